@@ -0,0 +1,5864 @@
+// booktracer.cpp — libbooktracer implementation (see booktracer.h)
+// Dependencies: sqlite3, libcurl, nlohmann/json (header-only)
+
+#include "booktracer.h"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cctype>
+#include <chrono>
+#include <climits>
+#include <cstdint>
+#include <condition_variable>
+#include <coroutine>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <deque>
+#include <exception>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <future>
+#include <initializer_list>
+#include <iomanip>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <queue>
+#include <random>
+#include <regex>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#ifdef __linux__
+#include <sys/epoll.h>
+#endif
+#include <unistd.h>
+#endif
+
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#define BOOKTRACER_AVX2 1
+#include <immintrin.h>
+#endif
+
+#include <sqlite3.h>
+#include <curl/curl.h>
+// nlohmann/json is header-only; ensure include path is set via vcpkg or your environment.
+#include <nlohmann/json.hpp>
+
+namespace booktracer {
+
+static std::atomic<bool> g_useGoogleBooks{true};  // can be turned off if check fails
+static std::atomic<bool> g_online{true};  // last connectivity check; offline ISBN lookups get queued
+
+std::string statusToStr(Status s) {
+    switch (s) {
+        case Status::ToRead:  return "To-Read";
+        case Status::Reading: return "Reading";
+        case Status::Finished:return "Finished";
+    }
+    return "To-Read";
+}
+std::optional<Status> strToStatus(const std::string& s) {
+    std::string t = s;
+    std::transform(t.begin(), t.end(), t.begin(), [](unsigned char c){ return std::tolower(c); });
+    if (t=="to-read" || t=="toread" || t=="todo" || t=="0") return Status::ToRead;
+    if (t=="reading" || t=="1") return Status::Reading;
+    if (t=="finished"|| t=="done" || t=="2") return Status::Finished;
+    return std::nullopt;
+}
+
+// Shared by the C++ side and the progress_pct()/eta_days() SQL functions.
+static inline double progressPct(long long currentPage, long long totalPages) {
+    if (totalPages <= 0) return 0.0;
+    return 100.0 * static_cast<double>(currentPage) / static_cast<double>(totalPages);
+}
+static inline std::optional<long long> etaDays(long long remaining, long long dailyRate) {
+    if (dailyRate <= 0 || remaining <= 0) return std::nullopt;
+    // ceil division:
+    return (remaining + dailyRate - 1) / dailyRate;
+}
+double percentComplete(const Book& b) {
+    return progressPct(b.currentPage, b.totalPages);
+}
+std::optional<int> daysToFinish(const Book& b, int dailyRate) {
+    auto d = etaDays(static_cast<long long>(b.totalPages) - b.currentPage, dailyRate);
+    if (!d) return std::nullopt;
+    return static_cast<int>(*d);
+}
+
+// ----------------------------- ISBN utilities ------------------------------
+static std::string onlyDigitsX(const std::string& s) {
+    std::string t; t.reserve(s.size());
+    for (char c: s) if (std::isdigit((unsigned char)c) || c=='X' || c=='x') t.push_back(c=='x'?'X':c);
+    return t;
+}
+static bool isIsbn10(const std::string& s) { return s.size()==10; }
+static bool isIsbn13(const std::string& s) { return s.size()==13; }
+
+// convert ISBN-10 to ISBN-13 (prefix 978 and recompute)
+static std::string isbn10to13(const std::string& s10) {
+    std::string core = "978" + s10.substr(0, 9);
+    int sum = 0;
+    for (int i=0;i<(int)core.size();++i) {
+        int d = core[i]-'0';
+        sum += (i%2==0) ? d : 3*d;
+    }
+    int cd = (10 - (sum % 10)) % 10;
+    return core + std::to_string(cd);
+}
+std::string normalizeIsbn(const std::string& in) {
+    std::string s = onlyDigitsX(in);
+    if (isIsbn13(s)) return s;
+    if (isIsbn10(s)) return isbn10to13(s);
+    return ""; // invalid
+}
+// Check-digit validation for an ISBN already passed through onlyDigitsX().
+static bool isbnChecksumOk(const std::string& s) {
+    if (isIsbn10(s)) {
+        int sum = 0;
+        for (int i=0;i<10;++i) {
+            char c = s[i];
+            if (c=='X' && i!=9) return false;
+            int d = (c=='X') ? 10 : c-'0';
+            sum += (10-i) * d;
+        }
+        return sum % 11 == 0;
+    }
+    if (isIsbn13(s)) {
+        int sum = 0;
+        for (int i=0;i<13;++i) {
+            if (s[i]=='X') return false;
+            sum += (i%2==0) ? s[i]-'0' : 3*(s[i]-'0');
+        }
+        return sum % 10 == 0;
+    }
+    return false;
+}
+
+// ----------------------------- Task executor -------------------------------
+// One process-wide work-stealing pool for everything that runs in parallel
+// (statement warm-up, startup probes, export sorting, ...). Each worker owns
+// a deque per priority: it pushes and pops its own work LIFO at the back, and
+// idle workers steal FIFO from the front of others. Threads that are not
+// workers submit through a shared injection queue. Long-lived loops (the
+// maintenance scheduler) keep their own thread and do not belong here.
+class CancelToken {
+public:
+    CancelToken() : flag_(std::make_shared<std::atomic<bool>>(false)) {}
+    void cancel() const { flag_->store(true, std::memory_order_relaxed); }
+    bool cancelled() const { return flag_->load(std::memory_order_relaxed); }
+private:
+    std::shared_ptr<std::atomic<bool>> flag_;
+};
+
+class Executor {
+public:
+    enum class Priority { High, Normal, Low, Count };
+
+    struct Stats { unsigned long long submitted = 0, executed = 0, stolen = 0, cancelled = 0; };
+
+    explicit Executor(unsigned threads = std::max(2u, std::thread::hardware_concurrency()))
+        : workers_(std::max(1u, threads)) {
+        for (size_t i = 0; i < workers_.size(); ++i)
+            workers_[i].thread = std::thread([this, i]{ run(i); });
+    }
+    ~Executor() {
+        { std::lock_guard<std::mutex> lk(sleepMu_); stop_ = true; }
+        sleepCv_.notify_all();
+        for (auto& w: workers_) if (w.thread.joinable()) w.thread.join();
+    }
+    Executor(const Executor&) = delete;
+    Executor& operator=(const Executor&) = delete;
+
+    static Executor& instance() { static Executor ex; return ex; }
+
+    size_t size() const { return workers_.size(); }
+
+    // Queues f and returns its future. A task whose token is cancelled before
+    // it starts is dropped; its future then reports std::future_error.
+    template <class F>
+    auto submit(F&& f, Priority prio = Priority::Normal, CancelToken tok = {})
+        -> std::future<std::invoke_result_t<std::decay_t<F>>> {
+        using R = std::invoke_result_t<std::decay_t<F>>;
+        auto task = std::make_shared<std::packaged_task<R()>>(std::forward<F>(f));
+        auto fut = task->get_future();
+        push([task]{ (*task)(); }, prio, std::move(tok));
+        return fut;
+    }
+
+    // Runs body(b, e) over [begin, end) in chunks of `grain`. The caller works
+    // on chunks too, so calling this from inside a task cannot deadlock. The
+    // remaining chunks are skipped once tok is cancelled or body throws (tok
+    // itself is never cancelled here); the first exception thrown by body is
+    // rethrown here after all started chunks finish.
+    void parallelFor(size_t begin, size_t end, size_t grain,
+                     const std::function<void(size_t, size_t)>& body,
+                     CancelToken tok = {}, Priority prio = Priority::Normal) {
+        if (begin >= end) return;
+        grain = std::max<size_t>(grain, 1);
+        size_t chunks = (end - begin + grain - 1) / grain;
+        if (chunks == 1) { if (!tok.cancelled()) body(begin, end); return; }
+
+        struct Range {
+            std::atomic<size_t> next, done{0};
+            size_t begin, end, grain;
+            std::function<void(size_t, size_t)> body;
+            CancelToken tok;
+            std::atomic<bool> failed{false};   // body threw: skip the rest
+            std::mutex mu;
+            std::condition_variable cv;
+            std::exception_ptr error;
+            // claims and runs chunks until none are left
+            void drain() {
+                for (size_t b; (b = next.fetch_add(grain)) < end;) {
+                    size_t e = std::min(end, b + grain);
+                    if (!tok.cancelled() && !failed.load(std::memory_order_relaxed)) {
+                        try { body(b, e); }
+                        catch (...) {
+                            std::lock_guard<std::mutex> lk(mu);
+                            if (!error) error = std::current_exception();
+                            failed.store(true, std::memory_order_relaxed);
+                        }
+                    }
+                    if (done.fetch_add(e - b) + (e - b) == end - this->begin) {
+                        std::lock_guard<std::mutex> lk(mu);
+                        cv.notify_all();
+                    }
+                }
+            }
+        };
+        auto r = std::make_shared<Range>();
+        r->next = begin; r->begin = begin; r->end = end; r->grain = grain;
+        r->body = body; r->tok = tok;
+
+        size_t helpers = std::min(chunks - 1, workers_.size());
+        for (size_t i = 0; i < helpers; ++i) push([r]{ r->drain(); }, prio, {});
+        r->drain();
+        {
+            std::unique_lock<std::mutex> lk(r->mu);
+            r->cv.wait(lk, [&]{ return r->done.load() == end - begin; });
+        }
+        if (r->error) std::rethrow_exception(r->error);
+    }
+
+    Stats stats() const {
+        Stats s;
+        s.submitted = submitted_.load(std::memory_order_relaxed);
+        s.executed  = executed_.load(std::memory_order_relaxed);
+        s.stolen    = stolen_.load(std::memory_order_relaxed);
+        s.cancelled = cancelled_.load(std::memory_order_relaxed);
+        return s;
+    }
+
+private:
+    static constexpr size_t kPrios = static_cast<size_t>(Priority::Count);
+
+    struct Task {
+        std::function<void()> fn;
+        CancelToken tok;
+    };
+    struct TaskQueue {
+        std::mutex mu;
+        std::deque<Task> q[kPrios];
+    };
+    struct Worker : TaskQueue {
+        std::thread thread;
+    };
+
+    std::vector<Worker> workers_;
+    TaskQueue inject_;
+    std::mutex sleepMu_;
+    std::condition_variable sleepCv_;
+    std::atomic<size_t> pending_{0};
+    bool stop_ = false;
+    std::atomic<unsigned long long> submitted_{0}, executed_{0}, stolen_{0}, cancelled_{0};
+
+    // Index of the calling worker in its pool, or -1 on other threads.
+    static int& workerIndex(const Executor* ex) {
+        thread_local const Executor* owner = nullptr;
+        thread_local int idx = -1;
+        if (owner != ex) { owner = ex; idx = -1; }
+        return idx;
+    }
+
+    void push(std::function<void()> fn, Priority prio, CancelToken tok) {
+        int self = workerIndex(this);
+        TaskQueue& tq = self >= 0 ? static_cast<TaskQueue&>(workers_[self]) : inject_;
+        {
+            std::lock_guard<std::mutex> lk(tq.mu);
+            tq.q[static_cast<size_t>(prio)].push_back(Task{std::move(fn), std::move(tok)});
+        }
+        submitted_.fetch_add(1, std::memory_order_relaxed);
+        pending_.fetch_add(1);
+        { std::lock_guard<std::mutex> lk(sleepMu_); }   // pairs with the wait predicate
+        sleepCv_.notify_one();
+    }
+
+    static bool popBack(TaskQueue& tq, size_t p, Task& out) {
+        std::lock_guard<std::mutex> lk(tq.mu);
+        if (tq.q[p].empty()) return false;
+        out = std::move(tq.q[p].back()); tq.q[p].pop_back();
+        return true;
+    }
+    static bool popFront(TaskQueue& tq, size_t p, Task& out) {
+        std::lock_guard<std::mutex> lk(tq.mu);
+        if (tq.q[p].empty()) return false;
+        out = std::move(tq.q[p].front()); tq.q[p].pop_front();
+        return true;
+    }
+
+    // Highest priority first; within a level: own deque, injected work, steal.
+    bool next(size_t self, Task& out) {
+        for (size_t p = 0; p < kPrios; ++p) {
+            if (popBack(workers_[self], p, out) || popFront(inject_, p, out)) return true;
+            for (size_t k = 1; k < workers_.size(); ++k) {
+                if (popFront(workers_[(self + k) % workers_.size()], p, out)) {
+                    stolen_.fetch_add(1, std::memory_order_relaxed);
+                    return true;
+                }
+            }
+        }
+        return false;
+    }
+
+    void run(size_t self) {
+        workerIndex(this) = static_cast<int>(self);
+        Task t;
+        while (true) {
+            if (next(self, t)) {
+                pending_.fetch_sub(1);
+                if (t.tok.cancelled()) cancelled_.fetch_add(1, std::memory_order_relaxed);
+                else { t.fn(); executed_.fetch_add(1, std::memory_order_relaxed); }
+                t = Task{};
+                continue;
+            }
+            std::unique_lock<std::mutex> lk(sleepMu_);
+            sleepCv_.wait(lk, [&]{ return stop_ || pending_.load() > 0; });
+            if (stop_ && pending_.load() == 0) return;
+        }
+    }
+};
+
+// ----------------------------- Metrics -------------------------------------
+// Process-wide counters behind the Prometheus textfile exporter (see
+// MetricsExporter). Recording is a relaxed atomic add or two; only the
+// exporter thread reads them, and it tolerates a slightly torn snapshot.
+namespace metrics {
+
+enum class Op { Add, AddMany, UpdateProgress, UpdateStatus, Remove, Get, List, Search,
+                ImportCsv, ImportCalibre, ImportOnix, ExportCsv, Forecast, LookupIsbn, ReverseLookup, Count };
+constexpr const char* kOpNames[] = {
+    "add", "add_many", "update_progress", "update_status", "remove", "get", "list", "search",
+    "import_csv", "import_calibre", "import_onix", "export_csv", "forecast", "lookup_isbn", "reverse_lookup"};
+static_assert(std::size(kOpNames) == static_cast<size_t>(Op::Count), "one name per Op");
+
+// Latency bucket upper bounds in ns; one more bucket takes the rest (+Inf).
+constexpr uint64_t kBucketNs[] = {
+    100'000, 250'000, 500'000, 1'000'000, 2'500'000, 5'000'000, 10'000'000, 25'000'000,
+    50'000'000, 100'000'000, 250'000'000, 500'000'000, 1'000'000'000, 2'500'000'000, 10'000'000'000};
+constexpr size_t kBuckets = std::size(kBucketNs);
+
+enum class Provider { OpenLibrary, GoogleBooks, OpenLibrarySearch, Count };
+constexpr const char* kProviderNames[] = {"openlibrary", "googlebooks", "openlibrary_search"};
+// Hit: the provider had the book; Miss: it answered without one; Error: no usable answer.
+enum class Outcome { Hit, Miss, Error, Count };
+constexpr const char* kOutcomeNames[] = {"hit", "miss", "error"};
+
+enum class Cache { ReverseLookup, Mirror, HttpConnection, Count };
+constexpr const char* kCacheNames[] = {"reverse_lookup", "mirror", "http_connection"};
+
+enum class Format { Csv, Calibre, Onix, Count };
+constexpr const char* kFormatNames[] = {"csv", "calibre", "onix"};
+
+template <class E> constexpr size_t idx(E e) { return static_cast<size_t>(e); }
+
+struct OpCounters {
+    std::atomic<uint64_t> errors{0}, nanos{0};
+    std::atomic<uint64_t> buckets[kBuckets + 1]{};     // not cumulative; summed on export
+};
+struct Registry {
+    OpCounters ops[idx(Op::Count)];
+    std::atomic<uint64_t> lookups[idx(Provider::Count)][idx(Outcome::Count)]{};
+    std::atomic<uint64_t> cache[idx(Cache::Count)][2]{};            // [miss, hit]
+    std::atomic<uint64_t> importRows[idx(Format::Count)]{}, importBytes[idx(Format::Count)]{};
+};
+// Constant-initialized, so recording never goes through a guard.
+static Registry g_registry;
+
+static void countLookup(Provider p, Outcome o) {
+    g_registry.lookups[idx(p)][idx(o)].fetch_add(1, std::memory_order_relaxed);
+}
+static void countCache(Cache c, bool hit) {
+    g_registry.cache[idx(c)][hit].fetch_add(1, std::memory_order_relaxed);
+}
+static void countImport(Format f, long long rows, unsigned long long bytes) {
+    g_registry.importRows[idx(f)].fetch_add(static_cast<uint64_t>(std::max(0LL, rows)), std::memory_order_relaxed);
+    g_registry.importBytes[idx(f)].fetch_add(bytes, std::memory_order_relaxed);
+}
+
+// Times one operation from construction to destruction. check() passes the
+// result through and counts false / negative / nullopt as an error.
+class OpTimer {
+public:
+    explicit OpTimer(Op op) : op_(op), t0_(std::chrono::steady_clock::now()) {}
+    ~OpTimer() {
+        auto ns = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - t0_).count());
+        OpCounters& c = g_registry.ops[idx(op_)];
+        size_t b = 0;
+        while (b < kBuckets && ns > kBucketNs[b]) ++b;
+        c.buckets[b].fetch_add(1, std::memory_order_relaxed);
+        c.nanos.fetch_add(ns, std::memory_order_relaxed);
+        if (failed_) c.errors.fetch_add(1, std::memory_order_relaxed);
+    }
+    OpTimer(const OpTimer&) = delete;
+    OpTimer& operator=(const OpTimer&) = delete;
+
+    bool check(bool ok) { failed_ = !ok; return ok; }
+    int  check(int n)   { failed_ = n < 0; return n; }
+    template <class T> std::optional<T> check(std::optional<T> v) { failed_ = !v; return v; }
+
+private:
+    Op op_;
+    std::chrono::steady_clock::time_point t0_;
+    bool failed_ = false;
+};
+
+} // namespace metrics
+
+// ----------------------------- Structured logging --------------------------
+// JSON-lines event log. A thread that logs gets its own single-producer ring
+// of fixed-size records; one drain thread polls every ring, formats and
+// writes. Rings start small and a thread that fills its ring moves to one
+// twice the size (the only allocations), so only bursty threads hold large
+// ones. A record that finds the largest ring full is dropped and counted, so
+// logging can never stall the caller.
+// While logging is off the level check is the only cost.
+namespace logging {
+
+using Level = LogLevel;
+constexpr const char* kLevelNames[] = {"debug", "info", "warn", "error"};
+
+static std::atomic<int> g_minLevel{static_cast<int>(Level::Off)};
+
+static bool enabled(Level l) { return static_cast<int>(l) >= g_minLevel.load(std::memory_order_relaxed); }
+
+// Keys must be string literals; string values are copied into the record.
+struct Field {
+    enum Type : uint8_t { Str, Int, Real, Bool };
+    const char* key;
+    Type type;
+    std::string_view s;
+    union { long long i; double d; };
+    Field(const char* k, std::string_view v) : key(k), type(Str), s(v), i(0) {}
+    Field(const char* k, const std::string& v) : key(k), type(Str), s(v), i(0) {}
+    Field(const char* k, const char* v) : key(k), type(Str), s(v ? v : ""), i(0) {}
+    Field(const char* k, bool v) : key(k), type(Bool), i(v) {}
+    template <class T, std::enable_if_t<std::is_integral_v<T> && !std::is_same_v<T, bool>, int> = 0>
+    Field(const char* k, T v) : key(k), type(Int), i(static_cast<long long>(v)) {}
+    Field(const char* k, double v) : key(k), type(Real), d(v) {}
+};
+
+struct Record {
+    static constexpr size_t kMaxFields = 8, kTextBytes = 240;
+    struct Slot { const char* key; Field::Type type; uint16_t off, len; union { long long i; double d; }; };
+    long long tsUs;
+    Level level;
+    const char* event;
+    uint8_t fields;
+    bool truncated;
+    Slot slot[kMaxFields];
+    char text[kTextBytes];
+};
+
+class Ring {
+public:
+    static constexpr size_t kMinCapacity = 16, kMaxCapacity = 1024;   // powers of two
+    Ring(int thread, size_t capacity) : thread_(thread), buf_(capacity) {}
+
+    // Producer side: the slot to fill, or null when full.
+    Record* claim() {
+        size_t t = tail_.load(std::memory_order_relaxed);
+        if (t - head_.load(std::memory_order_acquire) == buf_.size()) return nullptr;
+        return &buf_[t & (buf_.size() - 1)];
+    }
+    void publish() { tail_.store(tail_.load(std::memory_order_relaxed) + 1, std::memory_order_release); }
+    void dropOne() { dropped_.fetch_add(1, std::memory_order_relaxed); }
+    size_t capacity() const { return buf_.size(); }
+
+    // Consumer side.
+    template <class F> void drain(F&& f) {
+        size_t h = head_.load(std::memory_order_relaxed), t = tail_.load(std::memory_order_acquire);
+        for (; h != t; ++h) f(buf_[h & (buf_.size() - 1)]);
+        head_.store(h, std::memory_order_release);
+    }
+    bool empty() const { return head_.load(std::memory_order_acquire) == tail_.load(std::memory_order_acquire); }
+    unsigned long long takeDropped() { return dropped_.exchange(0, std::memory_order_relaxed); }
+    int thread() const { return thread_; }
+    std::atomic<bool> retired{false};   // owning thread has exited
+
+private:
+    int thread_;
+    std::vector<Record> buf_;
+    alignas(64) std::atomic<size_t> head_{0};
+    alignas(64) std::atomic<size_t> tail_{0};
+    std::atomic<unsigned long long> dropped_{0};
+};
+
+class Logger {
+public:
+    static Logger& instance() { static Logger l; return l; }
+    ~Logger() { stop(); }
+
+    bool start(const std::string& path, Level minLevel) {
+        stop();
+        std::lock_guard<std::mutex> lk(mu_);
+        out_ = path.empty() ? stderr : std::fopen(path.c_str(), "a");
+        if (!out_) return false;
+        stop_ = false;
+        thread_ = std::thread([this]{ run(); });
+        g_minLevel.store(static_cast<int>(minLevel), std::memory_order_relaxed);
+        return true;
+    }
+    // Drains what is queued, then closes the output.
+    void stop() {
+        g_minLevel.store(static_cast<int>(Level::Off), std::memory_order_relaxed);
+        {
+            std::lock_guard<std::mutex> lk(mu_);
+            stop_ = true;
+        }
+        cv_.notify_all();
+        if (thread_.joinable()) thread_.join();
+        std::lock_guard<std::mutex> lk(mu_);
+        if (out_ && out_ != stderr) std::fclose(out_);
+        out_ = nullptr;
+    }
+    LogStats stats() const {
+        return LogStats{written_.load(std::memory_order_relaxed), dropped_.load(std::memory_order_relaxed)};
+    }
+
+    // The calling thread's next free record, or null when it is dropped;
+    // fill it, then publish() on the returned ring.
+    Record* claim(Ring*& ring) {
+        Holder& h = holder();
+        if (!h.r) h.r = add(0, Ring::kMinCapacity);
+        if (Record* r = h.r->claim()) { ring = h.r.get(); return r; }
+        if (h.r->capacity() == Ring::kMaxCapacity) { h.r->dropOne(); return nullptr; }
+        // full: move to a larger ring; the old one is drained, then dropped as retired
+        auto bigger = add(h.r->thread(), h.r->capacity() * 2);
+        h.r->retired.store(true, std::memory_order_release);
+        h.r = std::move(bigger);
+        ring = h.r.get();
+        return h.r->claim();
+    }
+
+private:
+    static constexpr auto kPollEvery = std::chrono::milliseconds(20);
+
+    struct Holder {
+        std::shared_ptr<Ring> r;
+        ~Holder() { if (r) r->retired.store(true, std::memory_order_release); }
+    };
+    static Holder& holder() { thread_local Holder h; return h; }
+    // Registers a ring; thread 0 = a new thread id. Drained after the rings
+    // already registered, so a thread's old ring empties before its new one.
+    std::shared_ptr<Ring> add(int thread, size_t capacity) {
+        std::lock_guard<std::mutex> lk(mu_);
+        auto r = std::make_shared<Ring>(thread ? thread : nextThread_++, capacity);
+        rings_.push_back(r);
+        return r;
+    }
+
+    std::mutex mu_;
+    std::condition_variable cv_;
+    bool stop_ = true;
+    std::thread thread_;
+    std::FILE* out_ = nullptr;
+    std::vector<std::shared_ptr<Ring>> rings_;
+    int nextThread_ = 1;
+    std::atomic<unsigned long long> written_{0}, dropped_{0};
+
+    void run() {
+        std::string buf;
+        std::vector<std::pair<Record, int>> copies;          // (record, thread)
+        std::vector<std::pair<const Record*, int>> batch;
+        std::unique_lock<std::mutex> lk(mu_);
+        bool last = false;
+        while (!last) {
+            last = cv_.wait_for(lk, kPollEvery, [this]{ return stop_; });
+            auto rings = rings_;          // formatting runs without the lock
+            lk.unlock();
+            buf.clear();
+            batch.clear();
+            copies.clear();
+            unsigned long long dropped = 0;
+            // Copied out so each slot is free again right away; merged by time below.
+            for (auto& r: rings) {
+                r->drain([&](const Record& rec){ copies.emplace_back(rec, r->thread()); });
+                dropped += r->takeDropped();
+            }
+            for (const auto& [rec, thread]: copies) batch.emplace_back(&rec, thread);
+            std::stable_sort(batch.begin(), batch.end(), [](const auto& a, const auto& b){ return a.first->tsUs < b.first->tsUs; });
+            for (const auto& [rec, thread]: batch) format(buf, *rec, thread);
+            if (dropped) {
+                dropped_.fetch_add(dropped, std::memory_order_relaxed);
+                Record note{};
+                note.tsUs = nowUs();
+                note.level = Level::Warn;
+                note.event = "log_dropped";
+                note.fields = 1;
+                note.slot[0].key = "count";
+                note.slot[0].type = Field::Int;
+                note.slot[0].i = static_cast<long long>(dropped);
+                format(buf, note, 0);
+            }
+            lk.lock();
+            if (!buf.empty() && out_) {
+                std::fwrite(buf.data(), 1, buf.size(), out_);
+                std::fflush(out_);
+                written_.fetch_add(batch.size() + (dropped ? 1 : 0), std::memory_order_relaxed);
+            }
+            // a retired ring gets no new records; drop it once drained
+            rings_.erase(std::remove_if(rings_.begin(), rings_.end(), [](const std::shared_ptr<Ring>& r){
+                return r->retired.load(std::memory_order_acquire) && r->empty();
+            }), rings_.end());
+        }
+    }
+
+    static void escape(std::string& out, std::string_view s) {
+        static const char* hex = "0123456789abcdef";
+        for (unsigned char c: s) {
+            switch (c) {
+                case '"':  out += "\\\""; break;
+                case '\\': out += "\\\\"; break;
+                case '\n': out += "\\n"; break;
+                case '\r': out += "\\r"; break;
+                case '\t': out += "\\t"; break;
+                default:
+                    if (c < 0x20) { out += "\\u00"; out += hex[c >> 4]; out += hex[c & 15]; }
+                    else out += static_cast<char>(c);
+            }
+        }
+    }
+    static void format(std::string& out, const Record& r, int thread) {
+        std::time_t secs = static_cast<std::time_t>(r.tsUs / 1000000);
+        std::tm tm{};
+#ifdef _WIN32
+        gmtime_s(&tm, &secs);
+#else
+        gmtime_r(&secs, &tm);
+#endif
+        char ts[40];
+        size_t n = std::strftime(ts, sizeof ts, "%Y-%m-%dT%H:%M:%S", &tm);
+        std::snprintf(ts + n, sizeof ts - n, ".%06lldZ", r.tsUs % 1000000);
+        out += "{\"ts\":\""; out += ts;
+        out += "\",\"level\":\""; out += kLevelNames[static_cast<int>(r.level)];
+        out += "\",\"event\":\""; escape(out, r.event);
+        out += "\",\"thread\":"; out += std::to_string(thread);
+        for (uint8_t i = 0; i < r.fields; ++i) {
+            const Record::Slot& s = r.slot[i];
+            out += ",\""; escape(out, s.key); out += "\":";
+            switch (s.type) {
+                case Field::Str:  out += '"'; escape(out, std::string_view(r.text + s.off, s.len)); out += '"'; break;
+                case Field::Int:  out += std::to_string(s.i); break;
+                case Field::Bool: out += s.i ? "true" : "false"; break;
+                case Field::Real: {
+                    char d[32];
+                    std::snprintf(d, sizeof d, "%.6g", std::isfinite(s.d) ? s.d : 0.0);
+                    out += d;
+                    break;
+                }
+            }
+        }
+        if (r.truncated) out += ",\"truncated\":true";
+        out += "}\n";
+    }
+
+public:
+    static long long nowUs() {
+        return std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::system_clock::now().time_since_epoch()).count();
+    }
+};
+
+// Queues one event; strings beyond the record's text space are cut short.
+static void log(Level level, const char* event, std::initializer_list<Field> fields = {}) {
+    if (!enabled(level)) return;
+    Ring* ring = nullptr;
+    Record* r = Logger::instance().claim(ring);
+    if (!r) return;
+    r->tsUs = Logger::nowUs();
+    r->level = level;
+    r->event = event;
+    r->fields = 0;
+    r->truncated = false;
+    size_t used = 0;
+    for (const Field& f: fields) {
+        if (r->fields == Record::kMaxFields) { r->truncated = true; break; }
+        Record::Slot& s = r->slot[r->fields++];
+        s.key = f.key;
+        s.type = f.type;
+        if (f.type == Field::Str) {
+            size_t n = std::min(f.s.size(), Record::kTextBytes - used);
+            if (n < f.s.size()) r->truncated = true;
+            std::memcpy(r->text + used, f.s.data(), n);
+            s.off = static_cast<uint16_t>(used);
+            s.len = static_cast<uint16_t>(n);
+            used += n;
+        } else if (f.type == Field::Real) {
+            s.d = f.d;
+        } else {
+            s.i = f.i;
+        }
+    }
+    ring->publish();
+}
+
+} // namespace logging
+
+bool startLogging(const std::string& path, LogLevel minLevel) {
+    if (minLevel == LogLevel::Off) { stopLogging(); return true; }
+    return logging::Logger::instance().start(path, minLevel);
+}
+void stopLogging() { logging::Logger::instance().stop(); }
+LogStats logStats() { return logging::Logger::instance().stats(); }
+std::optional<LogLevel> logLevelFromStr(std::string s) {
+    std::transform(s.begin(), s.end(), s.begin(), [](unsigned char c){ return std::tolower(c); });
+    if (s == "debug") return LogLevel::Debug;
+    if (s == "info")  return LogLevel::Info;
+    if (s == "warn" || s == "warning") return LogLevel::Warn;
+    if (s == "error") return LogLevel::Error;
+    if (s == "off")   return LogLevel::Off;
+    return std::nullopt;
+}
+
+// ----------------------------- Streaming JSON fields -----------------------
+// Incremental scanner that pulls a few string fields out of a JSON document
+// as bytes arrive, so a transfer can be cut short once they are all known.
+// Paths are dot-separated keys with numeric array indexes, e.g.
+// "items.0.volumeInfo.title". Only string values are captured; everything
+// else is skipped without building a tree.
+class JsonFieldScanner {
+public:
+    static constexpr size_t kMaxValue = 4096;   // longer values are truncated
+    static constexpr size_t kMaxDepth = 64;
+
+    explicit JsonFieldScanner(const std::vector<std::string>& paths) : values_(paths.size()) {
+        for (const auto& p: paths) {
+            std::vector<std::string> segs;
+            std::string seg;
+            std::istringstream ss(p);
+            while (std::getline(ss, seg, '.')) segs.push_back(seg);
+            targets_.push_back(std::move(segs));
+        }
+    }
+
+    // Returns false once the input is known to be malformed.
+    bool feed(const char* p, size_t n) {
+        for (const char* end = p + n; p < end && st_ != St::Error; ++p) step(*p);
+        return st_ != St::Error;
+    }
+    bool complete() const { return found_ == targets_.size(); }
+    const std::optional<std::string>& field(size_t i) const { return values_[i]; }
+
+private:
+    enum class St { Value, ValueOrEnd, KeyOrEnd, Key, Colon, String, Literal, After, Done, Error };
+    struct Frame { bool object; std::string key; size_t index = 0; };
+
+    std::vector<std::vector<std::string>> targets_;
+    std::vector<std::optional<std::string>> values_;
+    size_t found_ = 0;
+    std::vector<Frame> stack_;
+    St st_ = St::Value;
+
+    // current string token
+    bool isKey_ = false, escape_ = false;
+    int capture_ = -1;          // target index being captured, -1 = skip
+    int hexLeft_ = 0;
+    unsigned hex_ = 0, highSurrogate_ = 0;
+    std::string tok_;
+
+    static bool ws(char c) { return c == ' ' || c == '\t' || c == '\n' || c == '\r'; }
+
+    int matchTarget() const {
+        for (size_t t = 0; t < targets_.size(); ++t) {
+            if (values_[t] || targets_[t].size() != stack_.size()) continue;
+            bool same = true;
+            for (size_t d = 0; same && d < stack_.size(); ++d) {
+                const Frame& f = stack_[d];
+                same = f.object ? targets_[t][d] == f.key : targets_[t][d] == std::to_string(f.index);
+            }
+            if (same) return static_cast<int>(t);
+        }
+        return -1;
+    }
+
+    void beginString(bool key) {
+        isKey_ = key; escape_ = false; hexLeft_ = 0; highSurrogate_ = 0;
+        capture_ = key ? -1 : matchTarget();
+        tok_.clear();
+        st_ = St::String;
+    }
+    void put(char c) {
+        if ((isKey_ || capture_ >= 0) && tok_.size() < (isKey_ ? 256 : kMaxValue)) tok_.push_back(c);
+    }
+    void putCodepoint(unsigned cp) {
+        if (cp < 0x80) put(static_cast<char>(cp));
+        else if (cp < 0x800) { put(static_cast<char>(0xC0 | (cp >> 6))); put(static_cast<char>(0x80 | (cp & 0x3F))); }
+        else if (cp < 0x10000) {
+            put(static_cast<char>(0xE0 | (cp >> 12)));
+            put(static_cast<char>(0x80 | ((cp >> 6) & 0x3F))); put(static_cast<char>(0x80 | (cp & 0x3F)));
+        } else {
+            put(static_cast<char>(0xF0 | (cp >> 18))); put(static_cast<char>(0x80 | ((cp >> 12) & 0x3F)));
+            put(static_cast<char>(0x80 | ((cp >> 6) & 0x3F))); put(static_cast<char>(0x80 | (cp & 0x3F)));
+        }
+    }
+    void endString() {
+        if (isKey_) { stack_.back().key = std::move(tok_); st_ = St::Colon; return; }
+        if (capture_ >= 0) { values_[capture_] = std::move(tok_); ++found_; }
+        endValue();
+    }
+    void endValue() { st_ = stack_.empty() ? St::Done : St::After; }
+    void open(bool object) {
+        if (stack_.size() >= kMaxDepth) { st_ = St::Error; return; }
+        stack_.push_back(Frame{object, {}, 0});
+        st_ = object ? St::KeyOrEnd : St::ValueOrEnd;
+    }
+    void close(bool object) {
+        if (stack_.empty() || stack_.back().object != object) { st_ = St::Error; return; }
+        stack_.pop_back();
+        endValue();
+    }
+
+    void stringChar(char c) {
+        if (hexLeft_) {
+            int v = (c >= '0' && c <= '9') ? c - '0' : (c >= 'a' && c <= 'f') ? c - 'a' + 10
+                  : (c >= 'A' && c <= 'F') ? c - 'A' + 10 : -1;
+            if (v < 0) { st_ = St::Error; return; }
+            hex_ = hex_ * 16 + static_cast<unsigned>(v);
+            if (--hexLeft_) return;
+            if (hex_ >= 0xD800 && hex_ < 0xDC00) { highSurrogate_ = hex_; return; }
+            if (hex_ >= 0xDC00 && hex_ < 0xE000 && highSurrogate_)
+                putCodepoint(0x10000 + ((highSurrogate_ - 0xD800) << 10) + (hex_ - 0xDC00));
+            else putCodepoint(hex_);
+            highSurrogate_ = 0;
+            return;
+        }
+        if (escape_) {
+            escape_ = false;
+            switch (c) {
+                case 'n': put('\n'); break;
+                case 't': put('\t'); break;
+                case 'r': put('\r'); break;
+                case 'b': put('\b'); break;
+                case 'f': put('\f'); break;
+                case 'u': hexLeft_ = 4; hex_ = 0; break;
+                default:  put(c); break;   // \" \\ \/
+            }
+            return;
+        }
+        if (c == '\\') escape_ = true;
+        else if (c == '"') endString();
+        else put(c);
+    }
+
+    void step(char c) {
+        switch (st_) {
+            case St::String: stringChar(c); return;
+            case St::Literal:
+                if (c == ',' || c == ']' || c == '}' || ws(c)) { endValue(); step(c); }
+                return;
+            case St::ValueOrEnd:
+                if (ws(c)) return;
+                if (c == ']') { close(false); return; }
+                st_ = St::Value;
+                [[fallthrough]];
+            case St::Value:
+                if (ws(c)) return;
+                if (c == '{') open(true);
+                else if (c == '[') open(false);
+                else if (c == '"') beginString(false);
+                else if (c == '-' || (c >= '0' && c <= '9') || c == 't' || c == 'f' || c == 'n') st_ = St::Literal;
+                else st_ = St::Error;
+                return;
+            case St::KeyOrEnd:
+                if (ws(c)) return;
+                if (c == '}') { close(true); return; }
+                st_ = St::Key;
+                [[fallthrough]];
+            case St::Key:
+                if (ws(c)) return;
+                if (c == '"') beginString(true); else st_ = St::Error;
+                return;
+            case St::Colon:
+                if (ws(c)) return;
+                st_ = (c == ':') ? St::Value : St::Error;
+                return;
+            case St::After:
+                if (ws(c)) return;
+                if (c == ',') {
+                    if (stack_.back().object) st_ = St::Key;
+                    else { ++stack_.back().index; st_ = St::Value; }
+                }
+                else if (c == '}') close(true);
+                else if (c == ']') close(false);
+                else st_ = St::Error;
+                return;
+            case St::Done:
+                if (!ws(c)) st_ = St::Error;
+                return;
+            case St::Error:
+                return;
+        }
+    }
+};
+
+// ----------------------------- Connection reuse ----------------------------
+// libcurl keeps live connections in the easy handle that opened them, so
+// throwaway handles pay DNS + TCP + TLS on every request. HttpPool keeps idle
+// easy handles per host for the blocking client, and a share object gives
+// every handle (blocking and coroutine) one DNS cache and one TLS session
+// cache. The startup probes therefore leave warm connections behind for the
+// first lookup.
+class HttpPool {
+public:
+    static constexpr size_t kMaxIdlePerHost = 4;
+
+    static HttpPool& instance() { static HttpPool p; return p; }
+
+    // Idle handle that last talked to url's host, or a fresh one. Options are
+    // reset; live connections and caches survive.
+    CURL* acquire(const std::string& url, bool countAsUse = true) {
+        if (countAsUse)
+            lastUse_.store(std::chrono::steady_clock::now().time_since_epoch().count(), std::memory_order_relaxed);
+        std::string h = host(url);
+        {
+            std::lock_guard<std::mutex> lk(mu_);
+            auto it = idle_.find(h);
+            if (it != idle_.end() && !it->second.empty()) {
+                CURL* c = it->second.back();
+                it->second.pop_back();
+                curl_easy_reset(c);
+                return c;
+            }
+        }
+        return curl_easy_init();
+    }
+    void release(const std::string& url, CURL* c) {
+        if (!c) return;
+        {
+            std::lock_guard<std::mutex> lk(mu_);
+            auto& v = idle_[host(url)];
+            if (!closed_ && v.size() < kMaxIdlePerHost) { v.push_back(c); return; }
+        }
+        curl_easy_cleanup(c);
+    }
+
+    CURLSH* share() {
+        std::lock_guard<std::mutex> lk(mu_);
+        if (share_ || closed_) return share_;
+        share_ = curl_share_init();
+        if (!share_) return nullptr;
+        curl_share_setopt(share_, CURLSHOPT_LOCKFUNC, &HttpPool::lock);
+        curl_share_setopt(share_, CURLSHOPT_UNLOCKFUNC, &HttpPool::unlock);
+        curl_share_setopt(share_, CURLSHOPT_USERDATA, this);
+        curl_share_setopt(share_, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+        curl_share_setopt(share_, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+        return share_;
+    }
+
+    // Drops idle connections and the DNS/TLS caches. Only call it while no
+    // transfer is running: benchmarks use it to get a cold start, and
+    // shutdown() uses it before curl_global_cleanup.
+    void reset() {
+        std::unordered_map<std::string, std::vector<CURL*>> drop;
+        CURLSH* sh = nullptr;
+        {
+            std::lock_guard<std::mutex> lk(mu_);
+            drop.swap(idle_);
+            sh = std::exchange(share_, nullptr);
+        }
+        for (auto& [h, v]: drop) for (CURL* c: v) curl_easy_cleanup(c);
+        if (sh) curl_share_cleanup(sh);
+    }
+    void shutdown() {
+        { std::lock_guard<std::mutex> lk(mu_); closed_ = true; }
+        reset();
+    }
+
+    std::chrono::steady_clock::time_point lastUse() const {
+        return std::chrono::steady_clock::time_point(
+            std::chrono::steady_clock::duration(lastUse_.load(std::memory_order_relaxed)));
+    }
+
+    static std::string host(const std::string& url) {
+        size_t b = url.find("://");
+        b = (b == std::string::npos) ? 0 : b + 3;
+        size_t e = url.find_first_of("/?#", b);
+        return url.substr(b, e == std::string::npos ? std::string::npos : e - b);
+    }
+
+private:
+    std::mutex mu_;
+    bool closed_ = false;
+    std::unordered_map<std::string, std::vector<CURL*>> idle_;
+    CURLSH* share_ = nullptr;
+    std::mutex locks_[CURL_LOCK_DATA_LAST];
+    std::atomic<std::chrono::steady_clock::rep> lastUse_{0};
+
+    static void lock(CURL*, curl_lock_data d, curl_lock_access, void* self) {
+        static_cast<HttpPool*>(self)->locks_[d].lock();
+    }
+    static void unlock(CURL*, curl_lock_data d, void* self) {
+        static_cast<HttpPool*>(self)->locks_[d].unlock();
+    }
+};
+
+// ----------------------------- Fault injection -----------------------------
+// One draw per request, made before it reaches curl. Off by default, when
+// it costs a relaxed load.
+struct Fault {
+    enum Kind { None, Timeout, Status, Truncate };
+    Kind kind = None;
+    std::chrono::milliseconds delay{0};
+    long status = 0;            // Status: the synthetic answer
+    double cutAt = 1.0;         // Truncate: fraction of the body delivered
+};
+
+class FaultInjector {
+public:
+    static FaultInjector& instance() { static FaultInjector f; return f; }
+
+    void set(std::optional<FaultProfile> p) {
+        std::lock_guard<std::mutex> lk(mu_);
+        profile_ = std::move(p);
+        rng_.seed(profile_ ? profile_->seed : 1);
+        stats_ = {};
+        on_.store(profile_.has_value(), std::memory_order_relaxed);
+    }
+    std::optional<FaultProfile> profile() const { std::lock_guard<std::mutex> lk(mu_); return profile_; }
+    FaultStats stats() const { std::lock_guard<std::mutex> lk(mu_); return stats_; }
+
+    // HEAD requests have no body to cut.
+    Fault draw(bool headOnly) {
+        Fault f;
+        if (!on_.load(std::memory_order_relaxed)) return f;
+        std::lock_guard<std::mutex> lk(mu_);
+        if (!profile_) return f;
+        const FaultProfile& p = *profile_;
+        ++stats_.requests;
+        double ms = p.latencyMs;
+        if (ms > 0 && p.latencySigma > 0) ms *= std::exp(p.latencySigma * normal_(rng_));
+        double r = uniform_(rng_);
+        if ((r -= p.timeoutRate) < 0) {
+            f.kind = Fault::Timeout;
+            ms += p.timeoutMs;
+            ++stats_.timeouts;
+        } else if ((r -= p.serverErrorRate) < 0) {
+            f.kind = Fault::Status; f.status = 503;
+            ++stats_.serverErrors;
+        } else if ((r -= p.rateLimitRate) < 0) {
+            f.kind = Fault::Status; f.status = 429;
+            ++stats_.rateLimited;
+        } else if ((r -= p.truncateRate) < 0 && !headOnly) {
+            f.kind = Fault::Truncate; f.cutAt = uniform_(rng_);
+            ++stats_.truncated;
+        }
+        f.delay = std::chrono::milliseconds(std::llround(std::max(0.0, ms)));
+        stats_.delayMs += static_cast<double>(f.delay.count());
+        return f;
+    }
+
+private:
+    mutable std::mutex mu_;
+    std::atomic<bool> on_{false};
+    std::optional<FaultProfile> profile_;
+    std::mt19937_64 rng_{1};
+    std::uniform_real_distribution<double> uniform_{0.0, 1.0};
+    std::normal_distribution<double> normal_{0.0, 1.0};
+    FaultStats stats_;
+};
+
+static std::optional<FaultProfile> faultPreset(const std::string& name) {
+    FaultProfile p;
+    p.name = name;
+    if (name == "none") return p;
+    if (name == "slow")        { p.latencyMs = 150; p.latencySigma = 0.8; return p; }
+    if (name == "flaky")       { p.latencyMs = 20; p.latencySigma = 0.5; p.serverErrorRate = 0.10;
+                                 p.timeoutRate = 0.02; p.truncateRate = 0.03; return p; }
+    if (name == "ratelimited") { p.rateLimitRate = 0.30; return p; }
+    if (name == "truncated")   { p.truncateRate = 0.20; return p; }
+    if (name == "timeouts")    { p.timeoutRate = 0.05; return p; }
+    return std::nullopt;
+}
+
+std::vector<std::string> faultPresetNames() {
+    return {"none", "slow", "flaky", "ratelimited", "truncated", "timeouts"};
+}
+
+std::optional<FaultProfile> faultProfileFromStr(const std::string& spec) {
+    std::string s = spec;
+    std::transform(s.begin(), s.end(), s.begin(), [](unsigned char c){ return std::tolower(c); });
+    std::vector<std::string> parts;
+    std::stringstream ss(s);
+    for (std::string part; std::getline(ss, part, ',');) parts.push_back(part);
+    if (parts.empty()) return std::nullopt;
+    auto p = faultPreset(parts[0]);
+    if (!p) return std::nullopt;
+    for (size_t i = 1; i < parts.size(); ++i) {
+        size_t eq = parts[i].find('=');
+        if (eq == std::string::npos) return std::nullopt;
+        std::string key = parts[i].substr(0, eq), val = parts[i].substr(eq + 1);
+        try {
+            size_t used = 0;
+            if (key == "seed") {
+                p->seed = std::stoull(val, &used);
+            } else {
+                double v = std::stod(val, &used);
+                if (!std::isfinite(v) || v < 0) return std::nullopt;
+                if      (key == "latency")    p->latencyMs = v;
+                else if (key == "sigma")      p->latencySigma = v;
+                else if (key == "timeout")    p->timeoutRate = v;
+                else if (key == "timeout-ms") p->timeoutMs = static_cast<int>(std::min(v, 3600e3));
+                else if (key == "5xx")        p->serverErrorRate = v;
+                else if (key == "429")        p->rateLimitRate = v;
+                else if (key == "truncate")   p->truncateRate = v;
+                else return std::nullopt;
+            }
+            if (used != val.size()) return std::nullopt;
+        } catch (...) {
+            return std::nullopt;
+        }
+    }
+    if (p->timeoutRate + p->serverErrorRate + p->rateLimitRate + p->truncateRate > 1.0 + 1e-9)
+        return std::nullopt;
+    p->name = spec;
+    return p;
+}
+
+void setFaultProfile(std::optional<FaultProfile> profile) { FaultInjector::instance().set(std::move(profile)); }
+std::optional<FaultProfile> faultProfile() { return FaultInjector::instance().profile(); }
+FaultStats faultStats() { return FaultInjector::instance().stats(); }
+
+// ----------------------------- HTTP via curl -------------------------------
+// Where a transfer's bytes go. The body is capped at maxBytes; a non-2xx
+// status aborts before any body is read; with a scanner attached the
+// transfer stops as soon as every wanted field has been seen.
+static constexpr size_t kMaxHttpBody = 1u << 20;
+
+struct HttpSink {
+    CURL* curl = nullptr;
+    std::string* body = nullptr;          // null: do not keep the body
+    JsonFieldScanner* scan = nullptr;
+    size_t maxBytes = kMaxHttpBody;
+    size_t received = 0;
+    bool capped = false, satisfied = false;
+    double cutAt = 1.0;                   // injected truncation, see FaultInjector
+    size_t cutBytes = SIZE_MAX;
+    bool cut = false;
+    const std::atomic<bool>* cancel = nullptr;   // set: the transfer aborts once it turns true
+};
+
+// Blocking requests made on a thread that points this at a flag abort once
+// the flag turns true (a background worker being stopped).
+static thread_local const std::atomic<bool>* t_httpCancel = nullptr;
+
+// No provider may hold a request (or a thread joining it) forever.
+static constexpr long kHttpConnectTimeoutMs = 10000;
+static constexpr long kHttpTimeoutMs = 30000;
+
+// Once the scanner is satisfied, small leftovers are still read and dropped:
+// a transfer aborted mid-body closes its connection, which would cost the
+// next lookup a fresh TCP + TLS handshake.
+static constexpr size_t kDrainAfterSatisfied = 64 * 1024;
+// Where an injected truncation cuts a body of unknown length.
+static constexpr size_t kCutUnknownLength = 4096;
+
+static size_t curlWrite(char* ptr, size_t size, size_t nmemb, void* userdata) {
+    auto* s = static_cast<HttpSink*>(userdata);
+    size_t n = size*nmemb;
+    if (s->received == 0) {
+        long code = 0;
+        curl_easy_getinfo(s->curl, CURLINFO_RESPONSE_CODE, &code);
+        if (code < 200 || code >= 300) return 0;           // error page: not worth reading
+        if (s->cutAt < 1.0) {
+            curl_off_t len = -1;
+            curl_easy_getinfo(s->curl, CURLINFO_CONTENT_LENGTH_DOWNLOAD_T, &len);
+            s->cutBytes = static_cast<size_t>(s->cutAt * static_cast<double>(len > 0 ? len : kCutUnknownLength));
+        }
+    }
+    // a short count aborts the transfer, as a dropped connection would
+    if (n > s->cutBytes - s->received) { n = s->cutBytes - s->received; s->cut = true; }
+    s->received += n;
+    if (s->satisfied) return s->received > kDrainAfterSatisfied ? 0 : n;
+    if (s->received > s->maxBytes) { s->capped = true; return 0; }
+    if (s->body) s->body->append(ptr, n);
+    if (s->scan) {
+        if (!s->scan->feed(ptr, n)) return 0;
+        if (s->scan->complete()) { s->satisfied = true; return s->received > kDrainAfterSatisfied ? 0 : n; }
+    }
+    return n;
+}
+// curl calls this at least once a second, stalled or not.
+static int curlProgress(void* userdata, curl_off_t, curl_off_t, curl_off_t, curl_off_t) {
+    auto* s = static_cast<HttpSink*>(userdata);
+    return s->cancel && s->cancel->load(std::memory_order_relaxed) ? 1 : 0;
+}
+// Options shared by the blocking and the coroutine clients.
+static void configureEasy(CURL* curl, const std::string& url, HttpSink* sink) {
+    sink->curl = curl;
+    curl_easy_setopt(curl, CURLOPT_URL, url.c_str());
+    curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1L);
+    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, curlWrite);
+    curl_easy_setopt(curl, CURLOPT_WRITEDATA, sink);
+    // refuse oversized bodies up front when Content-Length is known
+    curl_easy_setopt(curl, CURLOPT_MAXFILESIZE_LARGE, static_cast<curl_off_t>(sink->maxBytes));
+    curl_easy_setopt(curl, CURLOPT_USERAGENT, "BookTracer/1.0");
+    curl_easy_setopt(curl, CURLOPT_NOSIGNAL, 1L);
+    curl_easy_setopt(curl, CURLOPT_TCP_KEEPALIVE, 1L);
+    curl_easy_setopt(curl, CURLOPT_CONNECTTIMEOUT_MS, kHttpConnectTimeoutMs);
+    curl_easy_setopt(curl, CURLOPT_TIMEOUT_MS, kHttpTimeoutMs);
+    curl_easy_setopt(curl, CURLOPT_XFERINFOFUNCTION, curlProgress);
+    curl_easy_setopt(curl, CURLOPT_XFERINFODATA, sink);
+    curl_easy_setopt(curl, CURLOPT_NOPROGRESS, sink->cancel ? 0L : 1L);
+    if (CURLSH* sh = HttpPool::instance().share()) curl_easy_setopt(curl, CURLOPT_SHARE, sh);
+}
+// A transfer cut short by the sink on purpose still counts as a success.
+static bool transferOk(CURLcode res, long code, const HttpSink& sink) {
+    return (res == CURLE_OK || sink.satisfied) && !sink.capped && code >= 200 && code < 300;
+}
+static bool httpPerform(const std::string& url, HttpSink& sink, bool headOnly = false, long* status = nullptr) {
+    Fault fault = FaultInjector::instance().draw(headOnly);
+    if (fault.delay.count() > 0) std::this_thread::sleep_for(fault.delay);
+    if (fault.kind == Fault::Timeout || fault.kind == Fault::Status) {
+        if (status) *status = fault.status;
+        return false;
+    }
+    sink.cutAt = fault.cutAt;
+    if (!sink.cancel) sink.cancel = t_httpCancel;
+    HttpPool& pool = HttpPool::instance();
+    CURL* curl = pool.acquire(url, !headOnly);
+    if (!curl) return false;
+    configureEasy(curl, url, &sink);
+    if (headOnly) curl_easy_setopt(curl, CURLOPT_NOBODY, 1L);
+    CURLcode res = curl_easy_perform(curl);
+    long code = 0, connects = 0;
+    curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &code);
+    curl_easy_getinfo(curl, CURLINFO_NUM_CONNECTS, &connects);
+    metrics::countCache(metrics::Cache::HttpConnection, res == CURLE_OK && connects == 0);
+    pool.release(url, curl);
+    if (status) *status = code;
+    if (res == CURLE_FILESIZE_EXCEEDED) sink.capped = true;
+    return transferOk(res, code, sink);
+}
+static std::optional<std::string> httpGet(const std::string& url, size_t maxBytes = kMaxHttpBody) {
+    std::string buf;
+    HttpSink sink;
+    sink.body = &buf;
+    sink.maxBytes = maxBytes;
+    if (!httpPerform(url, sink)) return std::nullopt;
+    return buf;
+}
+// 2xx check via HEAD: no body to download, and the connection stays in the
+// pool for the first real request to that host.
+static bool httpProbe(const std::string& url) {
+    HttpSink sink;
+    return httpPerform(url, sink, true);
+}
+// HEAD that only exists to open (or keep open) a pooled connection; any
+// HTTP status will do. Does not count as use for keep-warm purposes.
+static bool httpTouch(const std::string& url, const std::atomic<bool>* cancel = nullptr) {
+    HttpSink sink;
+    sink.cancel = cancel;
+    long status = 0;
+    httpPerform(url, sink, true, &status);
+    return status > 0;
+}
+// Streams the body through scan without keeping it.
+static bool httpGetFields(const std::string& url, JsonFieldScanner& scan, long* status = nullptr) {
+    HttpSink sink;
+    sink.scan = &scan;
+    return httpPerform(url, sink, false, status);
+}
+
+// Ultra-light internet probe (returns true on any 2xx)
+bool internetOk() {
+    // 204 No Content on success; our httpGet treats 2xx as OK
+    return httpProbe("https://www.google.com/generate_204");
+}
+
+// Quick Open Library ping (home page is fine; returns 200)
+static bool openLibraryOk() {
+    return httpProbe("https://openlibrary.org/");
+}
+
+// Key presence only (no network). For full check we’ll still call googleBooksReady().
+bool googleKeyPresent() {
+    const char* k = std::getenv("GOOGLE_BOOKS_API_KEY");
+    return k && *k;
+}
+
+// Quick Google Books API readiness check.
+// Returns true if key exists AND a tiny request succeeds (HTTP 2xx and no "error").
+static bool googleBooksReady() {
+    const char* key = std::getenv("GOOGLE_BOOKS_API_KEY");
+    if (!key || !*key) return false;  // no key
+
+    // Tiny request; OK even if totalItems==0
+    std::string url =
+        "https://www.googleapis.com/books/v1/volumes?q=isbn:0000000000000&maxResults=1&fields=totalItems&key=";
+    url += key;
+
+    if (auto body = httpGet(url)) {
+        try {
+            auto j = nlohmann::json::parse(*body);
+            if (j.contains("error")) return false;  // key invalid/blocked
+            return true;
+        } catch (...) {
+            return false; // not JSON -> treat as failure
+        }
+    }
+    return false; // network/HTTP error
+}
+
+
+// Open Library (no key)
+static std::string openLibraryIsbnUrl(const std::string& isbn13) {
+    return "https://openlibrary.org/isbn/" + isbn13 + ".json";
+}
+// author handling: Open Library authors usually need a 2nd request;
+// take by_statement if present, else leave blank and let Google fill.
+static JsonFieldScanner openLibraryScanner() { return JsonFieldScanner({"title", "by_statement"}); }
+static std::optional<LookupResult> openLibraryResult(const JsonFieldScanner& s) {
+    if (!s.field(0) || s.field(0)->empty()) return std::nullopt;
+    return LookupResult{*s.field(0), s.field(1).value_or("")};   // may have empty author, that's fine for now
+}
+
+// Google Books (needs key for higher reliability, but can work without)
+static std::string googleBooksIsbnUrl(const std::string& isbn13) {
+    const char* key = std::getenv("GOOGLE_BOOKS_API_KEY");
+    std::ostringstream oss;
+    oss << "https://www.googleapis.com/books/v1/volumes?q=isbn:" << isbn13
+        << "&maxResults=1&fields=items(volumeInfo(title,authors))";
+    if (key && *key) oss << "&key=" << key;
+    return oss.str();
+}
+static JsonFieldScanner googleBooksScanner() {
+    return JsonFieldScanner({"items.0.volumeInfo.title", "items.0.volumeInfo.authors.0"});
+}
+static std::optional<LookupResult> googleBooksResult(const JsonFieldScanner& s) {
+    LookupResult r{s.field(0).value_or(""), s.field(1).value_or("")};
+    if (r.title.empty() && r.author.empty()) return std::nullopt;
+    return r;
+}
+
+// Counts and logs one provider round trip. A 404 is the provider saying it
+// has no such book, not a failure.
+template <class R>
+static const R& noteLookup(metrics::Provider p, std::string_view key, bool ok, long status, const R& result) {
+    using metrics::Outcome;
+    Outcome o = result ? Outcome::Hit : ok || status == 404 ? Outcome::Miss : Outcome::Error;
+    metrics::countLookup(p, o);
+    logging::log(o == Outcome::Error ? logging::Level::Warn : logging::Level::Debug,
+                 o == Outcome::Error ? "lookup_failed" : "lookup",
+                 {{"provider", metrics::kProviderNames[metrics::idx(p)]}, {"key", key},
+                  {"result", metrics::kOutcomeNames[metrics::idx(o)]}, {"status", status}});
+    return result;
+}
+
+// One uncoalesced round trip per source; callers go through lookupIsbn.
+static std::optional<LookupResult> fetchIsbn(const std::string& isbn13) {
+    auto ol = openLibraryScanner();
+    long status = 0;
+    bool ok = httpGetFields(openLibraryIsbnUrl(isbn13), ol, &status);
+    if (auto r = noteLookup(metrics::Provider::OpenLibrary, isbn13, ok, status, ok ? openLibraryResult(ol) : std::nullopt))
+        return r;
+
+    if (g_useGoogleBooks) {
+        auto gb = googleBooksScanner();
+        ok = httpGetFields(googleBooksIsbnUrl(isbn13), gb, &status);
+        if (auto r = noteLookup(metrics::Provider::GoogleBooks, isbn13, ok, status, ok ? googleBooksResult(gb) : std::nullopt))
+            return r;
+    }
+
+    return std::nullopt;
+}
+
+// ----------------------------- Async HTTP (coroutines) ---------------------
+// Task<T> is a lazy coroutine: nothing runs until it is awaited (or handed to
+// HttpLoop::run/spawn), and the awaiting coroutine resumes by symmetric
+// transfer when it finishes.
+template <class T> class Task;
+
+namespace coro {
+struct PromiseBase {
+    std::coroutine_handle<> cont;
+    std::exception_ptr error;
+    std::suspend_always initial_suspend() noexcept { return {}; }
+    struct Final {
+        bool await_ready() noexcept { return false; }
+        template <class P>
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<P> h) noexcept {
+            auto c = h.promise().cont;
+            return c ? c : std::noop_coroutine();
+        }
+        void await_resume() noexcept {}
+    };
+    Final final_suspend() noexcept { return {}; }
+    void unhandled_exception() { error = std::current_exception(); }
+};
+template <class T> struct Promise : PromiseBase {
+    std::optional<T> value;
+    Task<T> get_return_object();
+    void return_value(T v) { value = std::move(v); }
+    T take() { if (error) std::rethrow_exception(error); return std::move(*value); }
+};
+template <> struct Promise<void> : PromiseBase {
+    Task<void> get_return_object();
+    void return_void() {}
+    void take() { if (error) std::rethrow_exception(error); }
+};
+} // namespace coro
+
+template <class T = void>
+class [[nodiscard]] Task {
+public:
+    using promise_type = coro::Promise<T>;
+    using Handle = std::coroutine_handle<promise_type>;
+
+    explicit Task(Handle h) : h_(h) {}
+    Task(Task&& o) noexcept : h_(std::exchange(o.h_, {})) {}
+    Task& operator=(Task&& o) noexcept { if (this != &o) { if (h_) h_.destroy(); h_ = std::exchange(o.h_, {}); } return *this; }
+    ~Task() { if (h_) h_.destroy(); }
+
+    bool await_ready() const noexcept { return !h_ || h_.done(); }
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting) noexcept {
+        h_.promise().cont = awaiting;
+        return h_;
+    }
+    T await_resume() { return h_.promise().take(); }
+
+private:
+    Handle h_;
+};
+
+namespace coro {
+template <class T> Task<T> Promise<T>::get_return_object() { return Task<T>(std::coroutine_handle<Promise<T>>::from_promise(*this)); }
+inline Task<void> Promise<void>::get_return_object() { return Task<void>(std::coroutine_handle<Promise<void>>::from_promise(*this)); }
+
+// Fire-and-forget frame that owns a Task until it completes.
+struct Detached {
+    struct promise_type {
+        Detached get_return_object() { return {}; }
+        std::suspend_never initial_suspend() noexcept { return {}; }
+        std::suspend_never final_suspend() noexcept { return {}; }
+        void return_void() {}
+        void unhandled_exception() {}
+    };
+};
+} // namespace coro
+
+struct HttpResponse {
+    CURLcode result = CURLE_OK;
+    long status = 0;
+    std::string body;          // empty when the request streamed into a scanner
+    bool capped = false;       // body exceeded the size cap and was dropped
+    bool satisfied = false;    // stopped early: the scanner had what it needed
+    bool ok() const {
+        return (result == CURLE_OK || satisfied) && !capped && status >= 200 && status < 300;
+    }
+};
+
+// Single-threaded event loop driving many transfers through one curl multi
+// handle. On Linux curl reports its sockets through CURLMOPT_SOCKETFUNCTION
+// into an epoll set and the loop feeds readiness back with
+// curl_multi_socket_action; elsewhere (Windows) it falls back to
+// curl_multi_poll. A suspended request costs one easy handle plus its body.
+// Requests delayed by fault injection wait on the loop's own timers.
+class HttpLoop {
+public:
+    static constexpr long kMaxHostConnections = 16;
+
+    HttpLoop() : multi_(curl_multi_init()) {
+        curl_multi_setopt(multi_, CURLMOPT_MAX_HOST_CONNECTIONS, kMaxHostConnections);
+#ifdef __linux__
+        epfd_ = epoll_create1(EPOLL_CLOEXEC);
+        curl_multi_setopt(multi_, CURLMOPT_SOCKETFUNCTION, &HttpLoop::onSocket);
+        curl_multi_setopt(multi_, CURLMOPT_SOCKETDATA, this);
+        curl_multi_setopt(multi_, CURLMOPT_TIMERFUNCTION, &HttpLoop::onTimer);
+        curl_multi_setopt(multi_, CURLMOPT_TIMERDATA, this);
+#endif
+    }
+    ~HttpLoop() {
+        curl_multi_cleanup(multi_);
+#ifdef __linux__
+        if (epfd_ >= 0) close(epfd_);
+#endif
+    }
+    HttpLoop(const HttpLoop&) = delete;
+    HttpLoop& operator=(const HttpLoop&) = delete;
+
+    // co_await loop.get(url) -> HttpResponse. With a scanner the body is
+    // streamed through it instead of being kept.
+    class GetAwaiter {
+    public:
+        GetAwaiter(HttpLoop& loop, std::string url, JsonFieldScanner* scan, size_t maxBytes)
+            : loop_(loop), url_(std::move(url)) {
+            sink_.scan = scan;
+            sink_.body = scan ? nullptr : &resp_.body;
+            sink_.maxBytes = maxBytes;
+        }
+        GetAwaiter(const GetAwaiter&) = delete;
+        ~GetAwaiter() {
+            if (timed_) loop_.timers_.erase(timer_);
+            if (!easy_) return;
+            if (added_) { curl_multi_remove_handle(loop_.multi_, easy_); --loop_.inFlight_; }
+            curl_easy_cleanup(easy_);
+        }
+        bool await_ready() {
+            fault_ = FaultInjector::instance().draw(false);
+            if (fault_.kind == Fault::Timeout || fault_.kind == Fault::Status) {
+                if (fault_.delay.count() > 0) return false;   // answered by the timer
+                answerFault();
+                return true;
+            }
+            sink_.cutAt = fault_.cutAt;
+            easy_ = curl_easy_init();
+            if (!easy_) { resp_.result = CURLE_FAILED_INIT; return true; }
+            configureEasy(easy_, url_, &sink_);
+            curl_easy_setopt(easy_, CURLOPT_PRIVATE, this);
+            return false;
+        }
+        void await_suspend(std::coroutine_handle<> h) {
+            waiter_ = h;
+            if (fault_.delay.count() > 0) {
+                timer_ = loop_.timers_.emplace(std::chrono::steady_clock::now() + fault_.delay, this);
+                timed_ = true;
+                return;
+            }
+            start();
+        }
+        HttpResponse await_resume() {
+            resp_.capped = sink_.capped || resp_.result == CURLE_FILESIZE_EXCEEDED;
+            resp_.satisfied = sink_.satisfied;
+            if (sink_.cut && resp_.result == CURLE_WRITE_ERROR) resp_.result = CURLE_PARTIAL_FILE;
+            return std::move(resp_);
+        }
+    private:
+        friend class HttpLoop;
+        using Timers = std::multimap<std::chrono::steady_clock::time_point, GetAwaiter*>;
+
+        void start() {
+            if (curl_multi_add_handle(loop_.multi_, easy_) != CURLM_OK) {
+                resp_.result = CURLE_FAILED_INIT;
+                loop_.ready_.push_back(waiter_);
+                return;
+            }
+            added_ = true;
+            ++loop_.inFlight_;
+        }
+        // A Timeout or Status fault stands in for the transfer.
+        void answerFault() {
+            if (fault_.kind == Fault::Timeout) resp_.result = CURLE_OPERATION_TIMEDOUT;
+            resp_.status = fault_.status;
+        }
+        // The injected delay is over.
+        void fire() {
+            timed_ = false;
+            if (fault_.kind == Fault::Timeout || fault_.kind == Fault::Status) {
+                answerFault();
+                loop_.ready_.push_back(waiter_);
+                return;
+            }
+            start();
+        }
+
+        HttpLoop& loop_;
+        std::string url_;
+        CURL* easy_ = nullptr;
+        bool added_ = false;
+        Fault fault_;
+        bool timed_ = false;
+        Timers::iterator timer_;
+        HttpSink sink_;
+        HttpResponse resp_;
+        std::coroutine_handle<> waiter_;
+    };
+    GetAwaiter get(std::string url, JsonFieldScanner* scan = nullptr, size_t maxBytes = kMaxHttpBody) {
+        return GetAwaiter(*this, std::move(url), scan, maxBytes);
+    }
+
+    // Queues a suspended coroutine to be resumed on the next turn of the loop.
+    void post(std::coroutine_handle<> h) { ready_.push_back(h); }
+
+    // Starts t now; it runs as the loop makes progress.
+    void spawn(Task<void> t) { ++live_; detach(std::move(t), live_); }
+
+    // Drives the loop until every spawned task has finished.
+    void run() {
+        while (live_ > 0) {
+            drainReady();
+            if (live_ == 0) break;
+            if (inFlight_ == 0 && ready_.empty() && timers_.empty()) break;   // nothing can make progress
+            step();
+        }
+    }
+
+    // Runs a single task to completion and returns its value.
+    template <class T>
+    T runSync(Task<T> t) {
+        if constexpr (std::is_void_v<T>) {
+            spawn(std::move(t));
+            run();
+        } else {
+            std::optional<T> out;
+            spawn([](Task<T> inner, std::optional<T>& o) -> Task<void> { o = co_await inner; }(std::move(t), out));
+            run();
+            return std::move(*out);
+        }
+    }
+
+    size_t inFlight() const { return inFlight_; }
+
+private:
+    CURLM* multi_;
+    size_t inFlight_ = 0;
+    size_t live_ = 0;
+    std::vector<std::coroutine_handle<>> ready_;
+    GetAwaiter::Timers timers_;
+#ifdef __linux__
+    int epfd_ = -1;
+    std::optional<std::chrono::steady_clock::time_point> deadline_;   // curl's timer
+
+    static int onSocket(CURL*, curl_socket_t s, int what, void* self, void*) {
+        int epfd = static_cast<HttpLoop*>(self)->epfd_;
+        if (what == CURL_POLL_REMOVE) { epoll_ctl(epfd, EPOLL_CTL_DEL, s, nullptr); return 0; }
+        epoll_event ev{};
+        ev.data.fd = s;
+        if (what & CURL_POLL_IN)  ev.events |= EPOLLIN;
+        if (what & CURL_POLL_OUT) ev.events |= EPOLLOUT;
+        if (epoll_ctl(epfd, EPOLL_CTL_MOD, s, &ev) != 0) epoll_ctl(epfd, EPOLL_CTL_ADD, s, &ev);
+        return 0;
+    }
+    static int onTimer(CURLM*, long timeoutMs, void* self) {
+        auto& d = static_cast<HttpLoop*>(self)->deadline_;
+        if (timeoutMs < 0) d.reset();
+        else d = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeoutMs);
+        return 0;
+    }
+#endif
+
+    static coro::Detached detach(Task<void> t, size_t& live) {
+        try { co_await t; } catch (...) {}
+        --live;
+    }
+
+    // Milliseconds until the first timer is due, rounded up, capped at cap.
+    int timerWaitMs(int cap) const {
+        if (timers_.empty()) return cap;
+        using namespace std::chrono;
+        auto left = duration_cast<microseconds>(timers_.begin()->first - steady_clock::now()).count();
+        return static_cast<int>(std::clamp<long long>((left + 999) / 1000, 0, cap));
+    }
+    void fireTimers() {
+        auto now = std::chrono::steady_clock::now();
+        while (!timers_.empty() && timers_.begin()->first <= now) {
+            GetAwaiter* a = timers_.begin()->second;
+            timers_.erase(timers_.begin());
+            a->fire();
+        }
+    }
+
+    void drainReady() {
+        while (!ready_.empty()) {
+            auto batch = std::move(ready_);
+            ready_.clear();
+            for (auto h: batch) h.resume();
+        }
+    }
+
+    // Waits for socket activity or curl's timer, then collects finished
+    // transfers and queues their coroutines.
+    void step() {
+        int running = 0;
+#ifdef __linux__
+        using namespace std::chrono;
+        int waitMs = 100;
+        if (deadline_) waitMs = static_cast<int>(std::clamp<long long>(
+            duration_cast<milliseconds>(*deadline_ - steady_clock::now()).count(), 0, 100));
+        waitMs = timerWaitMs(waitMs);
+        epoll_event evs[64];
+        int n = epoll_wait(epfd_, evs, 64, waitMs);
+        for (int i = 0; i < n; ++i) {
+            int flags = 0;
+            if (evs[i].events & EPOLLIN)  flags |= CURL_CSELECT_IN;
+            if (evs[i].events & EPOLLOUT) flags |= CURL_CSELECT_OUT;
+            if (evs[i].events & (EPOLLERR | EPOLLHUP)) flags |= CURL_CSELECT_ERR;
+            curl_multi_socket_action(multi_, evs[i].data.fd, flags, &running);
+        }
+        if (deadline_ && steady_clock::now() >= *deadline_) {
+            deadline_.reset();
+            curl_multi_socket_action(multi_, CURL_SOCKET_TIMEOUT, 0, &running);
+        }
+#else
+        curl_multi_perform(multi_, &running);
+        curl_multi_poll(multi_, nullptr, 0, timerWaitMs(100), nullptr);
+        curl_multi_perform(multi_, &running);
+#endif
+        fireTimers();
+        int left = 0;
+        while (CURLMsg* m = curl_multi_info_read(multi_, &left)) {
+            if (m->msg != CURLMSG_DONE) continue;
+            char* priv = nullptr;
+            curl_easy_getinfo(m->easy_handle, CURLINFO_PRIVATE, &priv);
+            auto* a = reinterpret_cast<GetAwaiter*>(priv);
+            a->added_ = false;
+            a->resp_.result = m->data.result;
+            curl_easy_getinfo(m->easy_handle, CURLINFO_RESPONSE_CODE, &a->resp_.status);
+            long connects = 0;
+            curl_easy_getinfo(m->easy_handle, CURLINFO_NUM_CONNECTS, &connects);
+            metrics::countCache(metrics::Cache::HttpConnection, m->data.result == CURLE_OK && connects == 0);
+            curl_multi_remove_handle(multi_, m->easy_handle);
+            --inFlight_;
+            ready_.push_back(a->waiter_);
+        }
+    }
+};
+
+static Task<std::optional<LookupResult>> fetchIsbnAsync(HttpLoop& http, std::string isbn13) {
+    auto ol = openLibraryScanner();
+    HttpResponse resp = co_await http.get(openLibraryIsbnUrl(isbn13), &ol);
+    if (auto r = noteLookup(metrics::Provider::OpenLibrary, isbn13, resp.ok(), resp.status,
+                             resp.ok() ? openLibraryResult(ol) : std::nullopt))
+        co_return r;
+
+    if (g_useGoogleBooks) {
+        auto gb = googleBooksScanner();
+        resp = co_await http.get(googleBooksIsbnUrl(isbn13), &gb);
+        if (auto r = noteLookup(metrics::Provider::GoogleBooks, isbn13, resp.ok(), resp.status,
+                                 resp.ok() ? googleBooksResult(gb) : std::nullopt))
+            co_return r;
+    }
+    co_return std::nullopt;
+}
+
+// ----------------------------- Single-flight lookups -----------------------
+// Concurrent lookups of the same ISBN-13 share one round trip: the first
+// caller (the leader) fetches, later callers wait for its result. Blocking
+// callers share a std::shared_future; coroutines on an HttpLoop park on the
+// flight and are resumed through the loop. The two kinds never wait on each
+// other, so a coroutine can never block its own loop. Results are not
+// cached once the flight lands.
+class LookupFlights {
+public:
+    static LookupFlights& instance() { static LookupFlights f; return f; }
+
+    std::optional<LookupResult> lookup(const std::string& isbn13) {
+        lookups_.fetch_add(1, std::memory_order_relaxed);
+        std::promise<std::optional<LookupResult>> lead;
+        std::shared_future<std::optional<LookupResult>> fut;
+        {
+            std::lock_guard<std::mutex> lk(mu_);
+            auto it = sync_.find(isbn13);
+            if (it != sync_.end()) {
+                coalesced_.fetch_add(1, std::memory_order_relaxed);
+                fut = it->second;
+            } else {
+                sync_.emplace(isbn13, lead.get_future().share());
+            }
+        }
+        if (fut.valid()) return fut.get();
+
+        fetches_.fetch_add(1, std::memory_order_relaxed);
+        std::optional<LookupResult> r;
+        try { r = fetchIsbn(isbn13); } catch (...) {}
+        {
+            std::lock_guard<std::mutex> lk(mu_);
+            sync_.erase(isbn13);
+        }
+        lead.set_value(r);
+        return r;
+    }
+
+    Task<std::optional<LookupResult>> lookupAsync(HttpLoop& http, std::string isbn13) {
+        lookups_.fetch_add(1, std::memory_order_relaxed);
+        AsyncKey key{&http, isbn13};
+        std::shared_ptr<AsyncFlight> flight;
+        bool leader = false;
+        {
+            std::lock_guard<std::mutex> lk(mu_);
+            auto it = async_.find(key);
+            if (it != async_.end()) flight = it->second;
+            else { async_.emplace(key, flight = std::make_shared<AsyncFlight>()); leader = true; }
+        }
+        if (!leader) {
+            coalesced_.fetch_add(1, std::memory_order_relaxed);
+            co_return co_await Join{flight};
+        }
+        fetches_.fetch_add(1, std::memory_order_relaxed);
+        std::optional<LookupResult> r;
+        try { r = co_await fetchIsbnAsync(http, isbn13); } catch (...) {}
+        {
+            std::lock_guard<std::mutex> lk(mu_);
+            async_.erase(key);
+        }
+        flight->result = r;
+        flight->done = true;
+        for (auto h: flight->waiters) http.post(h);
+        co_return r;
+    }
+
+    LookupStats stats() const {
+        LookupStats s;
+        s.lookups   = lookups_.load(std::memory_order_relaxed);
+        s.fetches   = fetches_.load(std::memory_order_relaxed);
+        s.coalesced = coalesced_.load(std::memory_order_relaxed);
+        return s;
+    }
+
+private:
+    // Only touched from the owning loop's thread once created.
+    struct AsyncFlight {
+        bool done = false;
+        std::optional<LookupResult> result;
+        std::vector<std::coroutine_handle<>> waiters;
+    };
+    struct Join {
+        std::shared_ptr<AsyncFlight> f;
+        bool await_ready() const noexcept { return f->done; }
+        void await_suspend(std::coroutine_handle<> h) { f->waiters.push_back(h); }
+        std::optional<LookupResult> await_resume() const { return f->result; }
+    };
+    using AsyncKey = std::pair<const HttpLoop*, std::string>;
+    struct AsyncKeyHash {
+        size_t operator()(const AsyncKey& k) const {
+            return std::hash<std::string>()(k.second) ^ std::hash<const void*>()(k.first);
+        }
+    };
+
+    std::mutex mu_;
+    std::unordered_map<std::string, std::shared_future<std::optional<LookupResult>>> sync_;
+    std::unordered_map<AsyncKey, std::shared_ptr<AsyncFlight>, AsyncKeyHash> async_;
+    std::atomic<unsigned long long> lookups_{0}, fetches_{0}, coalesced_{0};
+};
+
+std::optional<LookupResult> lookupIsbn(const std::string& rawIsbn) {
+    std::string isbn13 = normalizeIsbn(rawIsbn);
+    if (isbn13.empty()) return std::nullopt;
+    metrics::OpTimer t(metrics::Op::LookupIsbn);
+    return LookupFlights::instance().lookup(isbn13);
+}
+
+// Awaitable lookupIsbn: same sources and fallback order, but suspends on
+// the loop instead of blocking a thread.
+static Task<std::optional<LookupResult>> lookupIsbnAsync(HttpLoop& http, std::string rawIsbn) {
+    std::string isbn13 = normalizeIsbn(rawIsbn);
+    if (isbn13.empty()) co_return std::nullopt;
+    co_return co_await LookupFlights::instance().lookupAsync(http, std::move(isbn13));
+}
+
+// ----------------------------- Reverse lookup ------------------------------
+// Title/author -> ISBN through the Open Library search API. Queries are
+// normalized (ASCII case-folded, punctuation dropped, spaces collapsed) so
+// "The Hobbit " and "the hobbit." share one cache entry (see SqliteStorage's
+// reverse_lookup_cache).
+struct ReverseResult {
+    bool ok = false;                 // false: network/HTTP failure, nothing to cache
+    std::optional<ReverseHit> hit;   // nullopt: the search had no usable match
+};
+
+static std::string normalizeQueryText(const std::string& s) {
+    std::string out;
+    bool space = false;
+    for (unsigned char c: s) {
+        if (std::isalnum(c) || c >= 0x80) {
+            if (space && !out.empty()) out.push_back(' ');
+            out.push_back(static_cast<char>(std::tolower(c)));
+            space = false;
+        } else {
+            space = true;
+        }
+    }
+    return out;
+}
+static std::string reverseQueryKey(const std::string& title, const std::string& author) {
+    return normalizeQueryText(title) + '\x1f' + normalizeQueryText(author);
+}
+
+static std::string urlEncode(const std::string& s) {
+    static const char* hex = "0123456789ABCDEF";
+    std::string out;
+    for (unsigned char c: s) {
+        if (std::isalnum(c) || c == '-' || c == '_' || c == '.' || c == '~') out.push_back(static_cast<char>(c));
+        else if (c == ' ') out.push_back('+');
+        else { out.push_back('%'); out.push_back(hex[c >> 4]); out.push_back(hex[c & 15]); }
+    }
+    return out;
+}
+
+static constexpr int kReverseIsbnCandidates = 8;
+
+static std::string openLibrarySearchUrl(const std::string& title, const std::string& author) {
+    std::string url = "https://openlibrary.org/search.json?title=" + urlEncode(normalizeQueryText(title));
+    if (!normalizeQueryText(author).empty()) url += "&author=" + urlEncode(normalizeQueryText(author));
+    return url + "&limit=1&fields=title,author_name,isbn";
+}
+static JsonFieldScanner openLibrarySearchScanner() {
+    std::vector<std::string> paths{"docs.0.title", "docs.0.author_name.0"};
+    for (int i = 0; i < kReverseIsbnCandidates; ++i) paths.push_back("docs.0.isbn." + std::to_string(i));
+    return JsonFieldScanner(paths);
+}
+// First ISBN-13 among the candidates, else the first ISBN-10 converted.
+static std::optional<ReverseHit> openLibrarySearchResult(const JsonFieldScanner& s) {
+    std::string best;
+    for (int i = 0; i < kReverseIsbnCandidates; ++i) {
+        const auto& f = s.field(2 + i);
+        if (!f) continue;
+        std::string n = normalizeIsbn(*f);
+        if (n.empty()) continue;
+        if (onlyDigitsX(*f).size() == 13) { best = n; break; }
+        if (best.empty()) best = n;
+    }
+    if (best.empty()) return std::nullopt;
+    return ReverseHit{best, s.field(0).value_or(""), s.field(1).value_or("")};
+}
+
+static Task<ReverseResult> reverseLookupAsync(HttpLoop& http, std::string title, std::string author) {
+    ReverseResult r;
+    if (normalizeQueryText(title).empty()) { r.ok = true; co_return r; }
+    auto scan = openLibrarySearchScanner();
+    HttpResponse resp = co_await http.get(openLibrarySearchUrl(title, author), &scan);
+    r.ok = resp.ok();
+    if (r.ok) r.hit = openLibrarySearchResult(scan);
+    noteLookup(metrics::Provider::OpenLibrarySearch, title + " / " + author, r.ok, resp.status, r.hit);
+    co_return r;
+}
+
+// ----------------------------- Connection keep-warm ------------------------
+// Servers and curl both drop idle connections (curl after ~2 minutes), so
+// the connections left by the startup probes would go cold before a
+// lookup that comes later in the session. The warmer sends a HEAD to each
+// provider every interval, but only while the session is active (a lookup
+// or startup within idleStop), so an idle CLI stops generating traffic.
+static std::vector<std::string> providerWarmUrls() {
+    std::vector<std::string> urls{"https://openlibrary.org/"};
+    if (g_useGoogleBooks) urls.push_back("https://www.googleapis.com/books/v1/");
+    return urls;
+}
+
+class ConnectionWarmer {
+public:
+    struct Options {
+        std::chrono::seconds interval{45};
+        std::chrono::seconds idleStop{600};
+    };
+
+    ConnectionWarmer(std::vector<std::string> urls, Options opt) : urls_(std::move(urls)), opt_(opt) {}
+    ~ConnectionWarmer() { stop(); }
+    ConnectionWarmer(const ConnectionWarmer&) = delete;
+    ConnectionWarmer& operator=(const ConnectionWarmer&) = delete;
+
+    // Warms every provider right away (in the background), then keeps them warm.
+    void start() {
+        if (thread_.joinable()) return;
+        started_ = std::chrono::steady_clock::now();
+        thread_ = std::thread([this]{ run(); });
+    }
+    // Also aborts a touch in flight, within about a second.
+    void stop() {
+        { std::lock_guard<std::mutex> lk(mu_); stop_ = true; }
+        cancel_.store(true, std::memory_order_relaxed);
+        cv_.notify_all();
+        if (thread_.joinable()) thread_.join();
+    }
+    unsigned long long pings() const { return pings_.load(std::memory_order_relaxed); }
+
+private:
+    std::vector<std::string> urls_;
+    Options opt_;
+    std::chrono::steady_clock::time_point started_;
+    std::thread thread_;
+    std::mutex mu_;
+    std::condition_variable cv_;
+    bool stop_ = false;
+    std::atomic<bool> cancel_{false};
+    std::atomic<unsigned long long> pings_{0};
+
+    void run() {
+        std::unique_lock<std::mutex> lk(mu_);
+        while (!stop_) {
+            auto active = std::max(started_, HttpPool::instance().lastUse());
+            if (std::chrono::steady_clock::now() - active < opt_.idleStop) {
+                lk.unlock();
+                for (const auto& u: urls_) {
+                    if (cancel_.load(std::memory_order_relaxed)) break;
+                    httpTouch(u, &cancel_);
+                    pings_.fetch_add(1, std::memory_order_relaxed);
+                }
+                lk.lock();
+            }
+            cv_.wait_for(lk, opt_.interval, [this]{ return stop_; });
+        }
+    }
+};
+
+// ----------------------------- Streaming XML (ONIX) ------------------------
+// Pull-style XML reader: the file is read in fixed-size chunks and events are
+// produced one at a time, so memory stays bounded however large the feed is.
+// Only what ONIX needs is supported: elements, text, CDATA and entities;
+// attributes, comments, PIs and DOCTYPE are skipped. Namespace prefixes are dropped.
+class XmlPullReader {
+public:
+    enum class Event { Start, End, Text, Eof };
+    static constexpr size_t kChunk   = 64 * 1024;
+    static constexpr size_t kMaxText = 64 * 1024;   // longer text nodes are truncated
+
+    explicit XmlPullReader(const std::string& path)
+        : in_(path, std::ios::binary), buf_(kChunk) {}
+    bool ok() const { return in_.is_open(); }
+
+    Event next() {
+        if (pendingEnd_) { pendingEnd_ = false; return Event::End; }
+        while (true) {
+            int c = peek();
+            if (c < 0) return Event::Eof;
+            if (c != '<') {
+                readText();
+                if (!blank(text_)) return Event::Text;
+                continue;
+            }
+            get();
+            c = peek();
+            if (c == '/') {
+                get(); readName(); skipPast('>');
+                return Event::End;
+            }
+            if (c == '?') { skipPast("?>"); continue; }
+            if (c == '!') {
+                get();
+                if (consume("--"))      { skipPast("-->"); continue; }
+                if (consume("[CDATA[")) { readUntil("]]>"); if (!text_.empty()) return Event::Text; continue; }
+                skipDoctype(); continue;
+            }
+            readName();
+            skipAttributes();
+            return Event::Start;
+        }
+    }
+    const std::string& name() const { return name_; }
+    const std::string& text() const { return text_; }
+    uint64_t bytesRead() const { return consumed_; }
+
+private:
+    std::ifstream in_;
+    std::vector<char> buf_;
+    size_t pos_ = 0, len_ = 0;
+    uint64_t consumed_ = 0;
+    std::string name_, text_;
+    bool pendingEnd_ = false;
+
+    int peek() {
+        if (pos_ == len_) {
+            in_.read(buf_.data(), static_cast<std::streamsize>(buf_.size()));
+            len_ = static_cast<size_t>(in_.gcount()); pos_ = 0;
+            if (len_ == 0) return -1;
+        }
+        return static_cast<unsigned char>(buf_[pos_]);
+    }
+    int get() { int c = peek(); if (c >= 0) { ++pos_; ++consumed_; } return c; }
+
+    static bool blank(const std::string& s) {
+        for (unsigned char c: s) if (!std::isspace(c)) return false;
+        return true;
+    }
+    bool consume(const char* lit) {
+        // Only called right after "<!", where a mismatch just means "skip the tag".
+        for (const char* p = lit; *p; ++p) {
+            if (peek() != static_cast<unsigned char>(*p)) return false;
+            get();
+        }
+        return true;
+    }
+    void skipPast(char end) { int c; while ((c = get()) >= 0 && c != end) {} }
+    void skipPast(const char* end) {
+        size_t n = std::strlen(end), m = 0;
+        int c;
+        while (m < n && (c = get()) >= 0) m = (c == end[m]) ? m + 1 : (c == end[0] ? 1 : 0);
+    }
+    void skipDoctype() {
+        int depth = 0, c;
+        while ((c = get()) >= 0) {
+            if (c == '[') ++depth;
+            else if (c == ']') --depth;
+            else if (c == '>' && depth <= 0) return;
+        }
+    }
+    void readName() {
+        name_.clear();
+        while (peek() >= 0) {
+            const char* b = buf_.data() + pos_;
+            const char* e = buf_.data() + len_;
+            const char* q = b;
+            while (q < e && *q != '>' && *q != '/' && *q != ':' && !std::isspace(static_cast<unsigned char>(*q))) ++q;
+            if (name_.size() < 128) name_.append(b, std::min<size_t>(q - b, 128 - name_.size()));
+            advance(q - b);
+            if (q == e) continue;
+            if (*q != ':') return;
+            get(); name_.clear();   // drop namespace prefix
+        }
+    }
+    void advance(size_t n) { pos_ += n; consumed_ += n; }
+    void skipAttributes() {
+        int c, quote = 0;
+        bool slash = false;
+        while ((c = get()) >= 0) {
+            if (quote) { if (c == quote) quote = 0; continue; }
+            if (c == '"' || c == '\'') quote = c;
+            else if (c == '>') break;
+            slash = (c == '/');
+        }
+        pendingEnd_ = slash;   // <Tag/> yields Start followed by End
+    }
+    void appendText(char c) { if (text_.size() < kMaxText) text_.push_back(c); }
+    void readText() {
+        text_.clear();
+        while (peek() >= 0) {
+            const char* b = buf_.data() + pos_;
+            const char* e = buf_.data() + len_;
+            const char* q = b;
+            while (q < e && *q != '<' && *q != '&') ++q;
+            if (text_.size() < kMaxText) text_.append(b, std::min<size_t>(q - b, kMaxText - text_.size()));
+            advance(q - b);
+            if (q == e) continue;
+            if (*q == '<') return;
+            get(); readEntity();
+        }
+    }
+    void readUntil(const char* end) {
+        text_.clear();
+        size_t n = std::strlen(end), m = 0;
+        int c;
+        while (m < n && (c = get()) >= 0) {
+            if (c == end[m]) { ++m; continue; }
+            for (size_t i = 0; i < m; ++i) appendText(end[i]);
+            m = 0;
+            if (c == end[0]) m = 1; else appendText(static_cast<char>(c));
+        }
+    }
+    void readEntity() {
+        std::string ent;
+        int c;
+        while ((c = peek()) >= 0 && c != ';' && c != '<' && ent.size() < 12) { get(); ent.push_back(static_cast<char>(c)); }
+        if (c != ';') { appendText('&'); for (char e: ent) appendText(e); return; }
+        get();
+        if (ent == "amp") appendText('&');
+        else if (ent == "lt") appendText('<');
+        else if (ent == "gt") appendText('>');
+        else if (ent == "quot") appendText('"');
+        else if (ent == "apos") appendText('\'');
+        else if (ent.size() > 1 && ent[0] == '#') {
+            unsigned long cp = 0;
+            try { cp = (ent[1]=='x' || ent[1]=='X') ? std::stoul(ent.substr(2), nullptr, 16) : std::stoul(ent.substr(1)); }
+            catch (...) { return; }
+            appendUtf8(cp);
+        }
+        // other named entities come from DTDs we don't load; drop them
+    }
+    void appendUtf8(unsigned long cp) {
+        if (cp < 0x80) appendText(static_cast<char>(cp));
+        else if (cp < 0x800) { appendText(static_cast<char>(0xC0 | (cp >> 6))); appendText(static_cast<char>(0x80 | (cp & 0x3F))); }
+        else if (cp < 0x10000) {
+            appendText(static_cast<char>(0xE0 | (cp >> 12)));
+            appendText(static_cast<char>(0x80 | ((cp >> 6) & 0x3F)));
+            appendText(static_cast<char>(0x80 | (cp & 0x3F)));
+        } else if (cp < 0x110000) {
+            appendText(static_cast<char>(0xF0 | (cp >> 18)));
+            appendText(static_cast<char>(0x80 | ((cp >> 12) & 0x3F)));
+            appendText(static_cast<char>(0x80 | ((cp >> 6) & 0x3F)));
+            appendText(static_cast<char>(0x80 | (cp & 0x3F)));
+        }
+    }
+};
+
+struct OnixProduct {
+    std::string isbn13;
+    std::string title;
+    std::vector<std::string> contributors;
+    int pages = 0;
+};
+
+// ONIX 3.0 product reader on top of XmlPullReader. Accepts both reference
+// (<ProductIdentifier>) and short (<productidentifier>, <b244>) tag names.
+// Fields of related products and collections (series) are ignored.
+class OnixReader {
+public:
+    explicit OnixReader(const std::string& path) : xml_(path) {}
+    bool ok() const { return xml_.ok(); }
+    uint64_t bytesRead() const { return xml_.bytesRead(); }
+
+    // Fills p with the next <Product>; false at end of file.
+    bool next(OnixProduct& p) {
+        using Ev = XmlPullReader::Event;
+        while (true) {
+            switch (xml_.next()) {
+            case Ev::Eof: return false;
+            case Ev::Start: {
+                Tag t = tagOf(xml_.name());
+                if (t == Tag::Product) { reset(); inProduct_ = true; }
+                if (t == Tag::Collection || t == Tag::RelatedMaterial) ++ignoreDepth_;
+                stack_.push_back(t);
+                break;
+            }
+            case Ev::Text:
+                if (inProduct_ && !ignoreDepth_ && !stack_.empty()) onText(stack_.back(), xml_.text());
+                break;
+            case Ev::End: {
+                if (stack_.empty()) break;
+                Tag t = stack_.back();
+                stack_.pop_back();
+                if (t == Tag::Collection || t == Tag::RelatedMaterial) --ignoreDepth_;
+                if (inProduct_ && onEnd(t)) { p = std::move(cur_); return true; }
+                break;
+            }
+            }
+        }
+    }
+
+private:
+    // Element names are interned once per start tag; everything else compares enums.
+    enum class Tag : unsigned char {
+        Other, Product, ProductIdentifier, ProductIDType, IDValue,
+        TitleText, TitlePrefix, TitleWithoutPrefix, Collection, RelatedMaterial,
+        Contributor, ContributorRole, PersonName, NamesBeforeKey, KeyNames, CorporateName,
+        Extent, ExtentType, ExtentValue, ExtentUnit,
+    };
+
+    XmlPullReader xml_;
+    std::vector<Tag> stack_;
+    int ignoreDepth_ = 0;
+    bool inProduct_ = false;
+    OnixProduct cur_;
+    // scratch for the composite currently open
+    std::string idType_, idValue_;
+    std::string titleText_, titlePrefix_, titleNoPrefix_;
+    std::string role_, personName_, namesBefore_, keyNames_, corporate_;
+    std::string extentType_, extentValue_, extentUnit_;
+    int extentRank_ = 0;
+    std::vector<std::string> authors_, others_;
+
+    static Tag tagOf(const std::string& name) {
+        static const std::unordered_map<std::string, Tag> tags = {
+            {"Product", Tag::Product},                       {"product", Tag::Product},
+            {"ProductIdentifier", Tag::ProductIdentifier},   {"productidentifier", Tag::ProductIdentifier},
+            {"ProductIDType", Tag::ProductIDType},           {"b221", Tag::ProductIDType},
+            {"IDValue", Tag::IDValue},                       {"b244", Tag::IDValue},
+            {"TitleText", Tag::TitleText},                   {"b203", Tag::TitleText},
+            {"TitlePrefix", Tag::TitlePrefix},               {"b030", Tag::TitlePrefix},
+            {"TitleWithoutPrefix", Tag::TitleWithoutPrefix}, {"b031", Tag::TitleWithoutPrefix},
+            {"Collection", Tag::Collection},                 {"collection", Tag::Collection},
+            {"RelatedMaterial", Tag::RelatedMaterial},       {"relatedmaterial", Tag::RelatedMaterial},
+            {"Contributor", Tag::Contributor},               {"contributor", Tag::Contributor},
+            {"ContributorRole", Tag::ContributorRole},       {"b035", Tag::ContributorRole},
+            {"PersonName", Tag::PersonName},                 {"b036", Tag::PersonName},
+            {"NamesBeforeKey", Tag::NamesBeforeKey},         {"b039", Tag::NamesBeforeKey},
+            {"KeyNames", Tag::KeyNames},                     {"b040", Tag::KeyNames},
+            {"CorporateName", Tag::CorporateName},           {"b047", Tag::CorporateName},
+            {"Extent", Tag::Extent},                         {"extent", Tag::Extent},
+            {"ExtentType", Tag::ExtentType},                 {"b218", Tag::ExtentType},
+            {"ExtentValue", Tag::ExtentValue},               {"b219", Tag::ExtentValue},
+            {"ExtentUnit", Tag::ExtentUnit},                 {"b220", Tag::ExtentUnit},
+        };
+        auto it = tags.find(name);
+        return it == tags.end() ? Tag::Other : it->second;
+    }
+
+    void reset() {
+        cur_ = OnixProduct{};
+        extentRank_ = 0;
+        authors_.clear(); others_.clear();
+        titleText_.clear(); titlePrefix_.clear(); titleNoPrefix_.clear();
+    }
+
+    void onText(Tag tag, const std::string& t) {
+        switch (tag) {
+        case Tag::ProductIDType:      idType_ = t; break;
+        case Tag::IDValue:            idValue_ = t; break;
+        case Tag::TitleText:          if (titleText_.empty()) titleText_ = t; break;
+        case Tag::TitlePrefix:        if (titlePrefix_.empty()) titlePrefix_ = t; break;
+        case Tag::TitleWithoutPrefix: if (titleNoPrefix_.empty()) titleNoPrefix_ = t; break;
+        case Tag::ContributorRole:    if (role_.empty()) role_ = t; break;
+        case Tag::PersonName:         personName_ = t; break;
+        case Tag::NamesBeforeKey:     namesBefore_ = t; break;
+        case Tag::KeyNames:           keyNames_ = t; break;
+        case Tag::CorporateName:      corporate_ = t; break;
+        case Tag::ExtentType:         extentType_ = t; break;
+        case Tag::ExtentValue:        extentValue_ = t; break;
+        case Tag::ExtentUnit:         extentUnit_ = t; break;
+        default: break;
+        }
+    }
+
+    // Returns true when a whole Product has been read.
+    bool onEnd(Tag tag) {
+        if (tag == Tag::Product) {
+            inProduct_ = false;
+            cur_.title = !titleText_.empty() ? titleText_
+                       : titlePrefix_.empty() ? titleNoPrefix_
+                       : titlePrefix_ + " " + titleNoPrefix_;
+            cur_.contributors = authors_.empty() ? std::move(others_) : std::move(authors_);
+            return true;
+        }
+        if (!ignoreDepth_) {
+            if (tag == Tag::ProductIdentifier && !stack_.empty() && stack_.back() == Tag::Product) {
+                std::string v = onlyDigitsX(idValue_);
+                // 15 = ISBN-13; 03 = GTIN-13, which is an ISBN when prefixed 978/979
+                if (idType_ == "15" || (idType_ == "03" && cur_.isbn13.empty() &&
+                                        (v.rfind("978", 0) == 0 || v.rfind("979", 0) == 0)))
+                    if (v.size() == 13) cur_.isbn13 = v;
+            } else if (tag == Tag::Contributor) {
+                std::string n = !personName_.empty() ? personName_
+                              : !keyNames_.empty()   ? (namesBefore_.empty() ? keyNames_ : namesBefore_ + " " + keyNames_)
+                              : corporate_;
+                if (!n.empty() && authors_.size() + others_.size() < 16)
+                    (role_ == "A01" ? authors_ : others_).push_back(std::move(n));
+            } else if (tag == Tag::Extent) {
+                // 00 main content, 11 content page count, 10 notional pages; unit 03 = pages
+                int rank = extentType_ == "00" ? 3 : extentType_ == "11" ? 2 : extentType_ == "10" ? 1 : 0;
+                if (rank > extentRank_ && (extentUnit_.empty() || extentUnit_ == "03")) {
+                    try { cur_.pages = std::max(0, std::stoi(extentValue_)); extentRank_ = rank; } catch (...) {}
+                }
+            }
+        }
+        if (tag == Tag::ProductIdentifier) { idType_.clear(); idValue_.clear(); }
+        else if (tag == Tag::Contributor) { role_.clear(); personName_.clear(); namesBefore_.clear(); keyNames_.clear(); corporate_.clear(); }
+        else if (tag == Tag::Extent) { extentType_.clear(); extentValue_.clear(); extentUnit_.clear(); }
+        return false;
+    }
+};
+
+// ----------------------------- Memory-mapped files -------------------------
+// Read-only view of a whole file. Falls back to ok()==false if mapping fails.
+class MappedFile {
+public:
+    explicit MappedFile(const std::string& path) {
+#ifdef _WIN32
+        HANDLE f = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr,
+                               OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+        if (f == INVALID_HANDLE_VALUE) return;
+        LARGE_INTEGER sz;
+        if (GetFileSizeEx(f, &sz)) {
+            size_ = static_cast<size_t>(sz.QuadPart);
+            if (size_ == 0) data_ = "";
+            else if (HANDLE m = CreateFileMappingA(f, nullptr, PAGE_READONLY, 0, 0, nullptr)) {
+                data_ = static_cast<const char*>(MapViewOfFile(m, FILE_MAP_READ, 0, 0, 0));
+                CloseHandle(m);   // the view keeps the mapping alive
+            }
+        }
+        CloseHandle(f);
+#else
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) return;
+        struct stat sb;
+        if (::fstat(fd, &sb) == 0) {
+            size_ = static_cast<size_t>(sb.st_size);
+            if (size_ == 0) data_ = "";
+            else {
+                void* p = ::mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+                if (p != MAP_FAILED) {
+                    ::madvise(p, size_, MADV_SEQUENTIAL);
+                    data_ = static_cast<const char*>(p);
+                }
+            }
+        }
+        ::close(fd);   // the mapping keeps the file alive
+#endif
+        if (!data_) size_ = 0;
+    }
+    ~MappedFile() {
+        if (!data_ || size_ == 0) return;
+#ifdef _WIN32
+        UnmapViewOfFile(data_);
+#else
+        ::munmap(const_cast<char*>(data_), size_);
+#endif
+    }
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    bool ok() const { return data_ != nullptr; }
+    const char* data() const { return data_; }
+    size_t size() const { return size_; }
+
+private:
+    const char* data_ = nullptr;
+    size_t size_ = 0;
+};
+
+// ----------------------------- Fast CSV scanning ---------------------------
+// Zero-copy CSV record scanner over an in-memory range (usually a MappedFile).
+// Fields are returned as spans into the buffer; only quoted fields containing
+// "" need unescaping, and that happens lazily in CsvField::str().
+// Handles quoted fields with embedded commas/newlines and CRLF line endings.
+struct CsvField {
+    const char* b = nullptr;
+    const char* e = nullptr;
+    bool escaped = false;   // contains "" pairs that must be collapsed
+
+    std::string str() const {
+        if (!escaped) return std::string(b, e);
+        std::string out; out.reserve(e - b);
+        for (const char* p = b; p < e; ++p) { out.push_back(*p); if (*p == '"') ++p; }
+        return out;
+    }
+};
+
+// Scans one record starting at p, advancing p past its line ending.
+// Returns false when p is already at end.
+static bool csvNextRecord(const char*& p, const char* end, std::vector<CsvField>& out) {
+    out.clear();
+    if (p >= end) return false;
+    while (true) {
+        CsvField f;
+        if (p < end && *p == '"') {
+            const char* q = ++p;
+            f.b = q;
+            while (true) {
+                q = static_cast<const char*>(std::memchr(q, '"', end - q));
+                if (!q) { q = end; break; }                      // unterminated: take the rest
+                if (q + 1 < end && q[1] == '"') { f.escaped = true; q += 2; continue; }
+                break;
+            }
+            f.e = q;
+            p = (q < end) ? q + 1 : end;
+            while (p < end && *p != ',' && *p != '\n') ++p;      // junk after closing quote
+        } else {
+            f.b = p;
+            while (p < end && *p != ',' && *p != '\n') ++p;
+            f.e = p;
+            if (f.e > f.b && f.e[-1] == '\r' && (p == end || *p == '\n')) --f.e;
+        }
+        out.push_back(f);
+        if (p >= end) return true;
+        if (*p++ == '\n') return true;
+    }
+}
+
+// ----------------------------- External merge sort -------------------------
+// Sorts (key, payload) records under a fixed memory budget: records collect in
+// memory until the budget is hit, then the run is sorted and spilled to a temp
+// file. finish() k-way merges the runs (at most kMaxFanIn at a time, so huge
+// inputs take extra passes) and streams payloads in key order. Keys compare
+// as raw bytes; callers encode them so that byte order is the order wanted.
+class ExternalSorter {
+public:
+    static constexpr size_t kMaxFanIn = 64;
+    static constexpr size_t kRecordOverhead = 2 * sizeof(std::string);
+
+    explicit ExternalSorter(size_t memBudgetBytes)
+        : budget_(std::max<size_t>(memBudgetBytes, 1 << 20)),
+          dir_(std::filesystem::temp_directory_path()),
+          tag_(std::to_string(std::chrono::steady_clock::now().time_since_epoch().count())) {}
+    ExternalSorter(const ExternalSorter&) = delete;
+    ExternalSorter& operator=(const ExternalSorter&) = delete;
+    ~ExternalSorter() {
+        std::error_code ec;
+        for (const auto& r: runs_) std::filesystem::remove(r, ec);
+    }
+
+    bool add(std::string key, std::string payload) {
+        used_ += key.size() + payload.size() + kRecordOverhead;
+        mem_.push_back({std::move(key), std::move(payload)});
+        return used_ < budget_ || spill();
+    }
+
+    // Streams every payload in key order; stops early if sink returns false.
+    bool finish(const std::function<bool(const std::string&)>& sink) {
+        if (runs_.empty()) {   // everything fit in memory
+            sortMem();
+            for (const auto& r: mem_) if (!sink(r.second)) return false;
+            mem_.clear();
+            return true;
+        }
+        if (!mem_.empty() && !spill()) return false;
+        while (runs_.size() > kMaxFanIn) {
+            // merge the oldest kMaxFanIn runs into one new run
+            std::vector<std::filesystem::path> group(runs_.begin(), runs_.begin() + kMaxFanIn);
+            runs_.erase(runs_.begin(), runs_.begin() + kMaxFanIn);
+            std::filesystem::path out = nextRunPath();
+            std::ofstream os(out, std::ios::binary | std::ios::trunc);
+            if (!os) return false;
+            bool ok = merge(group, [&](const std::string& k, const std::string& v){ writeRecord(os, k, v); return bool(os); });
+            os.close();
+            removeAll(group);
+            if (!ok || !os) return false;
+            runs_.push_back(out);
+            ++passes_;
+        }
+        bool ok = merge(runs_, [&](const std::string&, const std::string& v){ return sink(v); });
+        ++passes_;
+        removeAll(runs_);
+        runs_.clear();
+        return ok;
+    }
+
+    // Runs spilled from the input; intermediate merge outputs are not counted.
+    size_t runsSpilled() const { return spilled_; }
+    int mergePasses() const { return passes_; }
+
+private:
+    using Record = std::pair<std::string, std::string>;
+
+    struct RunReader {
+        std::ifstream in;
+        std::vector<char> buf;
+        std::string key, val;
+        bool next() { return readRecord(in, key, val); }
+    };
+
+    size_t budget_;
+    size_t used_ = 0;
+    std::filesystem::path dir_;
+    std::string tag_;
+    std::vector<Record> mem_;
+    std::vector<std::filesystem::path> runs_;
+    size_t spilled_ = 0;
+    size_t files_ = 0;
+    int passes_ = 0;
+
+    std::filesystem::path nextRunPath() {
+        return dir_ / ("booktracer_sort_" + tag_ + "_" + std::to_string(files_++) + ".run");
+    }
+    // Sorts the in-memory run: slices are sorted in parallel on the executor,
+    // then merged pairwise.
+    static constexpr size_t kParallelSortMin = 1 << 14;
+    void sortMem() {
+        auto less = [](const Record& a, const Record& b){ return a.first < b.first; };
+        Executor& ex = Executor::instance();
+        size_t n = mem_.size();
+        if (n < kParallelSortMin || ex.size() < 2) { std::sort(mem_.begin(), mem_.end(), less); return; }
+        size_t slice = (n + ex.size() - 1) / ex.size();
+        ex.parallelFor(0, n, slice, [&](size_t b, size_t e){ std::sort(mem_.begin() + b, mem_.begin() + e, less); });
+        for (size_t width = slice; width < n; width *= 2) {
+            ex.parallelFor(0, (n + 2 * width - 1) / (2 * width), 1, [&](size_t b, size_t e){
+                for (size_t i = b; i < e; ++i) {
+                    size_t lo = i * 2 * width, mid = std::min(n, lo + width), hi = std::min(n, lo + 2 * width);
+                    if (mid < hi) std::inplace_merge(mem_.begin() + lo, mem_.begin() + mid, mem_.begin() + hi, less);
+                }
+            });
+        }
+    }
+    bool spill() {
+        sortMem();
+        std::filesystem::path p = nextRunPath();
+        std::ofstream os(p, std::ios::binary | std::ios::trunc);
+        if (!os) return false;
+        for (const auto& r: mem_) writeRecord(os, r.first, r.second);
+        os.close();
+        if (!os) { std::error_code ec; std::filesystem::remove(p, ec); return false; }
+        runs_.push_back(p);
+        ++spilled_;
+        mem_.clear();
+        mem_.shrink_to_fit();
+        used_ = 0;
+        return true;
+    }
+    static void removeAll(const std::vector<std::filesystem::path>& files) {
+        std::error_code ec;
+        for (const auto& f: files) std::filesystem::remove(f, ec);
+    }
+
+    // Run file format: [u32 key length][key][u32 payload length][payload]...
+    static void writeRecord(std::ostream& os, const std::string& k, const std::string& v) {
+        uint32_t kl = static_cast<uint32_t>(k.size()), vl = static_cast<uint32_t>(v.size());
+        os.write(reinterpret_cast<const char*>(&kl), sizeof kl); os.write(k.data(), kl);
+        os.write(reinterpret_cast<const char*>(&vl), sizeof vl); os.write(v.data(), vl);
+    }
+    static bool readRecord(std::istream& is, std::string& k, std::string& v) {
+        uint32_t kl = 0, vl = 0;
+        if (!is.read(reinterpret_cast<char*>(&kl), sizeof kl)) return false;
+        k.resize(kl);
+        if (!is.read(k.data(), kl) || !is.read(reinterpret_cast<char*>(&vl), sizeof vl)) return false;
+        v.resize(vl);
+        return static_cast<bool>(is.read(v.data(), vl));
+    }
+
+    template <class Out>
+    bool merge(const std::vector<std::filesystem::path>& files, Out&& out) {
+        // split the budget between the input buffers
+        size_t bufSize = std::max<size_t>(budget_ / (files.size() + 1), 64 * 1024);
+        std::vector<std::unique_ptr<RunReader>> readers;
+        for (const auto& f: files) {
+            auto r = std::make_unique<RunReader>();
+            r->buf.resize(bufSize);
+            r->in.rdbuf()->pubsetbuf(r->buf.data(), static_cast<std::streamsize>(r->buf.size()));
+            r->in.open(f, std::ios::binary);
+            if (!r->in) return false;
+            readers.push_back(std::move(r));
+        }
+        auto greater = [&](size_t a, size_t b){ return readers[a]->key > readers[b]->key; };
+        std::priority_queue<size_t, std::vector<size_t>, decltype(greater)> heap(greater);
+        for (size_t i = 0; i < readers.size(); ++i) if (readers[i]->next()) heap.push(i);
+        while (!heap.empty()) {
+            size_t i = heap.top(); heap.pop();
+            if (!out(readers[i]->key, readers[i]->val)) return false;
+            if (readers[i]->next()) heap.push(i);
+        }
+        return true;
+    }
+};
+
+// ----------------------------- CSV virtual table ---------------------------
+// Read-only SQLite module exposing a CSV file as a table without importing it:
+//   CREATE VIRTUAL TABLE temp.t USING csvfile('path/to/file.csv');
+// The first record supplies the column names; every value is TEXT.
+// The file is memory-mapped and scanned with csvNextRecord().
+namespace csvvtab {
+
+struct Table {
+    sqlite3_vtab base{};
+    std::unique_ptr<MappedFile> file;
+    const char* data = nullptr;   // first data record (after the header)
+    const char* end = nullptr;
+    double estRows = 0;
+};
+
+struct Cursor {
+    sqlite3_vtab_cursor base{};
+    const char* next = nullptr;
+    std::vector<CsvField> fields;
+    sqlite3_int64 rowid = 0;
+    bool eof = true;
+};
+
+static std::string dequote(const char* arg) {
+    std::string s = arg;
+    if (s.size() >= 2 && (s.front() == '\'' || s.front() == '"') && s.back() == s.front()) {
+        char q = s.front();
+        std::string out;
+        for (size_t i = 1; i + 1 < s.size(); ++i) { out.push_back(s[i]); if (s[i] == q && s[i+1] == q) ++i; }
+        return out;
+    }
+    return s;
+}
+
+static int connect(sqlite3* db, void*, int argc, const char* const* argv, sqlite3_vtab** out, char** err) {
+    if (argc != 4) { *err = sqlite3_mprintf("csvfile: expected one argument, the CSV path"); return SQLITE_ERROR; }
+    std::string path = dequote(argv[3]);
+    auto file = std::make_unique<MappedFile>(path);
+    if (!file->ok()) { *err = sqlite3_mprintf("csvfile: cannot open %s", path.c_str()); return SQLITE_ERROR; }
+
+    const char* p = file->data();
+    const char* end = p + file->size();
+    if (end - p >= 3 && std::memcmp(p, "\xEF\xBB\xBF", 3) == 0) p += 3;   // UTF-8 BOM
+    std::vector<CsvField> header;
+    if (!csvNextRecord(p, end, header)) { *err = sqlite3_mprintf("csvfile: %s has no header", path.c_str()); return SQLITE_ERROR; }
+
+    std::string ddl = "CREATE TABLE x(";
+    std::vector<std::string> seen;
+    for (size_t i = 0; i < header.size(); ++i) {
+        std::string name = header[i].str();
+        if (name.empty() || std::find(seen.begin(), seen.end(), name) != seen.end())
+            name = "c" + std::to_string(i + 1);
+        seen.push_back(name);
+        char* q = sqlite3_mprintf("%s\"%w\"", i ? "," : "", name.c_str());
+        ddl += q; sqlite3_free(q);
+    }
+    ddl += ")";
+    int rc = sqlite3_declare_vtab(db, ddl.c_str());
+    if (rc != SQLITE_OK) { *err = sqlite3_mprintf("csvfile: bad header: %s", sqlite3_errmsg(db)); return rc; }
+#ifdef SQLITE_VTAB_DIRECTONLY
+    // reads any file it is pointed at: not from triggers or views in a db file
+    sqlite3_vtab_config(db, SQLITE_VTAB_DIRECTONLY);
+#endif
+
+    auto* t = new Table;
+    t->data = p;
+    t->end = end;
+    // Rough row estimate from the header width, good enough for join ordering.
+    double avg = std::max<double>(16.0, static_cast<double>(p - file->data()));
+    t->estRows = std::max(1.0, (end - p) / avg);
+    t->file = std::move(file);
+    *out = &t->base;
+    return SQLITE_OK;
+}
+
+static int disconnect(sqlite3_vtab* vt) { delete reinterpret_cast<Table*>(vt); return SQLITE_OK; }
+
+static int bestIndex(sqlite3_vtab* vt, sqlite3_index_info* info) {
+    // Only full scans; SQLite evaluates WHERE terms itself.
+    auto* t = reinterpret_cast<Table*>(vt);
+    info->estimatedCost = t->estRows;
+    info->estimatedRows = static_cast<sqlite3_int64>(t->estRows);
+    return SQLITE_OK;
+}
+
+static int open(sqlite3_vtab*, sqlite3_vtab_cursor** out) {
+    auto* c = new Cursor;
+    *out = &c->base;
+    return SQLITE_OK;
+}
+static int close(sqlite3_vtab_cursor* cur) { delete reinterpret_cast<Cursor*>(cur); return SQLITE_OK; }
+
+static int next(sqlite3_vtab_cursor* cur) {
+    auto* c = reinterpret_cast<Cursor*>(cur);
+    auto* t = reinterpret_cast<Table*>(cur->pVtab);
+    do {
+        c->eof = !csvNextRecord(c->next, t->end, c->fields);
+    } while (!c->eof && c->fields.size() == 1 && c->fields[0].b == c->fields[0].e);   // skip blank lines
+    if (!c->eof) ++c->rowid;
+    return SQLITE_OK;
+}
+
+static int filter(sqlite3_vtab_cursor* cur, int, const char*, int, sqlite3_value**) {
+    auto* c = reinterpret_cast<Cursor*>(cur);
+    c->next = reinterpret_cast<Table*>(cur->pVtab)->data;
+    c->rowid = 0;
+    return next(cur);
+}
+
+static int eof(sqlite3_vtab_cursor* cur) { return reinterpret_cast<Cursor*>(cur)->eof; }
+
+static int column(sqlite3_vtab_cursor* cur, sqlite3_context* ctx, int i) {
+    auto* c = reinterpret_cast<Cursor*>(cur);
+    if (i < 0 || i >= static_cast<int>(c->fields.size())) { sqlite3_result_null(ctx); return SQLITE_OK; }
+    const CsvField& f = c->fields[i];
+    if (f.escaped) {
+        std::string s = f.str();
+        sqlite3_result_text(ctx, s.data(), static_cast<int>(s.size()), SQLITE_TRANSIENT);
+    } else {
+        // straight from the mapping, which the table keeps alive past every cursor
+        sqlite3_result_text(ctx, f.b, static_cast<int>(f.e - f.b), SQLITE_STATIC);
+    }
+    return SQLITE_OK;
+}
+
+static int rowid(sqlite3_vtab_cursor* cur, sqlite3_int64* out) {
+    *out = reinterpret_cast<Cursor*>(cur)->rowid;
+    return SQLITE_OK;
+}
+
+static sqlite3_module module = {
+    /* iVersion    */ 0,
+    /* xCreate     */ connect,
+    /* xConnect    */ connect,
+    /* xBestIndex  */ bestIndex,
+    /* xDisconnect */ disconnect,
+    /* xDestroy    */ disconnect,
+    /* xOpen       */ open,
+    /* xClose      */ close,
+    /* xFilter     */ filter,
+    /* xNext       */ next,
+    /* xEof        */ eof,
+    /* xColumn     */ column,
+    /* xRowid      */ rowid,
+    /* xUpdate     */ nullptr,
+    /* xBegin      */ nullptr,
+    /* xSync       */ nullptr,
+    /* xCommit     */ nullptr,
+    /* xRollback   */ nullptr,
+    /* xFindMethod */ nullptr,
+    /* xRename     */ nullptr,
+    /* xSavepoint  */ nullptr,
+    /* xRelease    */ nullptr,
+    /* xRollbackTo */ nullptr,
+    /* xShadowName */ nullptr,
+};
+
+} // namespace csvvtab
+
+// ----------------------------- SQL functions -------------------------------
+// Scalar functions registered on every connection so ISBN checks, progress and
+// ETA run inside the query engine (WHERE, ORDER BY, expression indexes):
+//   isbn_valid(x)            1/0, checksum-validated ISBN-10 or ISBN-13
+//   isbn13(x)                normalized ISBN-13 text, NULL if x is not a valid ISBN
+//   progress_pct(cur, total) percent complete as REAL
+//   eta_days(remaining, rate) days to finish at rate pages/day, NULL if unknown
+// All are deterministic (and innocuous where supported), so SQLite may use them
+// in indexes and constant-fold them.
+namespace sqlfn {
+
+static void isbnValid(sqlite3_context* ctx, int, sqlite3_value** argv) {
+    const unsigned char* t = sqlite3_value_text(argv[0]);
+    if (!t) { sqlite3_result_null(ctx); return; }
+    sqlite3_result_int(ctx, isbnChecksumOk(onlyDigitsX(reinterpret_cast<const char*>(t))) ? 1 : 0);
+}
+
+static void isbn13(sqlite3_context* ctx, int, sqlite3_value** argv) {
+    const unsigned char* t = sqlite3_value_text(argv[0]);
+    if (!t) { sqlite3_result_null(ctx); return; }
+    std::string s = onlyDigitsX(reinterpret_cast<const char*>(t));
+    if (!isbnChecksumOk(s)) { sqlite3_result_null(ctx); return; }
+    std::string n = normalizeIsbn(s);
+    sqlite3_result_text(ctx, n.c_str(), static_cast<int>(n.size()), SQLITE_TRANSIENT);
+}
+
+static void progressPctFn(sqlite3_context* ctx, int, sqlite3_value** argv) {
+    if (sqlite3_value_type(argv[0]) == SQLITE_NULL || sqlite3_value_type(argv[1]) == SQLITE_NULL) {
+        sqlite3_result_null(ctx); return;
+    }
+    sqlite3_result_double(ctx, progressPct(sqlite3_value_int64(argv[0]), sqlite3_value_int64(argv[1])));
+}
+
+static void etaDaysFn(sqlite3_context* ctx, int, sqlite3_value** argv) {
+    if (sqlite3_value_type(argv[0]) == SQLITE_NULL || sqlite3_value_type(argv[1]) == SQLITE_NULL) {
+        sqlite3_result_null(ctx); return;
+    }
+    auto d = etaDays(sqlite3_value_int64(argv[0]), sqlite3_value_int64(argv[1]));
+    if (d) sqlite3_result_int64(ctx, *d); else sqlite3_result_null(ctx);
+}
+
+static bool registerAll(sqlite3* db) {
+#ifdef SQLITE_INNOCUOUS
+    const int flags = SQLITE_UTF8 | SQLITE_DETERMINISTIC | SQLITE_INNOCUOUS;
+#else
+    const int flags = SQLITE_UTF8 | SQLITE_DETERMINISTIC;
+#endif
+    return sqlite3_create_function_v2(db, "isbn_valid",   1, flags, nullptr, isbnValid,     nullptr, nullptr, nullptr) == SQLITE_OK
+        && sqlite3_create_function_v2(db, "isbn13",       1, flags, nullptr, isbn13,        nullptr, nullptr, nullptr) == SQLITE_OK
+        && sqlite3_create_function_v2(db, "progress_pct", 2, flags, nullptr, progressPctFn, nullptr, nullptr, nullptr) == SQLITE_OK
+        && sqlite3_create_function_v2(db, "eta_days",     2, flags, nullptr, etaDaysFn,     nullptr, nullptr, nullptr) == SQLITE_OK;
+}
+
+} // namespace sqlfn
+
+// ----------------------------- List query shapes ---------------------------
+// Every filter/sort combination of SqliteStorage::list() is composed at compile
+// time from constexpr fragments, so the hot path only indexes a table of SQL
+// strings and reuses the matching cached prepared statement.
+template <size_t N>
+struct SqlText {
+    char s[N] = {};
+    constexpr SqlText() = default;
+    constexpr SqlText(const char (&lit)[N]) { for (size_t i = 0; i < N; ++i) s[i] = lit[i]; }
+    constexpr const char* c_str() const { return s; }
+};
+template <size_t A, size_t B>
+constexpr SqlText<A + B - 1> operator+(const SqlText<A>& a, const SqlText<B>& b) {
+    SqlText<A + B - 1> out;
+    for (size_t i = 0; i + 1 < A; ++i) out.s[i] = a.s[i];
+    for (size_t i = 0; i < B; ++i) out.s[A - 1 + i] = b.s[i];
+    return out;
+}
+
+namespace listsql {
+
+using Sort = SortBy;
+constexpr unsigned kSorts = 5;
+
+// Flags layout: bit 0 = status filter, remaining bits = Sort.
+constexpr unsigned kByStatus = 1u;
+constexpr unsigned flags(bool byStatus, Sort sort) { return (static_cast<unsigned>(sort) << 1) | (byStatus ? kByStatus : 0u); }
+constexpr unsigned kVariants = kSorts << 1;
+
+template <unsigned Flags>
+struct Query {
+    static constexpr Sort kSort = static_cast<Sort>(Flags >> 1);
+
+    static constexpr auto where() {
+        if constexpr ((Flags & kByStatus) != 0) return SqlText(" WHERE status=?1");
+        else return SqlText("");
+    }
+    // ?2 is the daily rate, bound only for Sort::Eta (books without an ETA sort last).
+    static constexpr auto order() {
+        if constexpr (kSort == Sort::Progress) return SqlText(" ORDER BY progress_pct(current_page,total_pages) DESC, id ASC;");
+        else if constexpr (kSort == Sort::Eta) return SqlText(" ORDER BY eta_days(total_pages-current_page,?2) IS NULL,"
+                                                              " eta_days(total_pages-current_page,?2) ASC, id ASC;");
+        else if constexpr (kSort == Sort::Title)  return SqlText(" ORDER BY title ASC, id ASC;");
+        else if constexpr (kSort == Sort::Author) return SqlText(" ORDER BY author ASC, id ASC;");
+        else return SqlText(" ORDER BY id ASC;");
+    }
+    static constexpr auto sql =
+        SqlText("SELECT id,title,author,total_pages,current_page,status,isbn FROM books") + where() + order();
+};
+
+template <size_t... I>
+constexpr std::array<const char*, sizeof...(I)> table(std::index_sequence<I...>) {
+    return {{ Query<static_cast<unsigned>(I)>::sql.c_str()... }};
+}
+constexpr auto kSql = table(std::make_index_sequence<kVariants>{});
+
+} // namespace listsql
+
+// ----------------------------- Columnar mirror -----------------------------
+// Struct-of-arrays copy of the numeric book columns (id, total_pages,
+// current_page, status) for aggregates, so totals and histograms are a
+// straight pass over a few int32 arrays instead of stepping rows. The kernels
+// come in a scalar and an AVX2 flavour; kernels() picks one at runtime.
+namespace colkern {
+
+struct Columns {
+    const int32_t* total;
+    const int32_t* current;
+    const int32_t* status;
+    size_t n;
+};
+
+// statusFilter < 0: every row.
+static ReadingTotals totalsScalar(const Columns& c, int statusFilter) {
+    ReadingTotals t;
+    for (size_t i = 0; i < c.n; ++i) {
+        if (statusFilter >= 0 && c.status[i] != statusFilter) continue;
+        ++t.books;
+        t.pagesTotal     += c.total[i];
+        t.pagesRead      += c.current[i];
+        t.pagesRemaining += std::max(0, c.total[i] - c.current[i]);
+    }
+    return t;
+}
+static StatusCounts statusCountsScalar(const Columns& c) {
+    StatusCounts out{};
+    for (size_t i = 0; i < c.n; ++i)
+        if (static_cast<uint32_t>(c.status[i]) < out.size()) ++out[c.status[i]];
+    return out;
+}
+// Same binning as the SQL fallback: finished books go to the last bin, books
+// without a page count to the first.
+static int progressBin(int32_t total, int32_t current) {
+    if (total <= 0) return 0;
+    if (current >= total) return kProgressBins - 1;
+    long long b = static_cast<long long>(current) * 10 / total;
+    return static_cast<int>(std::clamp(b, 0LL, 9LL));
+}
+static ProgressHistogram progressScalar(const Columns& c) {
+    ProgressHistogram out{};
+    for (size_t i = 0; i < c.n; ++i) ++out[progressBin(c.total[i], c.current[i])];
+    return out;
+}
+
+#ifdef BOOKTRACER_AVX2
+// Lane counters are 32-bit; fold them into 64-bit totals at least this often.
+constexpr size_t kAvxBlock = size_t(1) << 24;
+
+__attribute__((target("avx2"))) static inline __m256i widenAdd(__m256i acc, __m256i v) {
+    acc = _mm256_add_epi64(acc, _mm256_cvtepi32_epi64(_mm256_castsi256_si128(v)));
+    return _mm256_add_epi64(acc, _mm256_cvtepi32_epi64(_mm256_extracti128_si256(v, 1)));
+}
+__attribute__((target("avx2"))) static inline long long hsum64(__m256i v) {
+    alignas(32) long long l[4];
+    _mm256_store_si256(reinterpret_cast<__m256i*>(l), v);
+    return l[0] + l[1] + l[2] + l[3];
+}
+__attribute__((target("avx2"))) static inline long long hsum32(__m256i v) {
+    alignas(32) int32_t l[8];
+    _mm256_store_si256(reinterpret_cast<__m256i*>(l), v);
+    long long s = 0;
+    for (int32_t x: l) s += static_cast<uint32_t>(x);
+    return s;
+}
+__attribute__((target("avx2"))) static inline __m256i load8(const int32_t* p) {
+    return _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+}
+
+__attribute__((target("avx2"))) static ReadingTotals totalsAvx2(const Columns& c, int statusFilter) {
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i want = _mm256_set1_epi32(statusFilter);
+    const __m256i all  = _mm256_set1_epi32(-1);
+    __m256i tot = zero, cur = zero, rem = zero;
+    ReadingTotals t;
+    size_t i = 0;
+    while (i + 8 <= c.n) {
+        __m256i cnt = zero;   // selected lanes
+        size_t end = std::min(c.n - (c.n - i) % 8, i + kAvxBlock);
+        for (; i < end; i += 8) {
+            __m256i tv = load8(c.total + i), cv = load8(c.current + i);
+            __m256i m = statusFilter < 0 ? all : _mm256_cmpeq_epi32(load8(c.status + i), want);
+            cnt = _mm256_add_epi32(cnt, _mm256_and_si256(m, _mm256_set1_epi32(1)));
+            tot = widenAdd(tot, _mm256_and_si256(tv, m));
+            cur = widenAdd(cur, _mm256_and_si256(cv, m));
+            rem = widenAdd(rem, _mm256_and_si256(_mm256_max_epi32(_mm256_sub_epi32(tv, cv), zero), m));
+        }
+        t.books += hsum32(cnt);
+    }
+    t.pagesTotal = hsum64(tot);
+    t.pagesRead = hsum64(cur);
+    t.pagesRemaining = hsum64(rem);
+    ReadingTotals tail = totalsScalar({c.total + i, c.current + i, c.status + i, c.n - i}, statusFilter);
+    t.books += tail.books; t.pagesTotal += tail.pagesTotal;
+    t.pagesRead += tail.pagesRead; t.pagesRemaining += tail.pagesRemaining;
+    return t;
+}
+
+__attribute__((target("avx2"))) static StatusCounts statusCountsAvx2(const Columns& c) {
+    StatusCounts out{};
+    const __m256i one = _mm256_set1_epi32(1);
+    size_t i = 0;
+    while (i + 8 <= c.n) {
+        __m256i k0 = _mm256_setzero_si256(), k1 = k0, k2 = k0;
+        size_t end = std::min(c.n - (c.n - i) % 8, i + kAvxBlock);
+        for (; i < end; i += 8) {
+            __m256i s = load8(c.status + i);
+            k0 = _mm256_add_epi32(k0, _mm256_and_si256(_mm256_cmpeq_epi32(s, _mm256_setzero_si256()), one));
+            k1 = _mm256_add_epi32(k1, _mm256_and_si256(_mm256_cmpeq_epi32(s, one), one));
+            k2 = _mm256_add_epi32(k2, _mm256_and_si256(_mm256_cmpeq_epi32(s, _mm256_set1_epi32(2)), one));
+        }
+        out[0] += hsum32(k0); out[1] += hsum32(k1); out[2] += hsum32(k2);
+    }
+    StatusCounts tail = statusCountsScalar({nullptr, nullptr, c.status + i, c.n - i});
+    for (size_t k = 0; k < out.size(); ++k) out[k] += tail[k];
+    return out;
+}
+
+// Counting instead of dividing: a book with pages is in bin >= k (k = 1..9)
+// iff 10*current >= k*total, so per-threshold counts give the bins by
+// differencing. That is exact in int32 while total <= kExactTotal; lanes with
+// bigger totals (not real books) go through progressBin().
+constexpr int32_t kExactTotal = INT32_MAX / 10;
+
+__attribute__((target("avx2"))) static ProgressHistogram progressAvx2(const Columns& c) {
+    ProgressHistogram out{};
+    const __m256i zero = _mm256_setzero_si256(), limit = _mm256_set1_epi32(kExactTotal);
+    long long atLeast[kProgressBins - 1] = {};   // [k-1]: bin >= k among books with pages, not finished
+    long long eligible = 0;
+    size_t i = 0;
+    while (i + 8 <= c.n) {
+        __m256i ge[kProgressBins - 2], elig = zero, done = zero, none = zero;
+        for (auto& v: ge) v = zero;
+        size_t end = std::min(c.n - (c.n - i) % 8, i + kAvxBlock);
+        for (; i < end; i += 8) {
+            __m256i tv = load8(c.total + i), cv = load8(c.current + i);
+            __m256i hasPages = _mm256_cmpgt_epi32(tv, zero);
+            __m256i fin = _mm256_andnot_si256(_mm256_cmpgt_epi32(tv, cv), hasPages);   // total > 0 && cur >= total
+            __m256i e = _mm256_andnot_si256(fin, hasPages);
+            __m256i big = _mm256_and_si256(_mm256_cmpgt_epi32(tv, limit), e);
+            if (!_mm256_testz_si256(big, big)) {
+                for (size_t l = i; l < i + 8; ++l) ++out[progressBin(c.total[l], c.current[l])];
+                continue;
+            }
+            done = _mm256_sub_epi32(done, fin);
+            none = _mm256_sub_epi32(none, _mm256_cmpeq_epi32(hasPages, zero));
+            elig = _mm256_sub_epi32(elig, e);
+            __m256i c10 = _mm256_add_epi32(_mm256_slli_epi32(cv, 3), _mm256_slli_epi32(cv, 1));
+            __m256i kt = tv;
+            for (int k = 0; k < kProgressBins - 2; ++k) {
+                ge[k] = _mm256_sub_epi32(ge[k], _mm256_andnot_si256(_mm256_cmpgt_epi32(kt, c10), e));
+                kt = _mm256_add_epi32(kt, tv);
+            }
+        }
+        for (int k = 0; k < kProgressBins - 2; ++k) atLeast[k] += hsum32(ge[k]);
+        eligible += hsum32(elig);
+        out[kProgressBins - 1] += hsum32(done);
+        out[0] += hsum32(none);
+    }
+    out[0] += eligible - atLeast[0];
+    for (int k = 1; k < kProgressBins - 2; ++k) out[k] += atLeast[k - 1] - atLeast[k];
+    out[kProgressBins - 2] += atLeast[kProgressBins - 3];
+    ProgressHistogram tail = progressScalar({c.total + i, c.current + i, nullptr, c.n - i});
+    for (int b = 0; b < kProgressBins; ++b) out[b] += tail[b];
+    return out;
+}
+#endif
+
+struct Kernels {
+    const char* name;
+    ReadingTotals (*totals)(const Columns&, int);
+    StatusCounts (*statusCounts)(const Columns&);
+    ProgressHistogram (*progress)(const Columns&);
+};
+static const Kernels kScalar{"scalar", totalsScalar, statusCountsScalar, progressScalar};
+
+static const Kernels& kernels() {
+    static const Kernels& k = []() -> const Kernels& {
+#ifdef BOOKTRACER_AVX2
+        static const Kernels avx2{"avx2", totalsAvx2, statusCountsAvx2, progressAvx2};
+        if (__builtin_cpu_supports("avx2")) return avx2;
+#endif
+        return kScalar;
+    }();
+    return k;
+}
+
+} // namespace colkern
+
+class ColumnMirror {
+public:
+    void clear() { id_.clear(); total_.clear(); current_.clear(); status_.clear(); index_.clear(); }
+    void reserve(size_t n) {
+        id_.reserve(n); total_.reserve(n); current_.reserve(n); status_.reserve(n); index_.reserve(n);
+    }
+    size_t size() const { return id_.size(); }
+
+    void upsert(long long id, int32_t total, int32_t current, int32_t status) {
+        auto [it, fresh] = index_.try_emplace(id, static_cast<uint32_t>(id_.size()));
+        if (fresh) {
+            id_.push_back(id); total_.push_back(total); current_.push_back(current); status_.push_back(status);
+            return;
+        }
+        uint32_t i = it->second;
+        total_[i] = total; current_[i] = current; status_[i] = status;
+    }
+    // Swap-with-last, so row order is arbitrary (aggregates don't care).
+    void erase(long long id) {
+        auto it = index_.find(id);
+        if (it == index_.end()) return;
+        uint32_t i = it->second, last = static_cast<uint32_t>(id_.size() - 1);
+        index_.erase(it);
+        if (i != last) {
+            id_[i] = id_[last]; total_[i] = total_[last]; current_[i] = current_[last]; status_[i] = status_[last];
+            index_[id_[i]] = i;
+        }
+        id_.pop_back(); total_.pop_back(); current_.pop_back(); status_.pop_back();
+    }
+
+    colkern::Columns columns() const { return {total_.data(), current_.data(), status_.data(), id_.size()}; }
+
+    // Big mirrors are split into slices that run on the executor.
+    ReadingTotals totals(int statusFilter) const {
+        return reduce<ReadingTotals>([&](const colkern::Columns& c){ return colkern::kernels().totals(c, statusFilter); },
+            [](ReadingTotals& a, const ReadingTotals& b){
+                a.books += b.books; a.pagesTotal += b.pagesTotal;
+                a.pagesRead += b.pagesRead; a.pagesRemaining += b.pagesRemaining;
+            });
+    }
+    StatusCounts statusCounts() const {
+        return reduce<StatusCounts>([](const colkern::Columns& c){ return colkern::kernels().statusCounts(c); },
+            [](StatusCounts& a, const StatusCounts& b){ for (size_t k = 0; k < a.size(); ++k) a[k] += b[k]; });
+    }
+    ProgressHistogram progress() const {
+        return reduce<ProgressHistogram>([](const colkern::Columns& c){ return colkern::kernels().progress(c); },
+            [](ProgressHistogram& a, const ProgressHistogram& b){ for (size_t k = 0; k < a.size(); ++k) a[k] += b[k]; });
+    }
+    // (id, pages left) of the books with this status, by id.
+    std::vector<std::pair<int, long long>> pagesLeft(int32_t status) const {
+        std::vector<std::pair<int, long long>> out;
+        for (size_t i = 0; i < id_.size(); ++i)
+            if (status_[i] == status)
+                out.emplace_back(static_cast<int>(id_[i]), std::max<long long>(0, static_cast<long long>(total_[i]) - current_[i]));
+        std::sort(out.begin(), out.end());
+        return out;
+    }
+
+private:
+    static constexpr size_t kSliceRows = size_t(1) << 18;
+
+    template <class R, class Kernel, class Merge>
+    R reduce(Kernel kernel, Merge merge) const {
+        colkern::Columns all = columns();
+        if (all.n <= kSliceRows) return kernel(all);
+        std::vector<R> part((all.n + kSliceRows - 1) / kSliceRows);
+        Executor::instance().parallelFor(0, all.n, kSliceRows, [&](size_t b, size_t e){
+            part[b / kSliceRows] = kernel({all.total + b, all.current + b, all.status + b, e - b});
+        }, {}, Executor::Priority::High);
+        R out = part[0];
+        for (size_t i = 1; i < part.size(); ++i) merge(out, part[i]);
+        return out;
+    }
+
+    std::vector<long long> id_;
+    std::vector<int32_t> total_, current_, status_;
+    std::unordered_map<long long, uint32_t> index_;
+};
+
+// ----------------------------- In-memory text search -----------------------
+// ASCII-folded titles and authors of every book in one contiguous heap
+// ("title\0author\0" per row, with an offset index), for substring queries
+// that need no tokenizer: a brute-force scan of the heap with a
+// first/last-byte filter (Muła's "generic SIMD" strstr) finds mid-word
+// fragments with a memcmp only at candidate positions.
+namespace strkern {
+
+// First match of needle at or after `from`, or n. needle is non-empty.
+static size_t findScalar(const char* h, size_t n, std::string_view needle, size_t from) {
+    const size_t k = needle.size();
+    const char first = needle.front(), last = needle.back();
+    for (size_t i = from; i + k <= n; ++i)
+        if (h[i] == first && h[i + k - 1] == last && std::memcmp(h + i + 1, needle.data() + 1, k < 2 ? 0 : k - 2) == 0)
+            return i;
+    return n;
+}
+
+#ifdef BOOKTRACER_AVX2
+__attribute__((target("avx2"))) static size_t findAvx2(const char* h, size_t n, std::string_view needle, size_t from) {
+    const size_t k = needle.size();
+    const __m256i first = _mm256_set1_epi8(needle.front()), last = _mm256_set1_epi8(needle.back());
+    size_t i = from;
+    for (; i + k - 1 + 32 <= n; i += 32) {
+        __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(h + i));
+        __m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(h + i + k - 1));
+        uint32_t m = static_cast<uint32_t>(_mm256_movemask_epi8(
+            _mm256_and_si256(_mm256_cmpeq_epi8(a, first), _mm256_cmpeq_epi8(b, last))));
+        while (m) {
+            unsigned bit = static_cast<unsigned>(__builtin_ctz(m));
+            if (k <= 2 || std::memcmp(h + i + bit + 1, needle.data() + 1, k - 2) == 0) return i + bit;
+            m &= m - 1;
+        }
+    }
+    return findScalar(h, n, needle, i);
+}
+#endif
+
+struct Kernel {
+    const char* name;
+    size_t (*find)(const char*, size_t, std::string_view, size_t);
+};
+static const Kernel kScalar{"scalar", findScalar};
+
+static const Kernel& kernel() {
+    static const Kernel& k = []() -> const Kernel& {
+#ifdef BOOKTRACER_AVX2
+        static const Kernel avx2{"avx2", findAvx2};
+        if (__builtin_cpu_supports("avx2")) return avx2;
+#endif
+        return kScalar;
+    }();
+    return k;
+}
+
+} // namespace strkern
+
+class SearchHeap {
+public:
+    void clear() { heap_.clear(); start_.clear(); slotId_.clear(); slotOf_.clear(); dead_ = 0; }
+    size_t rows() const { return slotOf_.size(); }
+    size_t bytes() const { return heap_.size(); }
+
+    void upsert(long long id, std::string_view title, std::string_view author) {
+        erase(id);
+        slotOf_[id] = static_cast<uint32_t>(start_.size());
+        start_.push_back(heap_.size());
+        slotId_.push_back(id);
+        fold(title); heap_.push_back('\0');
+        fold(author); heap_.push_back('\0');
+    }
+    // Leaves a dead slot behind; the heap is compacted once half of it is dead.
+    void erase(long long id) {
+        auto it = slotOf_.find(id);
+        if (it == slotOf_.end()) return;
+        uint32_t s = it->second;
+        slotOf_.erase(it);
+        slotId_[s] = 0;
+        dead_ += slotEnd(s) - start_[s];
+        if (dead_ > heap_.size() / 2) compact();
+    }
+
+    // Ids of the books whose title or author contains q (ASCII case-insensitive),
+    // ascending. Big heaps are scanned in row-aligned slices on the executor.
+    std::vector<long long> find(std::string_view q, const strkern::Kernel& k = strkern::kernel(),
+                                size_t maxSlices = 64) const {
+        std::string needle;
+        for (unsigned char c: q) needle.push_back(static_cast<char>(std::tolower(c)));
+        std::vector<long long> out;
+        if (needle.empty()) {
+            for (long long id: slotId_) if (id) out.push_back(id);
+        } else if (needle.find('\0') == std::string::npos) {
+            size_t slices = std::clamp<size_t>(heap_.size() / kSliceBytes, 1, std::max<size_t>(maxSlices, 1));
+            std::vector<std::vector<long long>> part(slices);
+            auto scan = [&](size_t s){
+                size_t b = sliceStart(s, slices), e = sliceStart(s + 1, slices);
+                size_t slot = 0;
+                for (size_t pos = k.find(heap_.data(), e, needle, b); pos < e;) {
+                    slot = slotAt(pos, slot);
+                    if (slotId_[slot]) part[s].push_back(slotId_[slot]);
+                    size_t next = slotEnd(slot);   // one hit per row is enough
+                    pos = next < e ? k.find(heap_.data(), e, needle, next) : e;
+                }
+            };
+            if (slices == 1) scan(0);
+            else Executor::instance().parallelFor(0, slices, 1, [&](size_t b, size_t e){ for (size_t s = b; s < e; ++s) scan(s); },
+                                                  {}, Executor::Priority::High);
+            for (auto& p: part) out.insert(out.end(), p.begin(), p.end());
+        }
+        std::sort(out.begin(), out.end());
+        return out;
+    }
+
+private:
+    static constexpr size_t kSliceBytes = size_t(1) << 20;
+
+    std::string heap_;
+    std::vector<size_t> start_;                      // per slot
+    std::vector<long long> slotId_;                  // 0: dead slot
+    std::unordered_map<long long, uint32_t> slotOf_;
+    size_t dead_ = 0;
+
+    void fold(std::string_view s) {
+        for (unsigned char c: s) heap_.push_back(c ? static_cast<char>(std::tolower(c)) : ' ');
+    }
+    size_t slotEnd(size_t s) const { return s + 1 < start_.size() ? start_[s + 1] : heap_.size(); }
+    // Slot holding heap byte pos, searching forward from slot `from` (hits come
+    // in heap order, and are usually close together): gallop, then bisect.
+    size_t slotAt(size_t pos, size_t from) const {
+        size_t lo = from, step = 1;
+        while (lo + step < start_.size() && start_[lo + step] <= pos) { lo += step; step *= 2; }
+        size_t hi = std::min(start_.size(), lo + step);
+        return static_cast<size_t>(std::upper_bound(start_.begin() + lo, start_.begin() + hi, pos) - start_.begin()) - 1;
+    }
+    // Slice boundaries fall on row starts, so no match straddles two slices.
+    size_t sliceStart(size_t s, size_t slices) const {
+        if (s == 0) return 0;
+        if (s >= slices) return heap_.size();
+        size_t target = heap_.size() / slices * s;
+        auto it = std::lower_bound(start_.begin(), start_.end(), target);
+        return it == start_.end() ? heap_.size() : *it;
+    }
+    void compact() {
+        SearchHeap fresh;
+        fresh.heap_.reserve(heap_.size() - dead_);
+        for (size_t s = 0; s < start_.size(); ++s) {
+            if (!slotId_[s]) continue;
+            fresh.slotOf_[slotId_[s]] = static_cast<uint32_t>(fresh.start_.size());
+            fresh.start_.push_back(fresh.heap_.size());
+            fresh.slotId_.push_back(slotId_[s]);
+            fresh.heap_.append(heap_, start_[s], slotEnd(s) - start_[s]);
+        }
+        *this = std::move(fresh);
+    }
+};
+
+// ----------------------------- Finish-date forecasts -----------------------
+// Monte Carlo over the observed pages per day: a trial replays random past
+// days until the pages left are read. A draw per simulated day would be too
+// slow for long backlogs, so the simulator bootstraps tables of 2^j-day
+// blocks, each the sum of two random blocks one level down (which it
+// remembers). A trial takes whole top-level blocks while they do not finish
+// the reading, then bisects the one that does through its halves down to the
+// finishing day: about log2(days) steps instead of one per day.
+class FinishSimulator {
+public:
+    using Rng = std::mt19937_64;
+    struct Result {
+        std::vector<std::array<int, 2>> days;   // P50, P90 per target; -1 past the horizon
+        long long trials = 0;
+    };
+
+    // daily: pages read on each sampled day, zero days included; at least one > 0.
+    FinishSimulator(const std::vector<int>& daily, uint64_t seed) : seed_(seed) {
+        for (int d: daily) tables_[0].push_back(Block{d, 0, 0});
+        Rng rng(mix(seed_, ~0ull));
+        for (int j = 1; j < kLevels; ++j) {
+            const auto& lo = tables_[j - 1];
+            tables_[j].resize(kTableSize);
+            for (auto& b: tables_[j]) {
+                b.first = static_cast<uint32_t>(rng() % lo.size());
+                b.second = static_cast<uint32_t>(rng() % lo.size());
+                b.pages = lo[b.first].pages + lo[b.second].pages;
+            }
+        }
+    }
+
+    // Reading days until `pages` are read, today being day 1; -1 past the horizon.
+    int trial(long long pages, Rng& rng) const {
+        if (pages <= 0) return 0;
+        constexpr int kTop = kLevels - 1;
+        const auto& top = tables_[kTop];
+        long long read = 0;
+        int days = 0;
+        size_t i;
+        while (read + top[i = rng() % top.size()].pages < pages) {
+            read += top[i].pages;
+            days += 1 << kTop;
+            if (days >= kForecastHorizonDays) return -1;
+        }
+        for (int j = kTop; j > 0; --j) {
+            const Block& b = tables_[j][i];
+            long long first = tables_[j - 1][b.first].pages;
+            if (read + first >= pages) { i = b.first; continue; }
+            read += first;
+            days += 1 << (j - 1);
+            i = b.second;
+        }
+        return days + 1 > kForecastHorizonDays ? -1 : days + 1;
+    }
+
+    // Adds rounds of trials for every target across the executor while another
+    // round still fits in the budget (at least one round runs). Each slice of
+    // a round draws from its own stream, seeded from (seed, round, slice).
+    Result run(const std::vector<long long>& pages, std::chrono::steady_clock::duration budget) const {
+        using clk = std::chrono::steady_clock;
+        auto t0 = clk::now();
+        Result r;
+        std::vector<std::vector<int>> samples(pages.size());
+        Executor& ex = Executor::instance();
+        size_t grain = std::max<size_t>(1, pages.size() / (ex.size() * 4));
+        for (uint64_t round = 0; r.trials < kMaxTrials; ++round) {
+            ex.parallelFor(0, pages.size(), grain, [&](size_t b, size_t e){
+                Rng rng(mix(seed_, round << 32 | b));
+                for (size_t i = b; i < e; ++i)
+                    for (int k = 0; k < kRoundTrials; ++k) samples[i].push_back(trial(pages[i], rng));
+            }, {}, Executor::Priority::High);
+            r.trials += kRoundTrials;
+            auto spent = clk::now() - t0;
+            if (spent + spent / static_cast<long long>(round + 1) > budget) break;
+        }
+        r.days.reserve(pages.size());
+        for (auto& s: samples) {
+            for (int& d: s) if (d < 0) d = INT_MAX;
+            r.days.push_back({quantile(s, 0.5), quantile(s, 0.9)});
+        }
+        return r;
+    }
+
+private:
+    static constexpr int kLevels = 16;              // top block 2^15 days
+    static constexpr size_t kTableSize = 8192;
+    static constexpr int kRoundTrials = 64;
+    static constexpr long long kMaxTrials = 4096;
+
+    struct Block {
+        long long pages;
+        uint32_t first, second;         // halves, indices one level down
+    };
+
+    uint64_t seed_;
+    std::array<std::vector<Block>, kLevels> tables_;
+
+    // splitmix64 finalizer over both words
+    static uint64_t mix(uint64_t a, uint64_t b) {
+        uint64_t z = a + 0x9E3779B97F4A7C15ull * (b + 1);
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+        return z ^ (z >> 31);
+    }
+    static int quantile(std::vector<int>& s, double p) {
+        auto it = s.begin() + static_cast<long>(p * (s.size() - 1) + 0.5);
+        std::nth_element(s.begin(), it, s.end());
+        return *it == INT_MAX ? -1 : *it;
+    }
+};
+
+// Local calendar date `days` after today, YYYY-MM-DD.
+static std::string dateInDays(int days) {
+    std::time_t now = std::time(nullptr);
+    std::tm tm{};
+#ifdef _WIN32
+    localtime_s(&tm, &now);
+#else
+    localtime_r(&now, &tm);
+#endif
+    tm.tm_mday += days;
+    tm.tm_hour = 12;            // clear of DST shifts
+    tm.tm_isdst = -1;
+    std::mktime(&tm);
+    char buf[16];
+    std::strftime(buf, sizeof buf, "%Y-%m-%d", &tm);
+    return buf;
+}
+
+// ----------------------------- SQLite storage ------------------------------
+std::optional<ExportKey> exportKeyFromStr(std::string s) {
+    std::transform(s.begin(), s.end(), s.begin(), [](unsigned char c){ return std::tolower(c); });
+    if (s.empty() || s=="id")  return ExportKey::Id;
+    if (s=="title")            return ExportKey::Title;
+    if (s=="author")           return ExportKey::Author;
+    if (s=="isbn")             return ExportKey::Isbn;
+    if (s=="pages")            return ExportKey::Pages;
+    if (s=="progress")         return ExportKey::Progress;
+    if (s=="status")           return ExportKey::Status;
+    return std::nullopt;
+}
+
+class SqliteStorage {
+public:
+    static constexpr int kDefaultBusyTimeoutMs = 5000;
+
+    // busyTimeoutMs: how long a statement waits on another process's write lock
+    // before SQLITE_BUSY is surfaced (after which writes are retried a few times).
+    explicit SqliteStorage(const std::string& dbpath, int busyTimeoutMs = kDefaultBusyTimeoutMs) {
+        // URI filenames are enabled so ATTACH can open foreign databases read-only.
+        // FULLMUTEX: statements are prepared on a warm-up thread while the UI runs.
+        const int flags = SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE | SQLITE_OPEN_URI | SQLITE_OPEN_FULLMUTEX;
+        if (sqlite3_open_v2(dbpath.c_str(), &db_, flags, nullptr) != SQLITE_OK) {
+            openError_ = sqlite3_errmsg(db_);
+            logging::log(logging::Level::Error, "db_open_failed", {{"path", dbpath}, {"msg", openError_}});
+            sqlite3_close(db_);
+            db_ = nullptr;
+        } else {
+            sqlite3_busy_timeout(db_, std::max(0, busyTimeoutMs));
+            // Lets the maintenance scheduler reclaim free pages in small slices. Only
+            // takes effect on a brand-new file, so it must precede the WAL switch.
+            exec("PRAGMA auto_vacuum=INCREMENTAL;");
+            // WAL lets readers run alongside the single writer (CLI + cron + imports).
+            exec("PRAGMA journal_mode=WAL;");
+            sqlite3_create_module_v2(db_, "csvfile", &csvvtab::module, nullptr, nullptr);
+            if (!sqlfn::registerAll(db_)) {
+                openError_ = std::string("SQL function registration failed: ") + sqlite3_errmsg(db_);
+                sqlite3_close(db_);
+                db_ = nullptr;
+                return;
+            }
+            ensureSchema();
+        }
+    }
+    ~SqliteStorage() {
+        waitWarm();
+        for (auto* st: hotStmts_) sqlite3_finalize(st);
+        for (auto* st: listStmts_) sqlite3_finalize(st);
+        if (db_) sqlite3_close(db_);
+    }
+    bool ok() const { return db_ != nullptr; }
+    std::string lastError() const { return db_ ? sqlite3_errmsg(db_) : openError_.empty() ? "database not open" : openError_; }
+
+    // Prepares all hot statements on the shared executor so the first list or
+    // update after startup pays no prepare latency. Safe to call once, right
+    // after construction; foreground calls join it before using a statement.
+    void warmUpAsync() {
+        if (!db_ || warm_.valid()) return;
+        warm_ = Executor::instance().submit([this]{
+            for (size_t i = 0; i < hotStmts_.size(); ++i) prepareInto(hotStmts_[i], kHotSql[i]);
+            for (unsigned f = 0; f < listsql::kVariants; ++f) prepareInto(listStmts_[f], listsql::kSql[f]);
+        }, Executor::Priority::High);
+    }
+
+    // Bump when the DDL below changes; databases already at this version skip it.
+    static constexpr int kSchemaVersion = 6;
+
+    void ensureSchema() {
+        if (userVersion() >= kSchemaVersion) return;
+        exec("BEGIN IMMEDIATE;");
+        const char* sql =
+            "CREATE TABLE IF NOT EXISTS books ("
+            "  id INTEGER PRIMARY KEY AUTOINCREMENT,"
+            "  title TEXT NOT NULL,"
+            "  author TEXT,"
+            "  total_pages INTEGER NOT NULL,"
+            "  current_page INTEGER NOT NULL,"
+            "  status INTEGER NOT NULL,"
+            "  isbn TEXT"
+            ");";
+        exec(sql);
+
+        // NEW: key-value store for app settings
+        exec("CREATE TABLE IF NOT EXISTS settings ("
+            "  key TEXT PRIMARY KEY,"
+            "  value TEXT NOT NULL"
+            ");");
+
+        // Helpful index for LIKE searches on title/author
+        exec("CREATE INDEX IF NOT EXISTS idx_books_title ON books(title);");
+        exec("CREATE INDEX IF NOT EXISTS idx_books_author ON books(author);");
+        exec("CREATE INDEX IF NOT EXISTS idx_books_status ON books(status);");
+        // ISBN dedup during imports
+        exec("CREATE INDEX IF NOT EXISTS idx_books_isbn ON books(isbn);");
+
+        // Resumable CSV imports: last committed position per source file
+        exec("CREATE TABLE IF NOT EXISTS import_checkpoints ("
+            "  file_key TEXT PRIMARY KEY,"
+            "  byte_offset INTEGER NOT NULL,"
+            "  rows_committed INTEGER NOT NULL,"
+            "  updated_at TEXT"
+            ");");
+
+        // ISBN lookups requested while offline, replayed on reconnect
+        exec("CREATE TABLE IF NOT EXISTS lookup_queue ("
+            "  isbn TEXT PRIMARY KEY,"
+            "  attempts INTEGER NOT NULL DEFAULT 0,"
+            "  enqueued_at TEXT NOT NULL,"
+            "  last_attempt TEXT"
+            ");");
+
+        // Reverse (title/author -> ISBN) lookups by normalized query; isbn=''
+        // records a search that found nothing
+        exec("CREATE TABLE IF NOT EXISTS reverse_lookup_cache ("
+            "  query_key TEXT PRIMARY KEY,"
+            "  isbn TEXT NOT NULL,"
+            "  title TEXT,"
+            "  author TEXT,"
+            "  fetched_at TEXT NOT NULL"
+            ");");
+
+        // Pages read per local day, from every current_page increase (by any
+        // writer); sampled by forecast()
+        exec("CREATE TABLE IF NOT EXISTS reading_log ("
+            "  day TEXT PRIMARY KEY,"
+            "  pages INTEGER NOT NULL"
+            ");");
+        exec("CREATE TRIGGER IF NOT EXISTS trg_books_reading_log "
+            "AFTER UPDATE OF current_page ON books WHEN new.current_page > old.current_page BEGIN "
+            "  INSERT INTO reading_log(day,pages) VALUES(date('now','localtime'), new.current_page - old.current_page)"
+            "  ON CONFLICT(day) DO UPDATE SET pages = pages + excluded.pages; "
+            "END;");
+
+        // Row changes to books by any writer, so a connection mirroring books
+        // in memory can tell commits that touched it from unrelated ones
+        // (maintenance, queue bookkeeping)
+        exec("CREATE TABLE IF NOT EXISTS books_changes (n INTEGER NOT NULL);");
+        exec("INSERT INTO books_changes(n) SELECT 0 WHERE NOT EXISTS (SELECT 1 FROM books_changes);");
+        exec("CREATE TRIGGER IF NOT EXISTS trg_books_changes_ins AFTER INSERT ON books BEGIN "
+            "  UPDATE books_changes SET n = n + 1; END;");
+        exec("CREATE TRIGGER IF NOT EXISTS trg_books_changes_upd AFTER UPDATE ON books BEGIN "
+            "  UPDATE books_changes SET n = n + 1; END;");
+        exec("CREATE TRIGGER IF NOT EXISTS trg_books_changes_del AFTER DELETE ON books BEGIN "
+            "  UPDATE books_changes SET n = n + 1; END;");
+
+        exec(("PRAGMA user_version=" + std::to_string(kSchemaVersion) + ";").c_str());
+        exec("COMMIT;");
+    }
+
+    int userVersion() {
+        sqlite3_stmt* st=nullptr;
+        if (sqlite3_prepare_v2(db_, "PRAGMA user_version;", -1, &st, nullptr) != SQLITE_OK) return 0;
+        int v = (sqlite3_step(st) == SQLITE_ROW) ? sqlite3_column_int(st, 0) : 0;
+        sqlite3_finalize(st);
+        return v;
+    }
+
+    int add(const Book& b) {
+        StmtLease st = hot(Hot::Add);
+        if (!st) return -1;
+        sqlite3_bind_text(st, 1, b.title.c_str(), -1, SQLITE_TRANSIENT);
+        sqlite3_bind_text(st, 2, b.author.c_str(), -1, SQLITE_TRANSIENT);
+        sqlite3_bind_int (st, 3, b.totalPages);
+        sqlite3_bind_int (st, 4, b.currentPage);
+        sqlite3_bind_int (st, 5, b.status);
+        sqlite3_bind_text(st, 6, b.isbn.c_str(), -1, SQLITE_TRANSIENT);
+        int rc = stepRetry(st);
+        if (rc != SQLITE_DONE) return -1;
+        return static_cast<int>(sqlite3_last_insert_rowid(db_));
+    }
+
+    // Batched insert: one transaction and one prepared statement for the whole
+    // batch. Rows whose ISBN is already in the library are skipped.
+    // Returns the number of rows inserted, or -1 on failure.
+    int addMany(const std::vector<Book>& rows) {
+        StmtLease st = hot(Hot::AddIfNew);
+        if (!st) return -1;
+        if (!exec("BEGIN IMMEDIATE;")) return -1;
+        int inserted = 0;
+        bool ok = true;
+        for (const auto& b: rows) {
+            sqlite3_bind_text(st, 1, b.title.c_str(), -1, SQLITE_TRANSIENT);
+            sqlite3_bind_text(st, 2, b.author.c_str(), -1, SQLITE_TRANSIENT);
+            sqlite3_bind_int (st, 3, b.totalPages);
+            sqlite3_bind_int (st, 4, b.currentPage);
+            sqlite3_bind_int (st, 5, b.status);
+            sqlite3_bind_text(st, 6, b.isbn.c_str(), -1, SQLITE_TRANSIENT);
+            if (sqlite3_step(st) != SQLITE_DONE) { ok = false; sqlite3_reset(st); break; }
+            inserted += sqlite3_changes(db_);
+            sqlite3_reset(st);
+        }
+        if (!ok || !exec("COMMIT;")) { exec("ROLLBACK;"); return -1; }
+        return inserted;
+    }
+
+    bool updateProgress(int id, int currentPage, int status) {
+        StmtLease st = hot(Hot::UpdateProgress);
+        if (!st) return false;
+        sqlite3_bind_int(st, 1, currentPage);
+        sqlite3_bind_int(st, 2, status);
+        sqlite3_bind_int(st, 3, id);
+        int rc = stepRetry(st);
+        return rc == SQLITE_DONE;
+    }
+
+    bool updateStatus(int id, int status) {
+        StmtLease st = hot(Hot::UpdateStatus);
+        if (!st) return false;
+        sqlite3_bind_int(st, 1, status);
+        sqlite3_bind_int(st, 2, status);
+        sqlite3_bind_int(st, 3, id);
+        int rc = stepRetry(st);
+        return rc == SQLITE_DONE;
+    }
+
+    bool remove(int id) {
+        StmtLease st = hot(Hot::Remove);
+        if (!st) return false;
+        sqlite3_bind_int(st, 1, id);
+        int rc = stepRetry(st);
+        return rc == SQLITE_DONE;
+    }
+
+    std::optional<Book> get(int id) {
+        StmtLease st = hot(Hot::Get);
+        if (!st) return std::nullopt;
+        sqlite3_bind_int(st, 1, id);
+        Book b;
+        if (sqlite3_step(st) == SQLITE_ROW) {
+            b.id          = sqlite3_column_int(st,0);
+            b.title       = reinterpret_cast<const char*>(sqlite3_column_text(st,1));
+            b.author      = reinterpret_cast<const char*>(sqlite3_column_text(st,2));
+            b.totalPages  = sqlite3_column_int(st,3);
+            b.currentPage = sqlite3_column_int(st,4);
+            b.status      = sqlite3_column_int(st,5);
+            const unsigned char* is = sqlite3_column_text(st,6);
+            b.isbn        = is ? reinterpret_cast<const char*>(is) : "";
+            return b;
+        }
+        return std::nullopt;
+    }
+
+    // dailyRate is only used by SortBy::Eta (books without an ETA sort last).
+    std::vector<Book> list(std::optional<int> statusFilter = std::nullopt,
+                           SortBy sort = SortBy::Id, int dailyRate = 0) {
+        std::vector<Book> out;
+        StmtLease st = listStmt(listsql::flags(statusFilter.has_value(), sort));
+        if (!st) return out;
+        if (statusFilter) sqlite3_bind_int(st, 1, *statusFilter);
+        if (sort == SortBy::Eta) sqlite3_bind_int(st, 2, dailyRate);
+        while (sqlite3_step(st) == SQLITE_ROW) {
+            Book b;
+            b.id          = sqlite3_column_int(st,0);
+            b.title       = reinterpret_cast<const char*>(sqlite3_column_text(st,1));
+            b.author      = reinterpret_cast<const char*>(sqlite3_column_text(st,2));
+            b.totalPages  = sqlite3_column_int(st,3);
+            b.currentPage = sqlite3_column_int(st,4);
+            b.status      = sqlite3_column_int(st,5);
+            const unsigned char* is = sqlite3_column_text(st,6);
+            b.isbn        = is ? reinterpret_cast<const char*>(is) : "";
+            out.push_back(std::move(b));
+        }
+        return out;
+    }
+
+    // Substring of title or author. With the search heap on this scans memory;
+    // otherwise it is a LIKE over every row (where % and _ are wildcards).
+    std::vector<Book> search(const std::string& q) {
+        std::vector<Book> out;
+        if (textOn_ && syncMirrors()) {
+            for (long long id: text_.find(q))
+                if (auto b = get(static_cast<int>(id))) out.push_back(std::move(*b));
+            return out;
+        }
+        StmtLease st = hot(Hot::Search);
+        if (!st) return out;
+        std::string pat = "%" + q + "%";
+        std::string patLower = pat;
+        std::transform(patLower.begin(), patLower.end(), patLower.begin(), [](unsigned char c){return std::tolower(c);});
+        sqlite3_bind_text(st, 1, patLower.c_str(), -1, SQLITE_TRANSIENT);
+        sqlite3_bind_text(st, 2, patLower.c_str(), -1, SQLITE_TRANSIENT);
+        while (sqlite3_step(st) == SQLITE_ROW) {
+            Book b;
+            b.id          = sqlite3_column_int(st,0);
+            b.title       = reinterpret_cast<const char*>(sqlite3_column_text(st,1));
+            b.author      = reinterpret_cast<const char*>(sqlite3_column_text(st,2));
+            b.totalPages  = sqlite3_column_int(st,3);
+            b.currentPage = sqlite3_column_int(st,4);
+            b.status      = sqlite3_column_int(st,5);
+            const unsigned char* is = sqlite3_column_text(st,6);
+            b.isbn        = is ? reinterpret_cast<const char*>(is) : "";
+            out.push_back(std::move(b));
+        }
+        return out;
+    }
+
+    public:
+    // get daily rate (pages/day); 0 if unset
+    int getDailyRate() {
+        StmtLease st = hot(Hot::GetDailyRate);
+        if (!st) return 0;
+        int rate = 0;
+        if (sqlite3_step(st) == SQLITE_ROW) {
+            const unsigned char* v = sqlite3_column_text(st, 0);
+            if (v) { try { rate = std::stoi(reinterpret_cast<const char*>(v)); } catch (...) {} }
+        }
+        return std::max(0, rate);
+    }
+
+    bool setDailyRate(int rate) {
+        StmtLease st = hot(Hot::SetDailyRate);
+        if (!st) return false;
+        std::string s = std::to_string(std::max(0, rate));
+        sqlite3_bind_text(st, 1, s.c_str(), -1, SQLITE_TRANSIENT);
+        bool ok = (stepRetry(st) == SQLITE_DONE);
+        return ok;
+    }
+
+    // In-memory mirrors -----------------------------------------------------------
+    // With a mirror on, an update hook records every rowid this connection
+    // writes in books; the next read re-reads just those rows. Commits from
+    // other connections (PRAGMA data_version moves) or a dirty set larger than
+    // a quarter of the table trigger a full reload instead.
+    void enableColumnMirror() { enableMirror(columnsOn_); }
+    void enableSearchHeap() { enableMirror(textOn_); }
+
+    // Reading aggregates --------------------------------------------------------
+
+    ReadingTotals readingTotals(std::optional<int> statusFilter = std::nullopt) {
+        if (columnsOn_ && syncMirrors()) return mirror_.totals(statusFilter.value_or(-1));
+        ReadingTotals t;
+        StmtLease st = hot(Hot::AggTotals);
+        if (!st) return t;
+        if (statusFilter) sqlite3_bind_int(st, 1, *statusFilter);
+        if (sqlite3_step(st) == SQLITE_ROW) {
+            t.books          = sqlite3_column_int64(st, 0);
+            t.pagesTotal     = sqlite3_column_int64(st, 1);
+            t.pagesRead      = sqlite3_column_int64(st, 2);
+            t.pagesRemaining = sqlite3_column_int64(st, 3);
+        }
+        return t;
+    }
+    StatusCounts statusCounts() {
+        if (columnsOn_ && syncMirrors()) return mirror_.statusCounts();
+        StatusCounts out{};
+        StmtLease st = hot(Hot::AggStatus);
+        while (st && sqlite3_step(st) == SQLITE_ROW) out[sqlite3_column_int(st, 0)] = sqlite3_column_int64(st, 1);
+        return out;
+    }
+    ProgressHistogram progressHistogram() {
+        if (columnsOn_ && syncMirrors()) return mirror_.progress();
+        ProgressHistogram out{};
+        StmtLease st = hot(Hot::AggProgress);
+        while (st && sqlite3_step(st) == SQLITE_ROW) out[sqlite3_column_int(st, 0)] = sqlite3_column_int64(st, 1);
+        return out;
+    }
+
+    // Reading history ------------------------------------------------------------
+
+    // Pages read per day, oldest first, from the first logged day within the
+    // last historyDays through today. Days without reading count as 0; today
+    // is left out while nothing has been read yet.
+    std::vector<int> readingDays(int historyDays) {
+        std::vector<int> days;
+        StmtLease st = hot(Hot::ReadingDays);
+        if (!st) return days;
+        sqlite3_bind_int(st, 1, std::max(1, historyDays));
+        std::vector<std::pair<int, int>> rows;   // (days ago, pages)
+        int oldest = -1;
+        while (sqlite3_step(st) == SQLITE_ROW) {
+            int ago = sqlite3_column_int(st, 0);
+            if (ago < 0) continue;               // clock went backwards
+            rows.emplace_back(ago, sqlite3_column_int(st, 1));
+            oldest = std::max(oldest, ago);
+        }
+        if (oldest < 0) return days;
+        days.assign(static_cast<size_t>(oldest) + 1, 0);
+        for (auto [ago, pages]: rows) days[static_cast<size_t>(oldest - ago)] += std::max(0, pages);
+        if (days.back() == 0) days.pop_back();
+        return days;
+    }
+
+    // (id, pages left) of every book being read.
+    std::vector<std::pair<int, long long>> readingLeft() {
+        if (columnsOn_ && syncMirrors()) return mirror_.pagesLeft(static_cast<int32_t>(Status::Reading));
+        std::vector<std::pair<int, long long>> out;
+        StmtLease st = hot(Hot::ReadingLeft);
+        while (st && sqlite3_step(st) == SQLITE_ROW)
+            out.emplace_back(sqlite3_column_int(st, 0), sqlite3_column_int64(st, 1));
+        return out;
+    }
+
+    // Reverse lookup cache -------------------------------------------------------
+    struct CachedReverse { std::optional<ReverseHit> hit; };
+
+    // Cached answer for a normalized query; misses are remembered for 30 days.
+    std::optional<CachedReverse> reverseCacheGet(const std::string& key) {
+        StmtLease st = hot(Hot::RevCacheGet);
+        if (!st) return std::nullopt;
+        sqlite3_bind_text(st, 1, key.c_str(), -1, SQLITE_TRANSIENT);
+        if (sqlite3_step(st) != SQLITE_ROW) return std::nullopt;
+        CachedReverse c;
+        std::string isbn = columnText(st, 0);
+        if (!isbn.empty()) c.hit = ReverseHit{isbn, columnText(st, 1), columnText(st, 2)};
+        return c;
+    }
+    bool reverseCachePut(const std::string& key, const std::optional<ReverseHit>& hit) {
+        StmtLease st = hot(Hot::RevCachePut);
+        if (!st) return false;
+        sqlite3_bind_text(st, 1, key.c_str(), -1, SQLITE_TRANSIENT);
+        sqlite3_bind_text(st, 2, hit ? hit->isbn13.c_str() : "", -1, SQLITE_TRANSIENT);
+        sqlite3_bind_text(st, 3, hit ? hit->title.c_str() : "", -1, SQLITE_TRANSIENT);
+        sqlite3_bind_text(st, 4, hit ? hit->author.c_str() : "", -1, SQLITE_TRANSIENT);
+        return stepRetry(st) == SQLITE_DONE;
+    }
+    std::vector<Book> booksWithoutIsbn() {
+        std::vector<Book> out;
+        StmtLease st = hot(Hot::NoIsbnBooks);
+        if (!st) return out;
+        while (sqlite3_step(st) == SQLITE_ROW) {
+            Book b;
+            b.id     = sqlite3_column_int(st, 0);
+            b.title  = columnText(st, 1);
+            b.author = columnText(st, 2);
+            out.push_back(std::move(b));
+        }
+        return out;
+    }
+    // Id of a book that already has this ISBN, or 0.
+    int bookWithIsbn(const std::string& isbn13) {
+        StmtLease st = hot(Hot::IsbnOwner);
+        if (!st) return 0;
+        sqlite3_bind_text(st, 1, isbn13.c_str(), -1, SQLITE_TRANSIENT);
+        return sqlite3_step(st) == SQLITE_ROW ? sqlite3_column_int(st, 0) : 0;
+    }
+    // Only fills a blank ISBN; never overwrites one.
+    bool setIsbn(int id, const std::string& isbn13) {
+        StmtLease st = hot(Hot::SetIsbn);
+        if (!st) return false;
+        sqlite3_bind_text(st, 1, isbn13.c_str(), -1, SQLITE_TRANSIENT);
+        sqlite3_bind_int(st, 2, id);
+        return stepRetry(st) == SQLITE_DONE && sqlite3_changes(db_) == 1;
+    }
+
+    // Offline lookup queue ------------------------------------------------------
+    bool enqueueLookup(const std::string& isbn13) {
+        StmtLease st = hot(Hot::QueueAdd);
+        if (!st) return false;
+        sqlite3_bind_text(st, 1, isbn13.c_str(), -1, SQLITE_TRANSIENT);
+        return stepRetry(st) == SQLITE_DONE;
+    }
+    long long lookupQueueSize() {
+        StmtLease st = hot(Hot::QueueCount);
+        if (!st || sqlite3_step(st) != SQLITE_ROW) return 0;
+        return sqlite3_column_int64(st, 0);
+    }
+    // Oldest first, so a long outage drains in order. ISBNs that already
+    // failed wait 10 minutes per attempt before they are due again.
+    std::vector<std::string> pendingLookups(int limit) {
+        std::vector<std::string> out;
+        StmtLease st = hot(Hot::QueueNext);
+        if (!st) return out;
+        sqlite3_bind_int(st, 1, limit);
+        while (sqlite3_step(st) == SQLITE_ROW) out.push_back(columnText(st, 0));
+        return out;
+    }
+    // Fills blank titles/authors of every book with this ISBN and dequeues
+    // it. Returns the number of books updated, or -1 on failure.
+    int applyLookup(const std::string& isbn13, const LookupResult& r) {
+        long long changed = 0;
+        if (!exec("BEGIN IMMEDIATE;")) return -1;
+        {
+            StmtLease st = hot(Hot::QueueApply);
+            if (!st) { exec("ROLLBACK;"); return -1; }
+            sqlite3_bind_text(st, 1, r.title.c_str(), -1, SQLITE_TRANSIENT);
+            sqlite3_bind_text(st, 2, r.author.c_str(), -1, SQLITE_TRANSIENT);
+            sqlite3_bind_text(st, 3, isbn13.c_str(), -1, SQLITE_TRANSIENT);
+            if (sqlite3_step(st) != SQLITE_DONE) { exec("ROLLBACK;"); return -1; }
+            changed = sqlite3_changes(db_);
+        }
+        {
+            StmtLease st = hot(Hot::QueueDone);
+            if (!st) { exec("ROLLBACK;"); return -1; }
+            sqlite3_bind_text(st, 1, isbn13.c_str(), -1, SQLITE_TRANSIENT);
+            if (sqlite3_step(st) != SQLITE_DONE) { exec("ROLLBACK;"); return -1; }
+        }
+        return exec("COMMIT;") ? static_cast<int>(changed) : -1;
+    }
+    // Records a failed replay (retried with a growing delay); after
+    // maxAttempts the ISBN is given up on. Returns 1 if it was dropped, 0 if
+    // it stays queued, -1 on failure.
+    int lookupFailed(const std::string& isbn13, int maxAttempts) {
+        StmtLease st = hot(Hot::QueueFail);
+        if (!st) return -1;
+        sqlite3_bind_text(st, 1, isbn13.c_str(), -1, SQLITE_TRANSIENT);
+        if (stepRetry(st) != SQLITE_DONE) return -1;
+        StmtLease drop = hot(Hot::QueueDrop);
+        if (!drop) return -1;
+        sqlite3_bind_text(drop, 1, isbn13.c_str(), -1, SQLITE_TRANSIENT);
+        sqlite3_bind_int(drop, 2, maxAttempts);
+        if (stepRetry(drop) != SQLITE_DONE) return -1;
+        return sqlite3_changes(db_) > 0 ? 1 : 0;
+    }
+
+    // CSV export/import -------------------------------------------------------
+    // Sorted export ------------------------------------------------------------
+    // Streams the table once; any order other than id goes through an
+    // ExternalSorter bounded by memBudgetBytes, so huge libraries never need a
+    // big temp B-tree in SQLite or every row in memory.
+    std::optional<ExportStats> exportCsv(const std::string& path, ExportKey key = ExportKey::Id,
+                                         size_t memBudgetBytes = kDefaultExportBudget) {
+        std::ofstream out(path, std::ios::trunc | std::ios::binary);
+        if (!out) return std::nullopt;
+        out << "id,title,author,totalPages,currentPage,status,isbn\n";
+
+        ExportStats stats;
+        std::unique_ptr<ExternalSorter> sorter;
+        if (key != ExportKey::Id) sorter = std::make_unique<ExternalSorter>(memBudgetBytes);
+
+        StmtLease st = hot(Hot::ScanAll);
+        if (!st) return std::nullopt;
+        std::string line;
+        int rc;
+        while ((rc = sqlite3_step(st)) == SQLITE_ROW) {
+            Book b;
+            b.id          = sqlite3_column_int(st,0);
+            b.title       = columnText(st,1);
+            b.author      = columnText(st,2);
+            b.totalPages  = sqlite3_column_int(st,3);
+            b.currentPage = sqlite3_column_int(st,4);
+            b.status      = sqlite3_column_int(st,5);
+            b.isbn        = columnText(st,6);
+            line = std::to_string(b.id) + ","
+                 + csvQuote(b.title) + ","
+                 + csvQuote(b.author) + ","
+                 + std::to_string(b.totalPages) + ","
+                 + std::to_string(b.currentPage) + ","
+                 + std::to_string(b.status) + ","
+                 + csvQuote(b.isbn) + "\n";
+            ++stats.rows;
+            if (!sorter) out << line;   // rowid order is already id order
+            else if (!sorter->add(sortKey(b, key), std::move(line))) return std::nullopt;
+        }
+        if (rc != SQLITE_DONE) return std::nullopt;
+        if (sorter) {
+            if (!sorter->finish([&](const std::string& l){ out << l; return bool(out); })) return std::nullopt;
+            stats.runs = sorter->runsSpilled();
+            stats.passes = sorter->mergePasses();
+        }
+        out.close();
+        if (!out) return std::nullopt;
+        return stats;
+    }
+    // Staged, resumable import. Each chunk of kImportChunkRows records is
+    // loaded raw into temp.import_staging (one cached INSERT, values bound
+    // straight from the mapped file), then validated, normalized, deduplicated
+    // against the file and the library, and merged into books by a handful of
+    // set-based statements. Rejected rows stay in the staging table and are
+    // summarized at the end.
+    // The chunk's transaction also records (file identity, byte offset, rows
+    // committed) in import_checkpoints. With resume=true, an import of the same
+    // file (same path, size and mtime) continues at the last committed offset;
+    // otherwise any old checkpoint is discarded and the import starts over.
+    static constexpr long long kImportChunkRows = 10000;
+    static constexpr int kRejectSample = 20;
+
+    std::optional<CsvCheckpoint> csvCheckpoint(const std::string& path) {
+        std::string key = fileIdentity(path);
+        if (key.empty()) return std::nullopt;
+        StmtLease st = hot(Hot::GetCheckpoint);
+        if (!st) return std::nullopt;
+        sqlite3_bind_text(st, 1, key.c_str(), -1, SQLITE_TRANSIENT);
+        if (sqlite3_step(st) != SQLITE_ROW) return std::nullopt;
+        CsvCheckpoint cp;
+        cp.offset = static_cast<unsigned long long>(sqlite3_column_int64(st, 0));
+        cp.rows   = sqlite3_column_int64(st, 1);
+        return cp;
+    }
+
+    std::optional<CsvImportStats> importCsv(const std::string& path, bool resume = false) {
+        std::string key = fileIdentity(path);
+        MappedFile file(path);
+        if (key.empty() || !file.ok() || file.size() == 0) return std::nullopt;
+        if (!exec("CREATE TEMP TABLE IF NOT EXISTS import_staging ("
+                  "  rec_no INTEGER PRIMARY KEY, ncols INTEGER,"
+                  "  title TEXT, author TEXT, total_pages TEXT, current_page TEXT, status TEXT, isbn TEXT,"
+                  "  norm_isbn TEXT, reject TEXT);") ||
+            !exec("CREATE INDEX IF NOT EXISTS temp.idx_staging_isbn ON import_staging(norm_isbn);") ||
+            !exec("CREATE TEMP TABLE IF NOT EXISTS import_seen (isbn TEXT PRIMARY KEY) WITHOUT ROWID;") ||
+            !exec("DELETE FROM temp.import_staging;") || !exec("DELETE FROM temp.import_seen;"))
+            return std::nullopt;
+
+        const char* base = file.data();
+        const char* end  = base + file.size();
+        const char* p    = base;
+
+        CsvImportStats stats;
+        std::optional<CsvCheckpoint> cp = resume ? csvCheckpoint(path) : std::nullopt;
+        if (cp && cp->offset <= file.size()) {
+            p = base + cp->offset;
+            stats.resumedRows = stats.rows = cp->rows;
+            stats.resumedOffset = cp->offset;
+        } else {
+            dropCheckpoint(key);
+            // naive header check on the first line
+            const char* nl = static_cast<const char*>(std::memchr(p, '\n', end - p));
+            if (std::string_view(p, (nl ? nl : end) - p).find("id,") != std::string_view::npos)
+                p = nl ? nl + 1 : end;
+        }
+
+        std::vector<CsvField> cols;
+        long long recNo = 0;
+        while (p < end) {
+            if (!exec("BEGIN IMMEDIATE;")) return std::nullopt;
+            bool ok = true;
+            {
+                StmtLease st = hot(Hot::StageRow);
+                if (!st) ok = false;
+                for (long long n = 0; ok && n < kImportChunkRows && csvNextRecord(p, end, cols); ++n) {
+                    if (cols.size() == 1 && cols[0].b == cols[0].e) { --n; continue; }   // blank line
+                    sqlite3_bind_int64(st, 1, ++recNo);
+                    sqlite3_bind_int  (st, 2, static_cast<int>(cols.size()));
+                    // id column (0) is ignored on insert (AUTOINCREMENT)
+                    for (int c = 1; c < 7; ++c) {
+                        if (c < static_cast<int>(cols.size())) bindField(st, c + 2, cols[c]);
+                        else sqlite3_bind_null(st, c + 2);
+                    }
+                    ok = sqlite3_step(st) == SQLITE_DONE;
+                    sqlite3_reset(st);
+                }
+            }
+            long long merged = 0;
+            ok = ok && execHot(Hot::StageValidate) && execHot(Hot::StageDedupFile)
+                    && execHot(Hot::StageDedupLibrary) && execHot(Hot::StageMerge, &merged)
+                    && execHot(Hot::StageRemember) && execHot(Hot::StageClearMerged);
+            stats.rows += merged;
+            ok = ok && (p < end ? saveCheckpoint(key, static_cast<unsigned long long>(p - base), stats.rows)
+                                : dropCheckpoint(key));
+            if (!ok || !exec("COMMIT;")) { exec("ROLLBACK;"); return std::nullopt; }
+        }
+
+        // Report rejects straight from the staging table.
+        sqlite3_stmt* st = nullptr;
+        if (sqlite3_prepare_v2(db_, "SELECT reject, count(*) FROM temp.import_staging GROUP BY reject ORDER BY 2 DESC;",
+                               -1, &st, nullptr) == SQLITE_OK) {
+            while (sqlite3_step(st) == SQLITE_ROW) {
+                long long n = sqlite3_column_int64(st, 1);
+                stats.rejected += n;
+                stats.rejectsByReason.emplace_back(columnText(st, 0), n);
+            }
+        }
+        sqlite3_finalize(st); st = nullptr;
+        if (sqlite3_prepare_v2(db_, "SELECT rec_no, title, reject FROM temp.import_staging ORDER BY rec_no LIMIT ?;",
+                               -1, &st, nullptr) == SQLITE_OK) {
+            sqlite3_bind_int(st, 1, kRejectSample);
+            while (sqlite3_step(st) == SQLITE_ROW)
+                stats.sample.push_back({sqlite3_column_int64(st, 0), columnText(st, 1), columnText(st, 2)});
+        }
+        sqlite3_finalize(st);
+        exec("DELETE FROM temp.import_staging;");
+        exec("DELETE FROM temp.import_seen;");
+        return stats;
+    }
+
+    // Calibre import ----------------------------------------------------------
+    // Calibre's metadata.db is SQLite too: attach it read-only and copy rows over
+    // with set-based INSERT ... SELECT in one transaction. Books already present
+    // (same ISBN, or same title+author when there is no ISBN) are skipped.
+    // Returns the number of books imported, or -1 on failure.
+    int importCalibre(const std::string& path) {
+        {
+            std::ifstream probe(path, std::ios::binary);
+            if (!probe) return -1;
+        }
+        sqlite3_stmt* st=nullptr;
+        if (sqlite3_prepare_v2(db_, "ATTACH DATABASE ? AS calibre;", -1, &st, nullptr) != SQLITE_OK) return -1;
+        std::string uri = fileUri(path, "mode=ro");
+        sqlite3_bind_text(st, 1, uri.c_str(), -1, SQLITE_TRANSIENT);
+        int rc = sqlite3_step(st); sqlite3_finalize(st);
+        if (rc != SQLITE_DONE) return -1;
+
+        int imported = -1;
+        if (isCalibreAttached() && exec("BEGIN IMMEDIATE;")) {
+            // Calibre keeps authors in a link table (many per book) and ISBNs in
+            // identifiers(type='isbn'); books.isbn is a legacy column, used as fallback.
+            const char* sql =
+                "INSERT INTO books(title,author,total_pages,current_page,status,isbn) "
+                "SELECT c.title, c.author, 0, 0, 0, c.isbn FROM ("
+                "  SELECT b.id AS id, b.title AS title,"
+                "    COALESCE((SELECT group_concat(name, ' & ') FROM ("
+                "      SELECT a.name AS name FROM calibre.books_authors_link l"
+                "      JOIN calibre.authors a ON a.id = l.author"
+                "      WHERE l.book = b.id ORDER BY l.id)), '') AS author,"
+                "    COALESCE((SELECT COALESCE(isbn13(i.val), upper(replace(replace(i.val,'-',''),' ','')))"
+                "      FROM calibre.identifiers i"
+                "      WHERE i.book = b.id AND lower(i.type) = 'isbn' LIMIT 1),"
+                "      isbn13(NULLIF(b.isbn,'')), '') AS isbn"
+                "  FROM calibre.books b) c "
+                "WHERE NOT EXISTS (SELECT 1 FROM main.books x WHERE"
+                "  (c.isbn <> '' AND x.isbn = c.isbn) OR"
+                "  (c.isbn = '' AND x.title = c.title AND x.author = c.author)) "
+                "ORDER BY c.id;";
+            if (exec(sql)) {
+                imported = sqlite3_changes(db_);
+                if (!exec("COMMIT;")) imported = -1;
+            }
+            if (imported < 0) exec("ROLLBACK;");
+        }
+        exec("DETACH DATABASE calibre;");
+        return imported;
+    }
+
+    // CSV query-without-import -------------------------------------------------
+    // Joins the CSV's "isbn" column against books through the csvfile virtual
+    // table; nothing is imported. nullopt if the file can't be read or has no
+    // isbn column.
+    std::optional<CsvOwnership> checkCsvOwnership(const std::string& path, int sampleLimit = 20) {
+        char* ddl = sqlite3_mprintf("CREATE VIRTUAL TABLE temp.csv_probe USING csvfile('%q');", path.c_str());
+        bool attached = exec(ddl);
+        sqlite3_free(ddl);
+        if (!attached) return std::nullopt;
+
+        std::optional<CsvOwnership> res;
+        // CSV rows are counted, not matches: the library may hold an ISBN twice
+        const char* countSql =
+            "SELECT count(*), count(*) FILTER (WHERE EXISTS ("
+            " SELECT 1 FROM books b WHERE b.isbn <> '' AND b.isbn = isbn13(c.isbn))) "
+            "FROM temp.csv_probe c;";
+        const char* sampleSql =
+            "SELECT id,title,author,total_pages,current_page,status,isbn FROM books "
+            "WHERE isbn <> '' AND isbn IN (SELECT isbn13(isbn) FROM temp.csv_probe) ORDER BY id LIMIT ?;";
+        sqlite3_stmt* st=nullptr;
+        // fails to prepare when the CSV has no isbn column
+        if (sqlite3_prepare_v2(db_, countSql, -1, &st, nullptr) == SQLITE_OK) {
+            CsvOwnership r;
+            if (sqlite3_step(st) == SQLITE_ROW) {
+                r.rows  = sqlite3_column_int64(st, 0);
+                r.owned = sqlite3_column_int64(st, 1);
+            }
+            sqlite3_finalize(st); st = nullptr;
+            if (sqlite3_prepare_v2(db_, sampleSql, -1, &st, nullptr) == SQLITE_OK) {
+                sqlite3_bind_int(st, 1, sampleLimit);
+                while (sqlite3_step(st) == SQLITE_ROW) {
+                    Book b;
+                    b.id          = sqlite3_column_int(st,0);
+                    b.title       = reinterpret_cast<const char*>(sqlite3_column_text(st,1));
+                    const unsigned char* au = sqlite3_column_text(st,2);
+                    b.author      = au ? reinterpret_cast<const char*>(au) : "";
+                    b.totalPages  = sqlite3_column_int(st,3);
+                    b.currentPage = sqlite3_column_int(st,4);
+                    b.status      = sqlite3_column_int(st,5);
+                    const unsigned char* is = sqlite3_column_text(st,6);
+                    b.isbn        = is ? reinterpret_cast<const char*>(is) : "";
+                    r.sample.push_back(std::move(b));
+                }
+            }
+            res = std::move(r);
+        }
+        sqlite3_finalize(st);
+        exec("DROP TABLE temp.csv_probe;");
+        return res;
+    }
+
+private:
+    sqlite3* db_ = nullptr;
+    std::string openError_;
+
+    // Mirror state (see enableColumnMirror()). The hook runs on whichever
+    // thread writes, so dirty ids are handed over under a lock.
+    ColumnMirror mirror_;
+    SearchHeap text_;
+    bool columnsOn_ = false, textOn_ = false, mirrorStale_ = false;
+    size_t mirrorRows_ = 0;
+    long long dataVersion_ = -1;
+    long long changesAll_ = -1, changesOwn_ = -1;   // books_changes when last synced
+    std::mutex dirtyMu_;
+    std::vector<long long> dirty_;
+    static constexpr size_t kMaxDirty = size_t(1) << 20;   // beyond this, reload
+
+    static void onRowChange(void* self, int, const char* dbName, const char* table, sqlite3_int64 rowid) {
+        if (std::strcmp(table, "books") != 0 || std::strcmp(dbName, "main") != 0) return;
+        auto* me = static_cast<SqliteStorage*>(self);
+        std::lock_guard<std::mutex> lk(me->dirtyMu_);
+        if (me->dirty_.size() < kMaxDirty) me->dirty_.push_back(rowid);
+        else me->mirrorStale_ = true;
+    }
+
+    void markStale() { std::lock_guard<std::mutex> lk(dirtyMu_); mirrorStale_ = true; }
+
+    void enableMirror(bool& flag) {
+        if (!db_ || flag) return;
+        flag = true;
+        markStale();   // the new mirror starts from a full load
+        sqlite3_update_hook(db_, &SqliteStorage::onRowChange, this);
+        // This connection's own share of books_changes. Temp triggers only fire
+        // for its writes and roll back with them, statement rollbacks included.
+        exec("CREATE TEMP TABLE IF NOT EXISTS books_own_changes (n INTEGER NOT NULL);");
+        exec("INSERT INTO temp.books_own_changes(n) SELECT 0 WHERE NOT EXISTS (SELECT 1 FROM temp.books_own_changes);");
+        exec("CREATE TEMP TRIGGER IF NOT EXISTS trg_books_own_ins AFTER INSERT ON main.books BEGIN "
+             "  UPDATE books_own_changes SET n = n + 1; END;");
+        exec("CREATE TEMP TRIGGER IF NOT EXISTS trg_books_own_upd AFTER UPDATE ON main.books BEGIN "
+             "  UPDATE books_own_changes SET n = n + 1; END;");
+        exec("CREATE TEMP TRIGGER IF NOT EXISTS trg_books_own_del AFTER DELETE ON main.books BEGIN "
+             "  UPDATE books_own_changes SET n = n + 1; END;");
+    }
+    // The mirror keeps int32 columns; rows written by other tools may hold more.
+    static int32_t columnInt32(sqlite3_stmt* st, int col) {
+        return static_cast<int32_t>(std::clamp<long long>(sqlite3_column_int64(st, col), INT32_MIN, INT32_MAX));
+    }
+    void mirrorRow(long long id, sqlite3_stmt* st, int col) {
+        if (columnsOn_)
+            mirror_.upsert(id, columnInt32(st, col), columnInt32(st, col + 1), columnInt32(st, col + 2));
+        if (textOn_) {
+            auto text = [&](int c){
+                const unsigned char* v = sqlite3_column_text(st, c);
+                return std::string_view(v ? reinterpret_cast<const char*>(v) : "", static_cast<size_t>(sqlite3_column_bytes(st, c)));
+            };
+            text_.upsert(id, text(col + 3), text(col + 4));
+        }
+    }
+
+    long long dataVersion() {
+        StmtLease st = hot(Hot::DataVersion);
+        return st && sqlite3_step(st) == SQLITE_ROW ? sqlite3_column_int64(st, 0) : -1;
+    }
+
+    // Row changes to books by every writer and by this connection alone.
+    bool booksChanges(long long& all, long long& own) {
+        StmtLease st = hot(Hot::BooksChanges);
+        if (!st || sqlite3_step(st) != SQLITE_ROW || sqlite3_column_type(st, 0) == SQLITE_NULL) return false;
+        all = sqlite3_column_int64(st, 0);
+        own = sqlite3_column_int64(st, 1);
+        return true;
+    }
+
+    // Brings the enabled mirrors up to date; false if they can't be loaded.
+    // A commit by another connection (data_version) only forces a full reload
+    // if it changed books: maintenance and the lookup replayer commit often.
+    bool syncMirrors() {
+        std::vector<long long> dirty;
+        bool stale;
+        {
+            std::lock_guard<std::mutex> lk(dirtyMu_);
+            dirty.swap(dirty_);
+            stale = mirrorStale_;
+            mirrorStale_ = false;
+        }
+        long long version = dataVersion();
+        if (version < 0) return false;
+        bool reload = stale || dirty.size() > mirrorRows_ / 4;
+        if (reload || version != dataVersion_) {
+            // read before any reload, so a commit racing it errs towards another reload
+            long long all = -1, own = -1;
+            if (!booksChanges(all, own) || all - changesAll_ != own - changesOwn_) reload = true;
+            changesAll_ = all;
+            changesOwn_ = own;
+            dataVersion_ = version;
+        }
+        metrics::countCache(metrics::Cache::Mirror, !reload);
+        if (reload) {
+            StmtLease st = hot(Hot::MirrorAll);
+            if (!st) { markStale(); return false; }
+            mirror_.clear();
+            text_.clear();
+            mirrorRows_ = 0;
+            for (; sqlite3_step(st) == SQLITE_ROW; ++mirrorRows_) mirrorRow(sqlite3_column_int64(st, 0), st, 1);
+            return true;
+        }
+        std::sort(dirty.begin(), dirty.end());
+        dirty.erase(std::unique(dirty.begin(), dirty.end()), dirty.end());
+        for (long long id: dirty) {
+            StmtLease st = hot(Hot::MirrorRow);
+            if (!st) { markStale(); return false; }
+            sqlite3_bind_int64(st, 1, id);
+            if (sqlite3_step(st) == SQLITE_ROW) {
+                mirrorRow(id, st, 0);
+            } else {   // deleted, or its insert was rolled back
+                mirror_.erase(id);
+                text_.erase(id);
+            }
+        }
+        return true;
+    }
+
+    // Hot statements: prepared once (in the background by warmUpAsync(), else
+    // on first use) and reused for the lifetime of the connection.
+    enum class Hot { Add, AddIfNew, UpdateProgress, UpdateStatus, Remove, Get, Search,
+                     GetDailyRate, SetDailyRate, GetCheckpoint, SaveCheckpoint, DropCheckpoint,
+                     StageRow, StageValidate, StageDedupFile, StageDedupLibrary, StageMerge, StageRemember,
+                     StageClearMerged, ScanAll, QueueAdd, QueueCount, QueueNext, QueueApply, QueueDone, QueueFail, QueueDrop,
+                     RevCacheGet, RevCachePut, NoIsbnBooks, IsbnOwner, SetIsbn,
+                     DataVersion, BooksChanges, MirrorAll, MirrorRow, AggTotals, AggStatus, AggProgress,
+                     ReadingDays, ReadingLeft, Count };
+    static constexpr const char* kHotSql[] = {
+        /* Add            */ "INSERT INTO books(title,author,total_pages,current_page,status,isbn)"
+                             "VALUES(?,?,?,?,?,?);",
+        /* AddIfNew       */ "INSERT INTO books(title,author,total_pages,current_page,status,isbn) "
+                             "SELECT ?1,?2,?3,?4,?5,?6 "
+                             "WHERE ?6 = '' OR NOT EXISTS (SELECT 1 FROM books WHERE isbn=?6);",
+        /* UpdateProgress */ "UPDATE books SET current_page=?, status=? WHERE id=?;",
+        /* UpdateStatus   */ "UPDATE books SET status=?, current_page=CASE WHEN ?=2 THEN total_pages ELSE current_page END WHERE id=?;",
+        /* Remove         */ "DELETE FROM books WHERE id=?;",
+        /* Get            */ "SELECT id,title,author,total_pages,current_page,status,isbn FROM books WHERE id=?;",
+        /* Search         */ "SELECT id,title,author,total_pages,current_page,status,isbn "
+                             "FROM books WHERE lower(title) LIKE ? OR lower(author) LIKE ? ORDER BY id ASC;",
+        /* GetDailyRate   */ "SELECT value FROM settings WHERE key='daily_rate';",
+        /* SetDailyRate   */ "INSERT INTO settings(key,value) VALUES('daily_rate',?) "
+                             "ON CONFLICT(key) DO UPDATE SET value=excluded.value;",
+        /* GetCheckpoint  */ "SELECT byte_offset,rows_committed FROM import_checkpoints WHERE file_key=?;",
+        /* SaveCheckpoint */ "INSERT INTO import_checkpoints(file_key,byte_offset,rows_committed,updated_at) "
+                             "VALUES(?1,?2,?3,datetime('now')) ON CONFLICT(file_key) DO UPDATE SET "
+                             "byte_offset=excluded.byte_offset, rows_committed=excluded.rows_committed, "
+                             "updated_at=excluded.updated_at;",
+        /* DropCheckpoint */ "DELETE FROM import_checkpoints WHERE file_key=?;",
+        // Staged CSV import (temp.import_staging exists only during importCsv;
+        // these fail to warm up before that and are prepared on first use).
+        /* StageRow       */ "INSERT INTO temp.import_staging(rec_no,ncols,title,author,total_pages,current_page,status,isbn) "
+                             "VALUES(?,?,?,?,?,?,?,?);",
+        /* StageValidate  */ "UPDATE temp.import_staging SET reject = CASE"
+                             " WHEN ncols < 7 THEN 'expected 7 columns'"
+                             " WHEN trim(title) = '' THEN 'missing title'"
+                             " WHEN trim(total_pages) GLOB '*[^0-9]*' THEN 'totalPages is not a number'"
+                             " WHEN trim(current_page) GLOB '*[^0-9]*' THEN 'currentPage is not a number'"
+                             // page counts must fit the int columns are read back into
+                             " WHEN length(ltrim(trim(total_pages),'0')) > 9 THEN 'totalPages out of range'"
+                             " WHEN length(ltrim(trim(current_page),'0')) > 9 THEN 'currentPage out of range'"
+                             " WHEN trim(status) NOT IN ('','0','1','2') THEN 'status must be 0, 1 or 2'"
+                             " WHEN trim(isbn) <> '' AND isbn13(isbn) IS NULL THEN 'invalid ISBN'"
+                             " END, norm_isbn = isbn13(isbn) WHERE reject IS NULL AND ("
+                             // only touch rows that can change, so clean rows aren't rewritten
+                             " ncols < 7 OR trim(title) = '' OR trim(total_pages) GLOB '*[^0-9]*'"
+                             " OR trim(current_page) GLOB '*[^0-9]*' OR trim(status) NOT IN ('','0','1','2')"
+                             " OR length(trim(total_pages)) > 9 OR length(trim(current_page)) > 9"
+                             " OR trim(isbn) <> '');",
+        /* StageDedupFile */ "UPDATE temp.import_staging SET reject = 'duplicate ISBN in file' "
+                             "WHERE reject IS NULL AND norm_isbn IS NOT NULL AND (rec_no > "
+                             "(SELECT min(s.rec_no) FROM temp.import_staging s"
+                             " WHERE s.norm_isbn = import_staging.norm_isbn AND s.reject IS NULL)"
+                             " OR norm_isbn IN (SELECT isbn FROM temp.import_seen));",
+        /* StageDedupLib  */ "UPDATE temp.import_staging SET reject = 'ISBN already in library' "
+                             "WHERE reject IS NULL AND norm_isbn IS NOT NULL "
+                             "AND EXISTS (SELECT 1 FROM main.books b WHERE b.isbn = import_staging.norm_isbn);",
+        /* StageMerge     */ "INSERT INTO main.books(title,author,total_pages,current_page,status,isbn) "
+                             "SELECT title, author, tp, min(max(CAST(trim(current_page) AS INTEGER),0),tp),"
+                             " CAST(trim(status) AS INTEGER), COALESCE(norm_isbn,'') FROM ("
+                             "  SELECT *, max(CAST(trim(total_pages) AS INTEGER),0) AS tp FROM temp.import_staging"
+                             "  WHERE reject IS NULL) ORDER BY rec_no;",
+        // merged rows leave staging, but their ISBNs still count as seen in the file
+        /* StageRemember  */ "INSERT OR IGNORE INTO temp.import_seen(isbn) SELECT norm_isbn FROM temp.import_staging"
+                             " WHERE reject IS NULL AND norm_isbn IS NOT NULL;",
+        /* StageClearMrgd */ "DELETE FROM temp.import_staging WHERE reject IS NULL;",
+        /* ScanAll        */ "SELECT id,title,author,total_pages,current_page,status,isbn FROM books ORDER BY id;",
+        /* QueueAdd       */ "INSERT OR IGNORE INTO lookup_queue(isbn,enqueued_at) VALUES(?,datetime('now'));",
+        /* QueueCount     */ "SELECT count(*) FROM lookup_queue;",
+        /* QueueNext      */ "SELECT isbn FROM lookup_queue WHERE last_attempt IS NULL"
+                             " OR last_attempt <= datetime('now', printf('-%d minutes', attempts * 10)) "
+                             "ORDER BY enqueued_at, rowid LIMIT ?;",
+        /* QueueApply     */ "UPDATE books SET title = CASE WHEN trim(title) = '' AND ?1 <> '' THEN ?1 ELSE title END,"
+                             " author = CASE WHEN trim(IFNULL(author,'')) = '' AND ?2 <> '' THEN ?2 ELSE author END "
+                             "WHERE isbn = ?3 AND (trim(title) = '' OR trim(IFNULL(author,'')) = '');",
+        /* QueueDone      */ "DELETE FROM lookup_queue WHERE isbn=?;",
+        /* QueueFail      */ "UPDATE lookup_queue SET attempts = attempts + 1, last_attempt = datetime('now') WHERE isbn=?1;",
+        /* QueueDrop      */ "DELETE FROM lookup_queue WHERE isbn=?1 AND attempts >= ?2;",
+        /* RevCacheGet    */ "SELECT isbn,title,author FROM reverse_lookup_cache WHERE query_key=? "
+                             "AND (isbn <> '' OR fetched_at > datetime('now','-30 days'));",
+        /* RevCachePut    */ "INSERT OR REPLACE INTO reverse_lookup_cache(query_key,isbn,title,author,fetched_at) "
+                             "VALUES(?,?,?,?,datetime('now'));",
+        /* NoIsbnBooks    */ "SELECT id,title,author FROM books WHERE IFNULL(isbn,'') = '' ORDER BY id;",
+        /* IsbnOwner      */ "SELECT id FROM books WHERE isbn=? LIMIT 1;",
+        /* SetIsbn        */ "UPDATE books SET isbn=? WHERE id=? AND IFNULL(isbn,'') = '';",
+        /* DataVersion    */ "PRAGMA data_version;",
+        // temp.books_own_changes exists once a mirror is enabled; prepared on first use
+        /* BooksChanges   */ "SELECT (SELECT n FROM main.books_changes), (SELECT n FROM temp.books_own_changes);",
+        /* MirrorAll      */ "SELECT id,total_pages,current_page,status,title,IFNULL(author,'') FROM books;",
+        /* MirrorRow      */ "SELECT total_pages,current_page,status,title,IFNULL(author,'') FROM books WHERE id=?;",
+        // Aggregates without the mirror; same semantics as the colkern kernels
+        // for page counts within int32 (the mirror saturates larger ones).
+        /* AggTotals      */ "SELECT count(*), IFNULL(sum(total_pages),0), IFNULL(sum(current_page),0),"
+                             " IFNULL(sum(max(total_pages-current_page,0)),0) FROM books WHERE ?1 IS NULL OR status=?1;",
+        /* AggStatus      */ "SELECT status, count(*) FROM books WHERE status BETWEEN 0 AND 2 GROUP BY status;",
+        /* AggProgress    */ "SELECT CASE WHEN total_pages <= 0 THEN 0 WHEN current_page >= total_pages THEN 10"
+                             " ELSE min(max(current_page*10/total_pages,0),9) END AS bin, count(*) FROM books GROUP BY bin;",
+        /* ReadingDays    */ "SELECT CAST(julianday(date('now','localtime')) - julianday(day) AS INTEGER), pages "
+                             "FROM reading_log WHERE day > date('now','localtime',printf('-%d days',?1));",
+        /* ReadingLeft    */ "SELECT id, max(total_pages-current_page,0) FROM books WHERE status=1 ORDER BY id;",
+    };
+    static_assert(sizeof(kHotSql) / sizeof(kHotSql[0]) == static_cast<size_t>(Hot::Count), "one SQL per Hot");
+    std::array<sqlite3_stmt*, static_cast<size_t>(Hot::Count)> hotStmts_{};
+    std::array<sqlite3_stmt*, listsql::kVariants> listStmts_{};
+    std::future<void> warm_;
+
+    // Borrowed cached statement; reset and unbound when the lease ends.
+    class StmtLease {
+    public:
+        explicit StmtLease(sqlite3_stmt* st) : st_(st) {}
+        ~StmtLease() { if (st_) { sqlite3_reset(st_); sqlite3_clear_bindings(st_); } }
+        StmtLease(const StmtLease&) = delete;
+        StmtLease& operator=(const StmtLease&) = delete;
+        operator sqlite3_stmt*() const { return st_; }
+    private:
+        sqlite3_stmt* st_;
+    };
+
+    bool prepareInto(sqlite3_stmt*& slot, const char* sql) {
+        if (slot) return true;
+        if (sqlite3_prepare_v3(db_, sql, -1, SQLITE_PREPARE_PERSISTENT, &slot, nullptr) == SQLITE_OK) return true;
+        sqlite3_finalize(slot);
+        slot = nullptr;
+        return false;
+    }
+    // The warm-up is the only other thread touching the caches; join it first.
+    void waitWarm() { if (warm_.valid()) warm_.get(); }
+
+    // Warm-up failures are expected (see StageRow); a failure here is not.
+    bool prepareLogged(sqlite3_stmt*& slot, const char* sql) {
+        if (prepareInto(slot, sql)) return true;
+        logging::log(logging::Level::Warn, "sql_prepare_failed", {{"sql", sql}, {"msg", sqlite3_errmsg(db_)}});
+        return false;
+    }
+    StmtLease hot(Hot q) {
+        waitWarm();
+        sqlite3_stmt*& st = hotStmts_[static_cast<size_t>(q)];
+        prepareLogged(st, kHotSql[static_cast<size_t>(q)]);
+        return StmtLease(st);
+    }
+    StmtLease listStmt(unsigned flags) {
+        waitWarm();
+        prepareLogged(listStmts_[flags], listsql::kSql[flags]);
+        return StmtLease(listStmts_[flags]);
+    }
+
+    // Write contention: busy_timeout waits inside SQLite first; if a write still
+    // reports BUSY/LOCKED, it is retried up to kMaxRetries times with jittered
+    // exponential backoff. Only single statements are retried, never half a
+    // transaction, and write transactions start with BEGIN IMMEDIATE so the
+    // lock is taken up front instead of failing at the first write.
+    static constexpr int kMaxRetries = 3;
+
+    static bool isBusy(int rc) {
+        rc &= 0xff;
+        return rc == SQLITE_BUSY || rc == SQLITE_LOCKED;
+    }
+    static void backoff(int attempt) {
+        thread_local std::mt19937 rng{std::random_device{}()};
+        std::uniform_real_distribution<double> jitter(0.5, 1.5);
+        double ms = 10.0 * (1 << std::min(attempt, 6)) * jitter(rng);
+        std::this_thread::sleep_for(std::chrono::microseconds(static_cast<long long>(ms * 1000)));
+    }
+    int stepRetry(sqlite3_stmt* st) {
+        int rc = sqlite3_step(st);
+        for (int attempt = 0; isBusy(rc) && attempt < kMaxRetries; ++attempt) {
+            sqlite3_reset(st);   // bindings survive a reset
+            backoff(attempt);
+            rc = sqlite3_step(st);
+        }
+        if (isBusy(rc))
+            logging::log(logging::Level::Warn, "sql_busy", {{"sql", sqlite3_sql(st)}, {"attempts", kMaxRetries + 1}});
+        else if (rc != SQLITE_ROW && rc != SQLITE_DONE)
+            logging::log(logging::Level::Warn, "sql_error", {{"sql", sqlite3_sql(st)}, {"rc", rc}, {"msg", sqlite3_errmsg(db_)}});
+        return rc;
+    }
+
+    bool exec(const char* sql) {
+        char* err = nullptr;
+        int rc = sqlite3_exec(db_, sql, nullptr, nullptr, &err);
+        for (int attempt = 0; isBusy(rc) && attempt < kMaxRetries; ++attempt) {
+            sqlite3_free(err); err = nullptr;
+            backoff(attempt);
+            rc = sqlite3_exec(db_, sql, nullptr, nullptr, &err);
+        }
+        if (rc != SQLITE_OK) {
+            logging::log(logging::Level::Warn, "sql_error", {{"sql", sql}, {"rc", rc}, {"msg", err ? err : sqlite3_errmsg(db_)}});
+            sqlite3_free(err);   // the message stays available through lastError()
+            return false;
+        }
+        return true;
+    }
+
+    bool isCalibreAttached() {
+        const char* sql =
+            "SELECT count(*) FROM calibre.sqlite_master WHERE type='table' "
+            "AND name IN ('books','authors','books_authors_link','identifiers');";
+        sqlite3_stmt* st=nullptr;
+        if (sqlite3_prepare_v2(db_, sql, -1, &st, nullptr) != SQLITE_OK) return false;
+        bool ok = sqlite3_step(st) == SQLITE_ROW && sqlite3_column_int(st, 0) == 4;
+        sqlite3_finalize(st);
+        return ok;
+    }
+
+    // SQLite URI for a plain file path (percent-escapes the characters URIs reserve).
+    static std::string fileUri(const std::string& path, const char* query) {
+        std::string p = path;
+        std::replace(p.begin(), p.end(), '\\', '/');
+        std::string out = "file:";
+        if (p.size() > 1 && p[1] == ':') out += "/";   // Windows drive letter
+        static const char* hex = "0123456789ABCDEF";
+        for (unsigned char c: p) {
+            if (c=='%' || c=='?' || c=='#' || c<=0x20) {
+                out.push_back('%'); out.push_back(hex[c>>4]); out.push_back(hex[c&15]);
+            } else out.push_back(static_cast<char>(c));
+        }
+        out += "?"; out += query;
+        return out;
+    }
+
+    // Identity of an import source: canonical path, size and modification time.
+    static std::string fileIdentity(const std::string& path) {
+        namespace fs = std::filesystem;
+        std::error_code ec;
+        fs::path canon = fs::canonical(path, ec);
+        if (ec) return "";
+        auto size  = fs::file_size(canon, ec);
+        if (ec) return "";
+        auto mtime = fs::last_write_time(canon, ec);
+        if (ec) return "";
+        return canon.string() + "|" + std::to_string(size) + "|" + std::to_string(mtime.time_since_epoch().count());
+    }
+    // Runs a cached no-result statement; optionally reports rows changed.
+    bool execHot(Hot q, long long* changes = nullptr) {
+        StmtLease st = hot(q);
+        if (!st || sqlite3_step(st) != SQLITE_DONE) return false;
+        if (changes) *changes = sqlite3_changes(db_);
+        return true;
+    }
+    static void bindField(sqlite3_stmt* st, int idx, const CsvField& f) {
+        if (f.escaped) {
+            std::string v = f.str();
+            sqlite3_bind_text(st, idx, v.data(), static_cast<int>(v.size()), SQLITE_TRANSIENT);
+        } else {
+            // the mapped file outlives the step, so no copy is needed
+            sqlite3_bind_text(st, idx, f.b, static_cast<int>(f.e - f.b), SQLITE_STATIC);
+        }
+    }
+    static std::string columnText(sqlite3_stmt* st, int col) {
+        const unsigned char* t = sqlite3_column_text(st, col);
+        return t ? reinterpret_cast<const char*>(t) : "";
+    }
+
+    bool saveCheckpoint(const std::string& key, unsigned long long offset, long long rows) {
+        StmtLease st = hot(Hot::SaveCheckpoint);
+        if (!st) return false;
+        sqlite3_bind_text (st, 1, key.c_str(), -1, SQLITE_TRANSIENT);
+        sqlite3_bind_int64(st, 2, static_cast<sqlite3_int64>(offset));
+        sqlite3_bind_int64(st, 3, rows);
+        return sqlite3_step(st) == SQLITE_DONE;
+    }
+    bool dropCheckpoint(const std::string& key) {
+        StmtLease st = hot(Hot::DropCheckpoint);
+        if (!st) return false;
+        sqlite3_bind_text(st, 1, key.c_str(), -1, SQLITE_TRANSIENT);
+        return stepRetry(st) == SQLITE_DONE;
+    }
+
+
+    // Byte-comparable sort key: the chosen field (ASCII case-folded text or a
+    // zero-padded number) followed by the zero-padded id as a tiebreak.
+    static std::string sortKey(const Book& b, ExportKey key) {
+        auto pad = [](unsigned long long v){ std::string n = std::to_string(v); return std::string(20 - n.size(), '0') + n; };
+        auto fold = [](std::string s){
+            std::transform(s.begin(), s.end(), s.begin(), [](unsigned char c){ return std::tolower(c); });
+            return s;
+        };
+        std::string k;
+        switch (key) {
+            case ExportKey::Id:       break;
+            case ExportKey::Title:    k = fold(b.title); break;
+            case ExportKey::Author:   k = fold(b.author); break;
+            case ExportKey::Isbn:     k = b.isbn; break;
+            case ExportKey::Pages:    k = pad(static_cast<unsigned long long>(std::max(0, b.totalPages))); break;
+            case ExportKey::Progress: k = pad(static_cast<unsigned long long>(percentComplete(b) * 1000)); break;
+            case ExportKey::Status:   k = pad(static_cast<unsigned long long>(std::max(0, b.status))); break;
+        }
+        k.push_back('\0');   // shorter field sorts first
+        return k + pad(static_cast<unsigned long long>(std::max(0, b.id)));
+    }
+
+    static std::string csvQuote(const std::string& s) {
+        std::string out; out.reserve(s.size()+4);
+        out.push_back('"');
+        for (char c: s) {
+            if (c == '"') out += "\"\"";
+            else out.push_back(c);
+        }
+        out.push_back('"');
+        return out;
+    }
+};
+
+// ----------------------------- Maintenance ---------------------------------
+// Background upkeep on its own connection: PRAGMA optimize and a bounded
+// ANALYZE on a schedule (ANALYZE first runs in the first idle window, as a
+// CLI session rarely lasts a whole interval), WAL checkpoints once the -wal
+// file passes a size threshold, and incremental vacuum in small slices while
+// the UI is idle.
+// Every task is short or non-blocking (PASSIVE checkpoints, analysis_limit,
+// few pages per vacuum slice) and the connection uses a tiny busy timeout,
+// so maintenance gives way to the foreground instead of holding it up.
+class MaintenanceScheduler {
+public:
+    struct Options {
+        std::chrono::seconds optimizeEvery{3600};
+        std::chrono::seconds analyzeEvery{24 * 3600};
+        std::chrono::seconds walPollEvery{15};
+        long long walCheckpointBytes = 8LL << 20;
+        std::chrono::milliseconds idleAfter{3000};     // quiet time before idle-only tasks
+        int vacuumPagesPerSlice = 64;
+        std::chrono::milliseconds vacuumBudget{20};    // per tick
+        int busyTimeoutMs = 5;
+    };
+    using TaskStats = MaintenanceTaskStats;
+
+    MaintenanceScheduler(std::string dbPath, Options opt)
+        : path_(std::move(dbPath)), opt_(opt), stats_{{"optimize"}, {"analyze"}, {"checkpoint"}, {"incremental_vacuum"}} {}
+    MaintenanceScheduler(const MaintenanceScheduler&) = delete;
+    MaintenanceScheduler& operator=(const MaintenanceScheduler&) = delete;
+    ~MaintenanceScheduler() { stop(); }
+
+    void start() {
+        if (thread_.joinable()) return;
+        stop_ = false;
+        thread_ = std::thread([this]{ run(); });
+    }
+    void stop() {
+        {
+            std::lock_guard<std::mutex> lk(mu_);
+            stop_ = true;
+        }
+        cv_.notify_all();
+        if (thread_.joinable()) thread_.join();
+    }
+
+    std::vector<TaskStats> stats() const {
+        std::lock_guard<std::mutex> lk(mu_);
+        return std::vector<TaskStats>(std::begin(stats_), std::end(stats_));
+    }
+    bool vacuumEnabled() const { return vacuumEnabled_.load(); }
+
+    // Bracket foreground work (see idle()); Library::ForegroundScope pairs them.
+    void foregroundBegin() { active_.fetch_add(1, std::memory_order_relaxed); }
+    void foregroundEnd() {
+        lastActivity_.store(nowMs(), std::memory_order_relaxed);
+        active_.fetch_sub(1, std::memory_order_relaxed);
+    }
+
+private:
+    enum Task { Optimize, Analyze, Checkpoint, Vacuum, TaskCount };
+
+    std::string path_;
+    Options opt_;
+    sqlite3* db_ = nullptr;
+    std::thread thread_;
+    mutable std::mutex mu_;
+    std::condition_variable cv_;
+    bool stop_ = false;
+    TaskStats stats_[TaskCount];
+    std::atomic<int> active_{0};
+    std::atomic<long long> lastActivity_{nowMs()};
+    std::atomic<bool> vacuumEnabled_{false};
+
+    static long long nowMs() {
+        return std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+    bool idle() const {
+        return active_.load(std::memory_order_relaxed) == 0 &&
+               nowMs() - lastActivity_.load(std::memory_order_relaxed) >= opt_.idleAfter.count();
+    }
+
+    // Runs sql on the maintenance connection and records its duration under task.
+    bool timed(Task task, const char* sql) {
+        auto t0 = std::chrono::steady_clock::now();
+        bool ok = sqlite3_exec(db_, sql, nullptr, nullptr, nullptr) == SQLITE_OK;
+        double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0).count();
+        std::lock_guard<std::mutex> lk(mu_);
+        TaskStats& s = stats_[task];
+        ++s.runs; s.totalMs += ms; s.lastMs = ms; s.maxMs = std::max(s.maxMs, ms);
+        logging::log(ok ? logging::Level::Debug : logging::Level::Warn, "maintenance",
+                     {{"task", s.name}, {"ms", ms}, {"ok", ok}});
+        return ok;
+    }
+    long long pragmaInt(const char* sql) {
+        sqlite3_stmt* st = nullptr;
+        long long v = -1;
+        if (sqlite3_prepare_v2(db_, sql, -1, &st, nullptr) == SQLITE_OK && sqlite3_step(st) == SQLITE_ROW)
+            v = sqlite3_column_int64(st, 0);
+        sqlite3_finalize(st);
+        return v;
+    }
+    long long walBytes() const {
+        std::error_code ec;
+        auto n = std::filesystem::file_size(path_ + "-wal", ec);
+        return ec ? 0 : static_cast<long long>(n);
+    }
+
+    void run() {
+        if (sqlite3_open_v2(path_.c_str(), &db_, SQLITE_OPEN_READWRITE, nullptr) != SQLITE_OK) {
+            sqlite3_close(db_); db_ = nullptr;
+            return;
+        }
+        sqlite3_busy_timeout(db_, opt_.busyTimeoutMs);
+        sqlite3_exec(db_, "PRAGMA analysis_limit=400;", nullptr, nullptr, nullptr);
+        vacuumEnabled_ = pragmaInt("PRAGMA auto_vacuum;") == 2;   // 2 = INCREMENTAL
+
+        using clock = std::chrono::steady_clock;
+        auto nextOptimize = clock::now() + std::chrono::seconds(60);   // let startup settle first
+        auto nextAnalyze  = clock::now();   // first idle window, then every analyzeEvery
+        auto nextWalPoll  = clock::now() + opt_.walPollEvery;
+
+        std::unique_lock<std::mutex> lk(mu_);
+        while (!cv_.wait_for(lk, std::chrono::seconds(1), [this]{ return stop_; })) {
+            lk.unlock();
+            auto now = clock::now();
+            if (now >= nextOptimize) {
+                timed(Optimize, "PRAGMA optimize;");
+                nextOptimize = now + opt_.optimizeEvery;
+            }
+            if (now >= nextAnalyze && idle()) {
+                timed(Analyze, "ANALYZE;");
+                nextAnalyze = now + opt_.analyzeEvery;
+            }
+            if (now >= nextWalPoll) {
+                if (walBytes() >= opt_.walCheckpointBytes)
+                    timed(Checkpoint, idle() ? "PRAGMA wal_checkpoint(TRUNCATE);" : "PRAGMA wal_checkpoint(PASSIVE);");
+                nextWalPoll = now + opt_.walPollEvery;
+            }
+            if (vacuumEnabled_ && idle()) vacuumSlices();
+            lk.lock();
+        }
+        lk.unlock();
+        sqlite3_close(db_);
+        db_ = nullptr;
+    }
+
+    void vacuumSlices() {
+        auto deadline = std::chrono::steady_clock::now() + opt_.vacuumBudget;
+        std::string sql = "PRAGMA incremental_vacuum(" + std::to_string(opt_.vacuumPagesPerSlice) + ");";
+        while (std::chrono::steady_clock::now() < deadline && idle() && pragmaInt("PRAGMA freelist_count;") > 0) {
+            if (!timed(Vacuum, sql.c_str())) break;
+        }
+    }
+};
+
+// ----------------------------- Offline lookup replay -----------------------
+// ISBNs added while offline are stored in lookup_queue. This worker, on its
+// own connection, checks connectivity cheaply (one HEAD) while the queue is
+// non-empty. Once the network is back it replays the queue in batches,
+// rate-limited so a long outage doesn't burst the providers, and fills in the
+// blank titles/authors of the affected books.
+class LookupReplayer {
+public:
+    struct Options {
+        std::chrono::seconds offlineCheckEvery{30};
+        std::chrono::seconds idleCheckEvery{120};   // notices rows queued by other processes
+        int batchSize = 25;
+        double lookupsPerSec = 1.0;
+        int burst = 3;
+        int maxAttempts = 5;                        // then the ISBN is considered unknown
+        int busyTimeoutMs = 250;
+    };
+    using Stats = LookupQueueStats;
+
+    LookupReplayer(std::string dbPath, Options opt) : path_(std::move(dbPath)), opt_(opt) {}
+    LookupReplayer(const LookupReplayer&) = delete;
+    LookupReplayer& operator=(const LookupReplayer&) = delete;
+    ~LookupReplayer() { stop(); }
+
+    void start() {
+        if (thread_.joinable()) return;
+        stop_ = false;
+        cancel_.store(false, std::memory_order_relaxed);
+        stats_.online = g_online;
+        thread_ = std::thread([this]{ run(); });
+    }
+    // Also aborts a lookup in flight, within about a second.
+    void stop() {
+        {
+            std::lock_guard<std::mutex> lk(mu_);
+            stop_ = true;
+        }
+        cancel_.store(true, std::memory_order_relaxed);
+        cv_.notify_all();
+        if (thread_.joinable()) thread_.join();
+    }
+    // Something was queued: check now instead of at the next interval.
+    void kick() {
+        { std::lock_guard<std::mutex> lk(mu_); kick_ = true; }
+        cv_.notify_all();
+    }
+
+    Stats stats() const { std::lock_guard<std::mutex> lk(mu_); return stats_; }
+    // ISBNs resolved since the last call (for a one-line notice in the menu).
+    unsigned long long takeCompleted() { return unseen_.exchange(0); }
+
+private:
+    std::string path_;
+    Options opt_;
+    std::thread thread_;
+    mutable std::mutex mu_;
+    std::condition_variable cv_;
+    bool stop_ = false, kick_ = false;
+    std::atomic<bool> cancel_{false};
+    Stats stats_;
+    std::atomic<unsigned long long> unseen_{0};
+
+    // Sleeps for d unless stopped; returns false on stop.
+    bool sleepFor(std::chrono::steady_clock::duration d) {
+        std::unique_lock<std::mutex> lk(mu_);
+        return !cv_.wait_for(lk, d, [this]{ return stop_; });
+    }
+    template <class F> void update(F&& f) { std::lock_guard<std::mutex> lk(mu_); f(stats_); }
+
+    bool checkOnline() {
+        bool on = internetOk();
+        if (cancel_.load(std::memory_order_relaxed)) return false;   // aborted, says nothing
+        if (g_online.exchange(on) != on) logging::log(logging::Level::Info, "connectivity", {{"online", on}});
+        update([&](Stats& s){ ++s.checks; s.online = on; });
+        return on;
+    }
+
+    void run() {
+        t_httpCancel = &cancel_;
+        SqliteStorage db(path_, opt_.busyTimeoutMs);
+        if (!db.ok()) return;
+        // token bucket: one token per lookup
+        using clock = std::chrono::steady_clock;
+        double tokens = opt_.burst;
+        auto refilled = clock::now();
+        auto takeToken = [&]{
+            while (true) {
+                auto now = clock::now();
+                tokens = std::min<double>(opt_.burst, tokens + std::chrono::duration<double>(now - refilled).count() * opt_.lookupsPerSec);
+                refilled = now;
+                if (tokens >= 1.0) { tokens -= 1.0; return true; }
+                if (!sleepFor(std::chrono::duration_cast<clock::duration>(
+                        std::chrono::duration<double>((1.0 - tokens) / opt_.lookupsPerSec)))) return false;
+            }
+        };
+
+        while (true) {
+            long long pending = db.lookupQueueSize();
+            update([&](Stats& s){ s.pending = pending; });
+            auto wait = opt_.idleCheckEvery;
+            if (pending > 0) {
+                if (checkOnline()) {
+                    auto batch = db.pendingLookups(opt_.batchSize);
+                    for (const auto& isbn: batch) {
+                        if (!takeToken()) return;
+                        // Not through LookupFlights: a lookup aborted by stop()
+                        // must not fail a foreground lookup merged into it.
+                        std::optional<LookupResult> r;
+                        try { r = fetchIsbn(isbn); } catch (...) {}
+                        if (cancel_.load(std::memory_order_relaxed)) return;
+                        if (r) {
+                            int n = db.applyLookup(isbn, *r);
+                            if (n >= 0) {
+                                logging::log(logging::Level::Info, "lookup_replayed", {{"isbn", isbn}, {"books", n}});
+                                ++unseen_;
+                                update([&](Stats& s){ ++s.resolved; s.booksUpdated += n; });
+                            }
+                        } else if (!checkOnline()) {
+                            break;   // dropped offline mid-batch; try again later
+                        } else if (db.lookupFailed(isbn, opt_.maxAttempts) > 0) {
+                            logging::log(logging::Level::Warn, "lookup_given_up", {{"isbn", isbn}, {"attempts", opt_.maxAttempts}});
+                            update([](Stats& s){ ++s.givenUp; });
+                        }
+                    }
+                    long long left = db.lookupQueueSize();
+                    update([&](Stats& s){ s.pending = left; });
+                    if (!g_online) wait = opt_.offlineCheckEvery;
+                    else if (static_cast<int>(batch.size()) == opt_.batchSize) wait = std::chrono::seconds(0);   // more due
+                } else {
+                    wait = opt_.offlineCheckEvery;
+                }
+            }
+            std::unique_lock<std::mutex> lk(mu_);
+            cv_.wait_for(lk, wait, [this]{ return stop_ || kick_; });
+            if (stop_) return;
+            kick_ = false;
+        }
+    }
+};
+
+// ----------------------------- Metrics export ------------------------------
+// Writes the metrics registry, plus library-size gauges read on its own
+// connection, in the Prometheus text format for node_exporter's textfile
+// collector. Each snapshot goes to "<path>.tmp" and is renamed over <path>,
+// so a scrape never sees a half-written file (the collector only reads
+// *.prom). A last snapshot is written on stop.
+class MetricsExporter {
+public:
+    struct Options {
+        std::string promPath;
+        std::chrono::milliseconds every{15000};
+        int busyTimeoutMs = 250;
+    };
+
+    MetricsExporter(std::string dbPath, Options opt) : path_(std::move(dbPath)), opt_(std::move(opt)) {}
+    MetricsExporter(const MetricsExporter&) = delete;
+    MetricsExporter& operator=(const MetricsExporter&) = delete;
+    ~MetricsExporter() { stop(); }
+
+    void start() {
+        if (thread_.joinable()) return;
+        stop_ = false;
+        thread_ = std::thread([this]{ run(); });
+    }
+    void stop() {
+        {
+            std::lock_guard<std::mutex> lk(mu_);
+            stop_ = true;
+        }
+        cv_.notify_all();
+        if (thread_.joinable()) thread_.join();
+    }
+    unsigned long long writes() const { return writes_.load(std::memory_order_relaxed); }
+    unsigned long long failures() const { return failures_.load(std::memory_order_relaxed); }
+
+private:
+    std::string path_;
+    Options opt_;
+    sqlite3* db_ = nullptr;
+    std::thread thread_;
+    std::mutex mu_;
+    std::condition_variable cv_;
+    bool stop_ = false;
+    std::atomic<unsigned long long> writes_{0}, failures_{0};
+
+    void run() {
+        if (sqlite3_open_v2(path_.c_str(), &db_, SQLITE_OPEN_READONLY, nullptr) != SQLITE_OK) {
+            sqlite3_close(db_); db_ = nullptr;   // registry metrics are still written
+        } else {
+            sqlite3_busy_timeout(db_, opt_.busyTimeoutMs);
+        }
+        std::unique_lock<std::mutex> lk(mu_);
+        do {
+            lk.unlock();
+            write();
+            lk.lock();
+        } while (!cv_.wait_for(lk, opt_.every, [this]{ return stop_; }));
+        lk.unlock();
+        write();
+        sqlite3_close(db_);
+        db_ = nullptr;
+    }
+
+    void write() {
+        if (writeFile()) { writes_.fetch_add(1, std::memory_order_relaxed); return; }
+        if (failures_.fetch_add(1, std::memory_order_relaxed) == 0)   // once, not every interval
+            logging::log(logging::Level::Warn, "metrics_write_failed", {{"path", opt_.promPath}});
+    }
+    bool writeFile() {
+        std::string tmp = opt_.promPath + ".tmp";
+        {
+            std::ofstream f(tmp, std::ios::binary | std::ios::trunc);
+            if (!f) return false;
+            render(f);
+            if (!f.flush()) return false;
+        }
+        std::error_code ec;
+        std::filesystem::rename(tmp, opt_.promPath, ec);
+        return !ec;
+    }
+
+    static void header(std::ostream& out, const char* name, const char* type, const char* help) {
+        out << "# HELP " << name << ' ' << help << "\n# TYPE " << name << ' ' << type << '\n';
+    }
+    static uint64_t load(const std::atomic<uint64_t>& a) { return a.load(std::memory_order_relaxed); }
+
+    void render(std::ostream& out) {
+        using namespace metrics;
+        const Registry& r = g_registry;
+        out << std::setprecision(9);
+
+        if (db_) {
+            sqlite3_stmt* st = nullptr;
+            long long byStatus[3] = {0, 0, 0}, queued = 0;
+            bool ok = sqlite3_prepare_v2(db_, "SELECT status, count(*) FROM books WHERE status BETWEEN 0 AND 2 "
+                                              "GROUP BY status;", -1, &st, nullptr) == SQLITE_OK;
+            while (ok && sqlite3_step(st) == SQLITE_ROW) byStatus[sqlite3_column_int(st, 0)] = sqlite3_column_int64(st, 1);
+            sqlite3_finalize(st);
+            if (ok) {
+                header(out, "booktracer_books", "gauge", "Books in the library by status.");
+                const char* names[] = {"to_read", "reading", "finished"};
+                for (int s = 0; s < 3; ++s) out << "booktracer_books{status=\"" << names[s] << "\"} " << byStatus[s] << '\n';
+            }
+            st = nullptr;
+            if (sqlite3_prepare_v2(db_, "SELECT count(*) FROM lookup_queue;", -1, &st, nullptr) == SQLITE_OK
+                && sqlite3_step(st) == SQLITE_ROW) {
+                queued = sqlite3_column_int64(st, 0);
+                header(out, "booktracer_lookup_queue_pending", "gauge", "ISBN lookups queued while offline.");
+                out << "booktracer_lookup_queue_pending " << queued << '\n';
+            }
+            sqlite3_finalize(st);
+        }
+
+        header(out, "booktracer_operation_seconds", "histogram", "Library operation latency.");
+        for (size_t o = 0; o < idx(Op::Count); ++o) {
+            const OpCounters& c = r.ops[o];
+            uint64_t cum = 0;
+            for (size_t b = 0; b <= kBuckets; ++b) {
+                cum += load(c.buckets[b]);
+                out << "booktracer_operation_seconds_bucket{op=\"" << kOpNames[o] << "\",le=\"";
+                if (b < kBuckets) out << kBucketNs[b] / 1e9; else out << "+Inf";
+                out << "\"} " << cum << '\n';
+            }
+            out << "booktracer_operation_seconds_sum{op=\"" << kOpNames[o] << "\"} " << load(c.nanos) / 1e9 << '\n'
+                << "booktracer_operation_seconds_count{op=\"" << kOpNames[o] << "\"} " << cum << '\n';
+        }
+        header(out, "booktracer_operation_errors_total", "counter", "Library operations that failed.");
+        for (size_t o = 0; o < idx(Op::Count); ++o)
+            out << "booktracer_operation_errors_total{op=\"" << kOpNames[o] << "\"} " << load(r.ops[o].errors) << '\n';
+
+        header(out, "booktracer_provider_lookups_total", "counter",
+               "Provider round trips by result (hit, miss: no such book, error: no usable answer).");
+        for (size_t p = 0; p < idx(Provider::Count); ++p)
+            for (size_t k = 0; k < idx(Outcome::Count); ++k)
+                out << "booktracer_provider_lookups_total{provider=\"" << kProviderNames[p] << "\",result=\""
+                    << kOutcomeNames[k] << "\"} " << load(r.lookups[p][k]) << '\n';
+
+        LookupStats ls = LookupFlights::instance().stats();
+        header(out, "booktracer_isbn_lookups_total", "counter", "ISBN lookups requested.");
+        out << "booktracer_isbn_lookups_total " << ls.lookups << '\n';
+        header(out, "booktracer_isbn_lookups_coalesced_total", "counter",
+               "ISBN lookups that shared another caller's in-flight fetch.");
+        out << "booktracer_isbn_lookups_coalesced_total " << ls.coalesced << '\n';
+
+        header(out, "booktracer_cache_requests_total", "counter",
+               "Cache lookups by result (mirror: incremental sync vs. full reload; "
+               "http_connection: reused vs. new connection).");
+        for (size_t c = 0; c < idx(Cache::Count); ++c)
+            for (int hit = 1; hit >= 0; --hit)
+                out << "booktracer_cache_requests_total{cache=\"" << kCacheNames[c] << "\",result=\""
+                    << (hit ? "hit" : "miss") << "\"} " << load(r.cache[c][hit]) << '\n';
+
+        header(out, "booktracer_import_rows_total", "counter", "Books added by imports.");
+        for (size_t f = 0; f < idx(Format::Count); ++f)
+            out << "booktracer_import_rows_total{format=\"" << kFormatNames[f] << "\"} " << load(r.importRows[f]) << '\n';
+        header(out, "booktracer_import_bytes_total", "counter", "Source bytes read by imports (CSV and ONIX).");
+        for (size_t f = 0; f < idx(Format::Count); ++f)
+            out << "booktracer_import_bytes_total{format=\"" << kFormatNames[f] << "\"} " << load(r.importBytes[f]) << '\n';
+    }
+};
+
+// ----------------------------- Reverse ISBN fill ---------------------------
+// Reverse lookup through the cache: fills `out` when a match is known.
+static Task<void> reverseLookupCached(SqliteStorage& db, HttpLoop& http, std::string title, std::string author,
+                                      std::optional<ReverseHit>& out, ReverseFillStats& st) {
+    std::string key = reverseQueryKey(title, author);
+    auto cached = db.reverseCacheGet(key);
+    metrics::countCache(metrics::Cache::ReverseLookup, cached.has_value());
+    if (cached) { ++st.cacheHits; out = cached->hit; co_return; }
+    ReverseResult r = co_await reverseLookupAsync(http, std::move(title), std::move(author));
+    if (!r.ok) { ++st.failed; co_return; }
+    ++st.fetched;
+    db.reverseCachePut(key, r.hit);
+    out = r.hit;
+}
+
+// Finds ISBNs for every ISBN-less book with at most `concurrency` searches in
+// flight (that many workers share one cursor over the list). A match that
+// another book already owns is reported, not applied, so no duplicates appear.
+static ReverseFillStats fillMissingIsbns(SqliteStorage& db, int concurrency) {
+    ReverseFillStats st;
+    std::vector<Book> books = db.booksWithoutIsbn();
+    st.books = books.size();
+    HttpLoop http;
+    size_t next = 0;
+    for (int w = 0; w < std::max(1, concurrency); ++w) {
+        http.spawn([](SqliteStorage& d, HttpLoop& h, std::vector<Book>& todo, size_t& cursor,
+                      ReverseFillStats& s) -> Task<void> {
+            while (cursor < todo.size()) {
+                const Book& b = todo[cursor++];
+                std::optional<ReverseHit> hit;
+                size_t failedBefore = s.failed;
+                co_await reverseLookupCached(d, h, b.title, b.author, hit, s);
+                if (s.failed != failedBefore) continue;
+                if (!hit) ++s.noMatch;
+                else if (d.bookWithIsbn(hit->isbn13)) ++s.duplicates;
+                else if (d.setIsbn(b.id, hit->isbn13)) ++s.matched;
+            }
+        }(db, http, books, next, st));
+    }
+    http.run();
+    return st;
+}
+
+// ----------------------------- Public network API --------------------------
+static std::mutex g_warmerMu;
+static std::unique_ptr<ConnectionWarmer> g_warmer;
+
+void globalInit() { curl_global_init(CURL_GLOBAL_DEFAULT); }
+
+// Pooled handles and the share object must go before curl's global state.
+void globalCleanup() {
+    stopKeepWarm();
+    HttpPool::instance().shutdown();
+    curl_global_cleanup();
+}
+
+// The probes are independent network round trips; run them side by side on
+// the executor.
+ProbeResult probeProviders() {
+    Executor& ex = Executor::instance();
+    ProbeResult r;
+    r.googleKey = googleKeyPresent();
+    auto netF = ex.submit(internetOk, Executor::Priority::High);
+    auto olF  = ex.submit(openLibraryOk, Executor::Priority::High);
+    std::future<bool> gapiF;
+    if (r.googleKey) gapiF = ex.submit(googleBooksReady, Executor::Priority::High);
+    r.internet    = netF.get();
+    r.googleBooks = r.internet && gapiF.valid() && gapiF.get();
+    r.openLibrary = olF.get() && r.internet;
+    return r;
+}
+
+void setUseGoogleBooks(bool on) { g_useGoogleBooks = on; }
+bool useGoogleBooks() { return g_useGoogleBooks; }
+void setOnline(bool on) { g_online = on; }
+bool online() { return g_online; }
+
+std::vector<std::optional<LookupResult>> lookupIsbns(const std::vector<std::string>& isbns) {
+    std::vector<std::optional<LookupResult>> results(isbns.size());
+    HttpLoop http;
+    for (size_t i = 0; i < isbns.size(); ++i) {
+        http.spawn([](HttpLoop& h, std::string isbn, std::optional<LookupResult>& out) -> Task<void> {
+            out = co_await lookupIsbnAsync(h, std::move(isbn));
+        }(http, isbns[i], results[i]));
+    }
+    http.run();
+    return results;
+}
+
+LookupStats lookupStats() { return LookupFlights::instance().stats(); }
+
+void startKeepWarm() {
+    std::lock_guard<std::mutex> lk(g_warmerMu);
+    if (g_warmer) return;
+    g_warmer = std::make_unique<ConnectionWarmer>(providerWarmUrls(), ConnectionWarmer::Options{});
+    g_warmer->start();
+}
+void stopKeepWarm() {
+    std::lock_guard<std::mutex> lk(g_warmerMu);
+    g_warmer.reset();
+}
+
+// ----------------------------- Library -------------------------------------
+// The public facade: one foreground connection plus the optional background
+// workers, which open their own connections to the same file.
+struct Library::Impl {
+    std::string path;
+    SqliteStorage db;
+    std::unique_ptr<MaintenanceScheduler> maint;
+    std::unique_ptr<LookupReplayer> replay;
+    bool replayWanted = false;
+    std::unique_ptr<MetricsExporter> metrics;
+
+    Impl(const std::string& p, int busyTimeoutMs) : path(p), db(p, busyTimeoutMs) {}
+
+    void startReplay() {
+        if (replay) return;
+        replay = std::make_unique<LookupReplayer>(path, LookupReplayer::Options{});
+        replay->start();
+    }
+};
+
+Library::Library(const std::string& dbPath, int busyTimeoutMs)
+    : impl_(std::make_unique<Impl>(dbPath, busyTimeoutMs)) {}
+Library::~Library() = default;
+
+bool Library::ok() const { return impl_->db.ok(); }
+std::string Library::lastError() const { return impl_->db.lastError(); }
+void Library::warmUp() { impl_->db.warmUpAsync(); }
+
+// Operations are timed for the metrics export (see OpTimer).
+using metrics::Op;
+using metrics::OpTimer;
+
+int  Library::add(const Book& b) { OpTimer t(Op::Add); return t.check(impl_->db.add(b)); }
+int  Library::addMany(const std::vector<Book>& rows) { OpTimer t(Op::AddMany); return t.check(impl_->db.addMany(rows)); }
+bool Library::updateProgress(int id, int currentPage, int status) {
+    OpTimer t(Op::UpdateProgress);
+    return t.check(impl_->db.updateProgress(id, currentPage, status));
+}
+bool Library::updateStatus(int id, int status) { OpTimer t(Op::UpdateStatus); return t.check(impl_->db.updateStatus(id, status)); }
+bool Library::remove(int id) { OpTimer t(Op::Remove); return t.check(impl_->db.remove(id)); }
+std::optional<Book> Library::get(int id) { OpTimer t(Op::Get); return impl_->db.get(id); }
+std::vector<Book> Library::list(std::optional<int> statusFilter, SortBy sort, int dailyRate) {
+    OpTimer t(Op::List);
+    return impl_->db.list(statusFilter, sort, dailyRate);
+}
+std::vector<Book> Library::search(const std::string& q) { OpTimer t(Op::Search); return impl_->db.search(q); }
+void Library::enableSearchHeap() { impl_->db.enableSearchHeap(); }
+int  Library::bookWithIsbn(const std::string& isbn13) { return impl_->db.bookWithIsbn(isbn13); }
+int  Library::getDailyRate() { return impl_->db.getDailyRate(); }
+bool Library::setDailyRate(int rate) { return impl_->db.setDailyRate(rate); }
+
+void Library::enableColumnMirror() { impl_->db.enableColumnMirror(); }
+ReadingTotals Library::readingTotals(std::optional<int> statusFilter) { return impl_->db.readingTotals(statusFilter); }
+StatusCounts Library::statusCounts() { return impl_->db.statusCounts(); }
+ProgressHistogram Library::progressHistogram() { return impl_->db.progressHistogram(); }
+
+// Every distinct pages-left value is simulated once and shared by the books
+// that have it.
+std::optional<ReadingForecast> Library::forecast(int budgetMs, int historyDays, unsigned long long seed) {
+    OpTimer timer(Op::Forecast);
+    using clk = std::chrono::steady_clock;
+    auto t0 = clk::now();
+    std::vector<int> daily = impl_->db.readingDays(historyDays);
+    long long read = 0;
+    for (int d: daily) read += d;
+    if (read <= 0) return std::nullopt;
+
+    ReadingForecast fc;
+    fc.historyDays = static_cast<int>(daily.size());
+    fc.pagesPerDay = static_cast<double>(read) / daily.size();
+    auto left = impl_->db.readingLeft();
+    fc.books.reserve(left.size());
+    for (auto [id, pages]: left) {
+        FinishForecast f;
+        f.bookId = id;
+        f.pagesLeft = pages;
+        fc.books.push_back(std::move(f));
+    }
+    fc.backlog.pagesLeft = impl_->db.readingTotals(static_cast<int>(Status::ToRead)).pagesRemaining
+                         + impl_->db.readingTotals(static_cast<int>(Status::Reading)).pagesRemaining;
+
+    std::vector<long long> targets{fc.backlog.pagesLeft};
+    for (const auto& f: fc.books) targets.push_back(f.pagesLeft);
+    std::sort(targets.begin(), targets.end());
+    targets.erase(std::unique(targets.begin(), targets.end()), targets.end());
+
+    if (!seed) seed = std::random_device{}() | static_cast<unsigned long long>(std::random_device{}()) << 32;
+    FinishSimulator sim(daily, seed);
+    auto budget = std::chrono::milliseconds(std::max(1, budgetMs)) - (clk::now() - t0);
+    FinishSimulator::Result r = sim.run(targets, budget);
+    std::unordered_map<int, std::string> dates;   // few distinct days across many books
+    auto date = [&](int days){
+        auto it = dates.find(days);
+        if (it == dates.end()) it = dates.emplace(days, dateInDays(std::max(0, days - 1))).first;
+        return it->second;
+    };
+    auto fill = [&](FinishForecast& f){
+        const auto& d = r.days[static_cast<size_t>(std::lower_bound(targets.begin(), targets.end(), f.pagesLeft)
+                                                   - targets.begin())];
+        if (d[0] >= 0) { f.p50Days = d[0]; f.p50Date = date(d[0]); }
+        if (d[1] >= 0) { f.p90Days = d[1]; f.p90Date = date(d[1]); }
+    };
+    for (auto& f: fc.books) fill(f);
+    fill(fc.backlog);
+    fc.trials = r.trials;
+    fc.ms = std::chrono::duration<double, std::milli>(clk::now() - t0).count();
+    return fc;
+}
+
+std::optional<ExportStats> Library::exportCsv(const std::string& path, ExportKey key, size_t memBudgetBytes) {
+    OpTimer t(Op::ExportCsv);
+    auto st = t.check(impl_->db.exportCsv(path, key, memBudgetBytes));
+    if (st) logging::log(logging::Level::Info, "export", {{"format", "csv"}, {"path", path}, {"rows", st->rows},
+                                                         {"runs", st->runs}, {"passes", st->passes}});
+    else    logging::log(logging::Level::Error, "export_failed", {{"format", "csv"}, {"path", path}, {"msg", lastError()}});
+    return st;
+}
+std::optional<CsvCheckpoint> Library::csvCheckpoint(const std::string& path) { return impl_->db.csvCheckpoint(path); }
+std::optional<CsvImportStats> Library::importCsv(const std::string& path, bool resume) {
+    OpTimer t(Op::ImportCsv);
+    auto st = t.check(impl_->db.importCsv(path, resume));
+    if (st) {
+        std::error_code ec;
+        auto size = std::filesystem::file_size(path, ec);
+        metrics::countImport(metrics::Format::Csv, st->rows - st->resumedRows,
+                             ec || size < st->resumedOffset ? 0 : size - st->resumedOffset);
+        logging::log(logging::Level::Info, "import", {{"format", "csv"}, {"path", path}, {"rows", st->rows},
+                                                     {"resumed_rows", st->resumedRows}, {"rejected", st->rejected}});
+        for (const auto& [reason, n]: st->rejectsByReason)
+            logging::log(logging::Level::Info, "import_rejects", {{"format", "csv"}, {"reason", reason}, {"rows", n}});
+    } else {
+        logging::log(logging::Level::Error, "import_failed", {{"format", "csv"}, {"path", path}, {"msg", lastError()}});
+    }
+    return st;
+}
+int Library::importCalibre(const std::string& path) {
+    OpTimer t(Op::ImportCalibre);
+    int n = t.check(impl_->db.importCalibre(path));
+    if (n > 0) metrics::countImport(metrics::Format::Calibre, n, 0);
+    if (n >= 0) logging::log(logging::Level::Info, "import", {{"format", "calibre"}, {"path", path}, {"rows", n}});
+    else logging::log(logging::Level::Error, "import_failed", {{"format", "calibre"}, {"path", path}, {"msg", lastError()}});
+    return n;
+}
+std::optional<CsvOwnership> Library::checkCsvOwnership(const std::string& path, int sampleLimit) {
+    return impl_->db.checkCsvOwnership(path, sampleLimit);
+}
+
+// Streams an ONIX feed product by product into addMany() in fixed-size batches.
+std::optional<OnixImportStats> Library::importOnix(const std::string& path) {
+    constexpr size_t kBatch = 1000;
+    OpTimer timer(Op::ImportOnix);
+    OnixReader onix(path);
+    if (!onix.ok()) {
+        logging::log(logging::Level::Error, "import_failed", {{"format", "onix"}, {"path", path}, {"msg", "cannot open"}});
+        return timer.check(std::optional<OnixImportStats>());
+    }
+
+    OnixImportStats st;
+    std::vector<Book> batch; batch.reserve(kBatch);
+    auto flush = [&]{
+        int n = impl_->db.addMany(batch);
+        if (n < 0) st.dbError = true; else st.inserted += n;
+        batch.clear();
+    };
+    OnixProduct p;
+    while (!st.dbError && onix.next(p)) {
+        ++st.products;
+        if (p.title.empty()) { ++st.skipped; continue; }
+        Book b;
+        b.title      = std::move(p.title);
+        for (auto& c: p.contributors) { if (!b.author.empty()) b.author += " & "; b.author += c; }
+        b.totalPages = p.pages;
+        b.status     = static_cast<int>(Status::ToRead);
+        b.isbn       = std::move(p.isbn13);
+        batch.push_back(std::move(b));
+        if (batch.size() == kBatch) flush();
+    }
+    if (!st.dbError && !batch.empty()) flush();
+    st.bytes = onix.bytesRead();
+    timer.check(!st.dbError);
+    metrics::countImport(metrics::Format::Onix, st.inserted, st.bytes);
+    logging::log(st.dbError ? logging::Level::Error : logging::Level::Info, st.dbError ? "import_failed" : "import",
+                 {{"format", "onix"}, {"path", path}, {"rows", st.inserted}, {"products", st.products},
+                  {"skipped", st.skipped}, {"bytes", st.bytes}});
+    return st;
+}
+
+std::optional<ReverseHit> Library::reverseLookup(const std::string& title, const std::string& author) {
+    OpTimer t(Op::ReverseLookup);
+    std::optional<ReverseHit> hit;
+    ReverseFillStats st;
+    HttpLoop http;
+    http.runSync(reverseLookupCached(impl_->db, http, title, author, hit, st));
+    return hit;
+}
+ReverseFillStats Library::fillMissingIsbns(int concurrency) {
+    ReverseFillStats st = booktracer::fillMissingIsbns(impl_->db, concurrency);
+    logging::log(logging::Level::Info, "isbn_fill", {{"books", st.books}, {"cache_hits", st.cacheHits},
+                 {"fetched", st.fetched}, {"matched", st.matched}, {"duplicates", st.duplicates},
+                 {"no_match", st.noMatch}, {"failed", st.failed}});
+    return st;
+}
+
+void Library::startMaintenance() {
+    if (impl_->maint) return;
+    impl_->maint = std::make_unique<MaintenanceScheduler>(impl_->path, MaintenanceScheduler::Options{});
+    impl_->maint->start();
+}
+bool Library::maintenanceRunning() const { return impl_->maint != nullptr; }
+std::vector<MaintenanceTaskStats> Library::maintenanceStats() const {
+    return impl_->maint ? impl_->maint->stats() : std::vector<MaintenanceTaskStats>{};
+}
+bool Library::vacuumEnabled() const { return impl_->maint && impl_->maint->vacuumEnabled(); }
+
+// The worker, and its connection, only start once there is something to replay.
+void Library::startLookupReplay() {
+    impl_->replayWanted = true;
+    if (impl_->db.lookupQueueSize() > 0) impl_->startReplay();
+}
+bool Library::lookupReplayRunning() const { return impl_->replayWanted; }
+// Queued rows are also picked up by a replayer in another process.
+bool Library::enqueueLookup(const std::string& isbn13) {
+    if (!impl_->db.enqueueLookup(isbn13)) return false;
+    if (impl_->replay) impl_->replay->kick();
+    else if (impl_->replayWanted) impl_->startReplay();
+    return true;
+}
+LookupQueueStats Library::lookupQueueStats() const {
+    if (impl_->replay) return impl_->replay->stats();
+    LookupQueueStats s;
+    s.pending = impl_->db.lookupQueueSize();
+    s.online  = g_online;
+    return s;
+}
+unsigned long long Library::takeCompletedLookups() {
+    return impl_->replay ? impl_->replay->takeCompleted() : 0;
+}
+
+void Library::startMetricsExport(const std::string& promPath, int intervalMs) {
+    if (impl_->metrics) return;
+    MetricsExporter::Options opt;
+    opt.promPath = promPath;
+    opt.every = std::chrono::milliseconds(std::max(100, intervalMs));
+    impl_->metrics = std::make_unique<MetricsExporter>(impl_->path, std::move(opt));
+    impl_->metrics->start();
+}
+bool Library::metricsExportRunning() const { return impl_->metrics != nullptr; }
+unsigned long long Library::metricsWriteFailures() const { return impl_->metrics ? impl_->metrics->failures() : 0; }
+
+Library::ForegroundScope::ForegroundScope(Library& lib) : lib_(lib) {
+    if (lib_.impl_->maint) lib_.impl_->maint->foregroundBegin();
+}
+Library::ForegroundScope::~ForegroundScope() {
+    if (lib_.impl_->maint) lib_.impl_->maint->foregroundEnd();
+}
+
+// ----------------------------- Benchmarks ----------------------------------
+namespace bench {
+
+double percentile(std::vector<double>& sorted, double p) {
+    if (sorted.empty()) return 0.0;
+    size_t i = static_cast<size_t>(p * (sorted.size() - 1) + 0.5);
+    return sorted[std::min(i, sorted.size() - 1)];
+}
+
+// N concurrent GETs on one thread.
+int http(const std::string& url, int requests, std::ostream& out) {
+    HttpLoop http;
+    int ok = 0, failed = 0;
+    size_t peak = 0;
+    auto t0 = std::chrono::steady_clock::now();
+    for (int i = 0; i < requests; ++i) {
+        http.spawn([](HttpLoop& h, std::string u, int& okN, int& failN, size_t& pk) -> Task<void> {
+            auto get = h.get(std::move(u));
+            pk = std::max(pk, h.inFlight() + 1);
+            HttpResponse r = co_await get;
+            ++(r.ok() ? okN : failN);
+        }(http, url, ok, failed, peak));
+    }
+    http.run();
+    double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+    out << "HTTP benchmark: " << requests << " GET(s) of " << url << " on one thread\n"
+              << std::fixed << std::setprecision(1)
+              << "  ok: " << ok << "  failed: " << failed << "  peak in flight: " << peak << "\n"
+              << "  wall: " << secs * 1000 << " ms  (" << (secs > 0 ? requests / secs : 0.0) << " req/s)\n";
+    return failed ? 1 : 0;
+}
+
+// Latency of the first lookup of a session from a cold start (no
+// connections, empty DNS and TLS caches) vs. after the providers were
+// pre-warmed.
+int firstLookup(const std::string& isbn, const std::optional<std::string>& url, int rounds, std::ostream& out) {
+    rounds = std::max(1, rounds);
+    g_useGoogleBooks = googleKeyPresent();
+    std::vector<std::string> warmUrls = url ? std::vector<std::string>{*url} : providerWarmUrls();
+    auto lookup = [&]{ return url ? httpGet(*url).has_value() : fetchIsbn(isbn).has_value(); };
+    auto timeOne = [&](bool& ok){
+        auto t0 = std::chrono::steady_clock::now();
+        ok = lookup();
+        return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0).count();
+    };
+
+    HttpPool& pool = HttpPool::instance();
+    std::vector<double> cold, warm;
+    int failures = 0;
+    for (int r = 0; r < rounds; ++r) {
+        bool ok = false;
+        pool.reset();
+        cold.push_back(timeOne(ok)); failures += !ok;
+        pool.reset();
+        for (const auto& u: warmUrls) httpTouch(u);   // what startup + the warmer leave behind
+        warm.push_back(timeOne(ok)); failures += !ok;
+    }
+    std::sort(cold.begin(), cold.end());
+    std::sort(warm.begin(), warm.end());
+    out << "First-lookup benchmark: " << (url ? *url : "ISBN " + isbn) << ", " << rounds << " round(s)\n"
+              << std::fixed << std::setprecision(1)
+              << "  cold   p50 " << percentile(cold, 0.5) << " ms  max " << cold.back() << " ms\n"
+              << "  warmed p50 " << percentile(warm, 0.5) << " ms  max " << warm.back() << " ms\n";
+    if (failures) out << "  (" << failures << " lookup(s) failed; timings include the failure path)\n";
+    return 0;
+}
+
+// Lookups under injected faults: a fixed number of workers on one loop,
+// each taking the next lookup as soon as its last one returns.
+int faults(const std::string& isbn, const std::optional<std::string>& url, int lookups,
+           int concurrency, const std::vector<FaultProfile>& profiles, std::ostream& out) {
+    lookups = std::max(1, lookups);
+    concurrency = std::clamp(concurrency, 1, lookups);
+    std::vector<FaultProfile> runs = profiles;
+    if (runs.empty())
+        for (const auto& name: faultPresetNames()) runs.push_back(*faultProfileFromStr(name));
+    bool google = g_useGoogleBooks.exchange(false);   // Open Library only
+    std::optional<FaultProfile> before = faultProfile();
+
+    out << "Fault benchmark: " << lookups << " " << (url ? "GET(s) of " + *url : "lookup(s) of ISBN " + isbn)
+        << ", " << concurrency << " in flight\n"
+        << "  profile              ok  failed     req/s     p50     p90     p99     max (ms)\n"
+        << std::fixed;
+    int rc = 0;
+    for (const auto& p: runs) {
+        setFaultProfile(p);
+        HttpLoop http;
+        std::vector<double> lat;
+        lat.reserve(static_cast<size_t>(lookups));
+        int next = 0, ok = 0;
+        auto t0 = std::chrono::steady_clock::now();
+        for (int w = 0; w < concurrency; ++w) {
+            http.spawn([](HttpLoop& h, const std::string& isbn13, const std::optional<std::string>& u, int total,
+                          int& nextN, int& okN, std::vector<double>& ms) -> Task<void> {
+                while (nextN < total) {
+                    ++nextN;
+                    auto s = std::chrono::steady_clock::now();
+                    bool good = false;
+                    if (u) good = (co_await h.get(*u)).ok();
+                    else good = (co_await fetchIsbnAsync(h, isbn13)).has_value();
+                    ms.push_back(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - s).count());
+                    okN += good;
+                }
+            }(http, isbn, url, lookups, next, ok, lat));
+        }
+        http.run();
+        double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+        std::sort(lat.begin(), lat.end());
+        FaultStats fs = faultStats();
+        out << "  " << std::left << std::setw(16) << p.name.substr(0, 16) << std::right
+            << std::setw(7) << ok << std::setw(8) << lookups - ok
+            << std::setprecision(1) << std::setw(10) << (secs > 0 ? lookups / secs : 0.0)
+            << std::setw(8) << percentile(lat, 0.50) << std::setw(8) << percentile(lat, 0.90)
+            << std::setw(8) << percentile(lat, 0.99) << std::setw(8) << (lat.empty() ? 0.0 : lat.back()) << "\n"
+            << "      injected: " << fs.timeouts << " timeout(s), " << fs.serverErrors << " 503, "
+            << fs.rateLimited << " 429, " << fs.truncated << " truncated, "
+            << std::setprecision(0) << fs.delayMs << " ms delay over " << fs.requests << " request(s)\n";
+        if (p.name == "none" && ok < lookups) rc = 1;   // the baseline itself is failing
+    }
+    setFaultProfile(before);
+    g_useGoogleBooks = google;
+    if (rc) out << "  (lookups fail without injected faults; check the network or --url)\n";
+    return rc;
+}
+
+// Scheduling overhead of the shared executor.
+int executor(int tasks, std::ostream& out) {
+    using clk = std::chrono::steady_clock;
+    auto nsPer = [](clk::time_point t0, long long n){
+        return std::chrono::duration<double, std::nano>(clk::now() - t0).count() / std::max(1LL, n);
+    };
+    Executor& ex = Executor::instance();
+    out << "Executor benchmark: " << ex.size() << " worker(s), " << tasks << " task(s)\n"
+              << std::fixed << std::setprecision(0);
+
+    // empty tasks submitted from outside the pool, one future each
+    {
+        std::vector<std::future<void>> futs; futs.reserve(tasks);
+        auto t0 = clk::now();
+        for (int i = 0; i < tasks; ++i) futs.push_back(ex.submit([]{}));
+        for (auto& f: futs) f.get();
+        out << "  submit+wait (external):   " << nsPer(t0, tasks) << " ns/task\n";
+    }
+    // fan-out from inside a task: children land on the worker's own deque and get stolen
+    {
+        auto t0 = clk::now();
+        ex.submit([&]{
+            std::vector<std::future<void>> futs; futs.reserve(tasks);
+            for (int i = 0; i < tasks; ++i) futs.push_back(ex.submit([]{}));
+            for (auto& f: futs) f.get();
+        }).get();
+        out << "  submit+wait (from worker): " << nsPer(t0, tasks) << " ns/task\n";
+    }
+    // baseline: a fresh thread per task
+    {
+        int n = std::min(tasks, 2000);
+        std::vector<std::future<void>> futs; futs.reserve(n);
+        auto t0 = clk::now();
+        for (int i = 0; i < n; ++i) futs.push_back(std::async(std::launch::async, []{}));
+        for (auto& f: futs) f.get();
+        out << "  std::async baseline:       " << nsPer(t0, n) << " ns/task\n";
+    }
+    // parallelFor over a cheap body vs. a plain loop
+    {
+        std::vector<double> v(static_cast<size_t>(tasks) * 64);
+        auto body = [&](size_t b, size_t e){ for (size_t i = b; i < e; ++i) v[i] = std::sqrt(double(i)); };
+        body(0, v.size());   // fault the pages in first
+        auto t0 = clk::now();
+        body(0, v.size());
+        double serial = nsPer(t0, 1);
+        for (size_t grain: {size_t(256), size_t(4096), size_t(65536)}) {
+            t0 = clk::now();
+            ex.parallelFor(0, v.size(), grain, body);
+            double par = nsPer(t0, 1);
+            out << "  parallelFor grain " << std::setw(6) << grain << ": "
+                      << std::setprecision(2) << par / 1e6 << " ms (serial " << serial / 1e6 << " ms, "
+                      << serial / std::max(par, 1.0) << "x)" << std::setprecision(0) << "\n";
+        }
+    }
+    // cancellation: tasks whose token is cancelled before they start are dropped
+    {
+        CancelToken tok;
+        std::atomic<int> ran{0};
+        std::vector<std::future<void>> futs; futs.reserve(tasks);
+        auto gate = std::make_shared<std::promise<void>>();
+        std::shared_future<void> open = gate->get_future().share();
+        std::vector<std::future<void>> blockers;
+        for (size_t i = 0; i < ex.size(); ++i) blockers.push_back(ex.submit([open]{ open.wait(); }, Executor::Priority::High));
+        for (int i = 0; i < tasks; ++i) futs.push_back(ex.submit([&]{ ++ran; }, Executor::Priority::Low, tok));
+        tok.cancel();
+        gate->set_value();
+        for (auto& f: blockers) f.get();
+        int dropped = 0;
+        for (auto& f: futs) { try { f.get(); } catch (const std::future_error&) { ++dropped; } }
+        out << "  cancelled before start:    " << dropped << " dropped, " << ran.load() << " ran\n";
+    }
+    Executor::Stats st = ex.stats();
+    out << "  totals: submitted " << st.submitted << ", executed " << st.executed
+              << ", stolen " << st.stolen << ", cancelled " << st.cancelled << "\n";
+    return 0;
+}
+
+// Aggregate kernels over synthetic columns, scalar vs. the runtime pick.
+int columns(size_t rows, std::ostream& out) {
+    using clk = std::chrono::steady_clock;
+    ColumnMirror m;
+    m.reserve(rows);
+    std::mt19937 rng(42);
+    std::uniform_int_distribution<int32_t> pages(0, 1200), status(0, 2);
+    for (size_t i = 0; i < rows; ++i) {
+        int32_t total = pages(rng);
+        m.upsert(static_cast<long long>(i) + 1, total, std::uniform_int_distribution<int32_t>(0, total)(rng), status(rng));
+    }
+    const colkern::Columns c = m.columns();
+    const colkern::Kernels& best = colkern::kernels();
+    out << "Column kernels: " << rows << " row(s), dispatch picks " << best.name << "\n"
+        << std::fixed << std::setprecision(3);
+
+    auto timeMs = [&](auto&& f) {
+        std::vector<double> ms;
+        for (int r = 0; r < 7; ++r) {
+            auto t0 = clk::now();
+            f();
+            ms.push_back(std::chrono::duration<double, std::milli>(clk::now() - t0).count());
+        }
+        std::sort(ms.begin(), ms.end());
+        return percentile(ms, 0.5);
+    };
+    bool same = true;
+    for (const colkern::Kernels* k: {&colkern::kScalar, &best}) {
+        ReadingTotals all, reading;
+        StatusCounts sc{};
+        ProgressHistogram ph{};
+        double tAll  = timeMs([&]{ all = k->totals(c, -1); });
+        double tFilt = timeMs([&]{ reading = k->totals(c, static_cast<int>(Status::Reading)); });
+        double tStat = timeMs([&]{ sc = k->statusCounts(c); });
+        double tProg = timeMs([&]{ ph = k->progress(c); });
+        out << "  " << std::left << std::setw(7) << k->name << std::right
+            << " totals " << tAll << " ms  filtered " << tFilt << " ms  by status " << tStat
+            << " ms  progress bins " << tProg << " ms\n";
+        ReadingTotals ref = colkern::kScalar.totals(c, -1);
+        same = same && all.pagesRead == ref.pagesRead && all.pagesRemaining == ref.pagesRemaining
+                    && sc == colkern::kScalar.statusCounts(c) && ph == colkern::kScalar.progress(c)
+                    && reading.books == sc[static_cast<int>(Status::Reading)];
+        if (k == &best) break;
+    }
+    {
+        ReadingTotals all;
+        ProgressHistogram ph{};
+        double tAll  = timeMs([&]{ all = m.totals(-1); });
+        double tProg = timeMs([&]{ ph = m.progress(); });
+        out << "  sliced over " << Executor::instance().size() << " worker(s): totals " << tAll
+            << " ms  progress bins " << tProg << " ms\n";
+        same = same && all.pagesRemaining == colkern::kScalar.totals(c, -1).pagesRemaining
+                    && ph == colkern::kScalar.progress(c);
+    }
+    out << "  results " << (same ? "match" : "DIFFER") << "\n";
+    return same ? 0 : 1;
+}
+
+// Substring scans of the search heap: the scalar kernel on one thread, the
+// dispatched kernel on one thread, then sliced across the executor.
+int substring(size_t rows, std::ostream& out) {
+    using clk = std::chrono::steady_clock;
+    static const char* const kWords[] = {
+        "the", "night", "circus", "shadow", "wind", "kingdom", "river", "glass", "memory", "winter",
+        "garden", "silent", "empire", "stars", "ocean", "fire", "house", "secret", "iron", "dream"};
+    static const char* const kNames[] = {"Ada", "Lin", "Maria", "Omar", "Yuki", "Jonas", "Priya", "Theo"};
+    static const char* const kFamilies[] = {"Okafor", "Lindqvist", "Moreau", "Tanaka", "Castillo", "Novak"};
+    std::mt19937 rng(7);
+    auto pick = [&](const auto& arr){ return arr[std::uniform_int_distribution<size_t>(0, std::size(arr) - 1)(rng)]; };
+
+    SearchHeap heap;
+    for (size_t i = 0; i < rows; ++i) {
+        std::string title;
+        for (int w = std::uniform_int_distribution<int>(2, 5)(rng); w > 0; --w) {
+            if (!title.empty()) title += ' ';
+            title += pick(kWords);
+        }
+        title[0] = static_cast<char>(std::toupper(static_cast<unsigned char>(title[0])));
+        std::string author = std::string(pick(kNames)) + " " + pick(kFamilies);
+        if (i % 1000 == 0) title += " Quixotic";   // a rare mid-word target
+        heap.upsert(static_cast<long long>(i) + 1, title, author);
+    }
+    out << std::fixed << std::setprecision(1) << "Substring scan: " << rows << " book(s), " << heap.bytes() / 1e6
+        << " MB heap, dispatch picks " << strkern::kernel().name << "\n" << std::setprecision(2);
+
+    auto oneThread = [&](std::string_view q, const strkern::Kernel& k){ return heap.find(q, k, 1); };
+    bool same = true;
+    for (const char* q: {"xoti", "ndqv", "ircu", "zzzz"}) {
+        auto timeMs = [&](auto&& f) {
+            std::vector<double> ms;
+            size_t n = 0;
+            for (int r = 0; r < 5; ++r) {
+                auto t0 = clk::now();
+                n = f().size();
+                ms.push_back(std::chrono::duration<double, std::milli>(clk::now() - t0).count());
+            }
+            std::sort(ms.begin(), ms.end());
+            return std::make_pair(percentile(ms, 0.5), n);
+        };
+        auto scalar = timeMs([&]{ return oneThread(q, strkern::kScalar); });
+        auto simd   = timeMs([&]{ return oneThread(q, strkern::kernel()); });
+        auto sliced = timeMs([&]{ return heap.find(q); });
+        same = same && scalar.second == simd.second && simd.second == sliced.second;
+        out << "  \"" << q << "\": " << std::setw(7) << sliced.second << " hit(s)   scalar " << scalar.first
+            << " ms   " << strkern::kernel().name << " " << simd.first << " ms   sliced over "
+            << Executor::instance().size() << " worker(s) " << sliced.first << " ms\n";
+    }
+    out << "  results " << (same ? "match" : "DIFFER") << "\n";
+    return same ? 0 : 1;
+}
+
+// Finish-date simulation over a synthetic 90-day history (about a third of the
+// days without reading). The block walk is checked against a plain day-by-day
+// walk on one book first.
+int forecast(size_t books, int budgetMs, std::ostream& out) {
+    using clk = std::chrono::steady_clock;
+    std::mt19937 rng(11);
+    std::vector<int> daily(90);
+    std::gamma_distribution<double> pagesOnDay(2.0, 20.0);
+    for (int& d: daily) d = std::bernoulli_distribution(0.35)(rng) ? 0 : static_cast<int>(pagesOnDay(rng));
+    daily.back() = std::max(daily.back(), 1);
+    double mean = 0;
+    for (int d: daily) mean += d;
+    mean /= daily.size();
+
+    FinishSimulator sim(daily, 42);
+    const long long oneBook = 2000;
+    std::vector<double> walk, block;
+    FinishSimulator::Rng r1(1), r2(2);
+    for (int t = 0; t < 20000; ++t) {
+        long long read = 0;
+        int days = 0;
+        while (read < oneBook) { read += daily[r1() % daily.size()]; ++days; }
+        walk.push_back(days);
+        block.push_back(sim.trial(oneBook, r2));
+    }
+    std::sort(walk.begin(), walk.end());
+    std::sort(block.begin(), block.end());
+    out << std::fixed << std::setprecision(1) << "Forecast: " << daily.size() << " day(s) of history, "
+        << mean << " pages/day\n"
+        << "  " << oneBook << " pages, day-by-day walk P50/P90 " << percentile(walk, 0.5) << "/" << percentile(walk, 0.9)
+        << " days, block walk " << percentile(block, 0.5) << "/" << percentile(block, 0.9) << "\n";
+
+    std::vector<long long> targets;
+    long long backlog = 0;
+    std::uniform_int_distribution<int> left(1, 800);
+    for (size_t i = 0; i < books; ++i) { targets.push_back(left(rng)); backlog += targets.back(); }
+    targets.push_back(backlog);
+    std::sort(targets.begin(), targets.end());
+    targets.erase(std::unique(targets.begin(), targets.end()), targets.end());
+
+    auto t0 = clk::now();
+    FinishSimulator::Result res = sim.run(targets, std::chrono::milliseconds(budgetMs));
+    double ms = std::chrono::duration<double, std::milli>(clk::now() - t0).count();
+    const auto& b = res.days.back();
+    auto days = [](int d){ return d < 0 ? "> " + std::to_string(kForecastHorizonDays) : std::to_string(d); };
+    out << "  " << books << " book(s), " << targets.size() << " distinct target(s), backlog " << backlog
+        << " pages: " << res.trials << " trial(s) each in " << ms << " ms (budget " << budgetMs << " ms, "
+        << Executor::instance().size() << " worker(s))\n"
+        << "  backlog P50 " << days(b[0]) << " days, P90 " << days(b[1]) << " days (mean rate alone: "
+        << backlog / mean << ")\n";
+    return 0;
+}
+
+// Producer-side cost of one event: logging off, queued to the async logger,
+// and a synchronous fprintf + fflush of the same line. A tight loop outruns
+// the drain thread, so most queued events are dropped and counted.
+int logging(size_t events, const std::string& path, std::ostream& out) {
+    using clk = std::chrono::steady_clock;
+    namespace lg = booktracer::logging;
+    auto perEventNs = [&](auto&& f) {
+        auto t0 = clk::now();
+        for (size_t i = 0; i < events; ++i) f(i);
+        return std::chrono::duration<double, std::nano>(clk::now() - t0).count() / events;
+    };
+    auto event = [](size_t i){
+        lg::log(lg::Level::Info, "bench", {{"isbn", "9780141036144"}, {"i", i}, {"ms", 1.5}, {"ok", true}});
+    };
+
+    stopLogging();
+    double off = perEventNs(event);
+    if (!startLogging(path, LogLevel::Info)) { out << "Cannot open " << path << "\n"; return 1; }
+    double async = perEventNs(event);
+    stopLogging();
+    LogStats ls = logStats();
+
+    std::FILE* f = std::fopen(path.c_str(), "a");
+    if (!f) { out << "Cannot open " << path << "\n"; return 1; }
+    double sync = perEventNs([&](size_t i){
+        std::fprintf(f, "{\"level\":\"info\",\"event\":\"bench\",\"isbn\":\"%s\",\"i\":%zu,\"ms\":%g,\"ok\":true}\n",
+                     "9780141036144", i, 1.5);
+        std::fflush(f);
+    });
+    std::fclose(f);
+
+    out << std::fixed << std::setprecision(1) << "Logging " << events << " event(s) to " << path << "\n"
+        << "  off:                " << std::setw(8) << off << " ns/event\n"
+        << "  async ring:         " << std::setw(8) << async << " ns/event (" << ls.written << " written, "
+        << ls.dropped << " dropped)\n"
+        << "  sync fprintf+fflush:" << std::setw(8) << sync << " ns/event\n";
+    return 0;
+}
+
+} // namespace bench
+
+} // namespace booktracer
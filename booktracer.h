@@ -0,0 +1,348 @@
+// booktracer.h — libbooktracer: book storage (SQLite), ISBN lookup, CSV/ONIX/
+// Calibre import, CSV export and reading ETAs, without any console I/O.
+// Failures are reported through return values (false / -1 / nullopt) and
+// Library::lastError(). Link with sqlite3 and libcurl.
+//
+// Stability: everything in this header except namespace bench is the public
+// API. Additions keep kApiVersion; a change that breaks existing callers
+// bumps it.
+
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <memory>
+#include <optional>
+#include <ostream>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace booktracer {
+
+constexpr int kApiVersion = 1;
+
+// ----------------------------- Books ---------------------------------------
+struct Book {
+    int         id = 0;
+    std::string title;
+    std::string author;
+    int         totalPages = 0;
+    int         currentPage = 0;
+    int         status = 0;      // 0 To-Read, 1 Reading, 2 Finished
+    std::string isbn;            // optional
+};
+
+enum class Status { ToRead=0, Reading=1, Finished=2 };
+
+std::string statusToStr(Status s);
+// Accepts to-read/reading/finished (and a few aliases or 0/1/2).
+std::optional<Status> strToStatus(const std::string& s);
+
+double percentComplete(const Book& b);
+// Days left at dailyRate pages/day; nullopt when finished or the rate is 0.
+std::optional<int> daysToFinish(const Book& b, int dailyRate);
+
+// ISBN-10 or ISBN-13 (any punctuation) to ISBN-13; "" when invalid.
+std::string normalizeIsbn(const std::string& in);
+
+enum class SortBy { Id, Progress, Eta, Title, Author };
+
+struct ReadingTotals { long long books = 0, pagesTotal = 0, pagesRead = 0, pagesRemaining = 0; };
+using StatusCounts = std::array<long long, 3>;   // indexed by Status
+// Bins [0,10%) ... [90,100%), then finished (current >= total > 0). Books
+// without a page count land in the first bin.
+constexpr int kProgressBins = 11;
+using ProgressHistogram = std::array<long long, kProgressBins>;
+
+// ----------------------------- Forecasts -----------------------------------
+constexpr int kForecastHorizonDays = 36500;
+struct FinishForecast {
+    int bookId = 0;                     // 0 for the whole backlog
+    long long pagesLeft = 0;
+    // Reading days counting today, like daysToFinish(); nullopt past the horizon.
+    std::optional<int> p50Days, p90Days;
+    std::string p50Date, p90Date;       // local YYYY-MM-DD, "" past the horizon
+};
+struct ReadingForecast {
+    std::vector<FinishForecast> books;  // each book being read, by id
+    FinishForecast backlog;             // every unfinished book, read one after another
+    int historyDays = 0;                // days sampled, including days without reading
+    double pagesPerDay = 0;             // mean over those days
+    long long trials = 0;               // per forecast
+    double ms = 0;
+};
+
+// ----------------------------- Import / export -----------------------------
+enum class ExportKey { Id, Title, Author, Isbn, Pages, Progress, Status };
+constexpr size_t kDefaultExportBudget = 64u << 20;
+// id/title/author/isbn/pages/progress/status ("" = id), case-insensitive.
+std::optional<ExportKey> exportKeyFromStr(std::string s);
+
+struct ExportStats { long long rows = 0; size_t runs = 0; int passes = 0; };
+
+struct CsvCheckpoint { unsigned long long offset = 0; long long rows = 0; };
+struct CsvReject { long long record = 0; std::string title; std::string reason; };
+struct CsvImportStats {
+    long long rows = 0;                 // merged into books, including resumed rows
+    long long resumedRows = 0;
+    unsigned long long resumedOffset = 0;
+    long long rejected = 0;
+    std::vector<std::pair<std::string, long long>> rejectsByReason;
+    std::vector<CsvReject> sample;      // first few rejects
+};
+
+struct CsvOwnership {
+    long long rows = 0;               // data rows in the CSV
+    long long owned = 0;              // rows whose ISBN is already in the library
+    std::vector<Book> sample;         // first few owned books
+};
+
+struct OnixImportStats {
+    size_t products = 0, skipped = 0;   // skipped: no title
+    long long inserted = 0;             // duplicates by ISBN are not inserted
+    unsigned long long bytes = 0;
+    bool dbError = false;               // the import stopped early
+};
+
+// ----------------------------- Logging -------------------------------------
+enum class LogLevel { Debug, Info, Warn, Error, Off };
+struct LogStats { unsigned long long written = 0, dropped = 0; };
+// debug/info/warn/error/off, case-insensitive.
+std::optional<LogLevel> logLevelFromStr(std::string s);
+
+// JSON-lines log of library events (SQL errors, lookups, imports, background
+// work), one object per line with ts, level, event, thread and event fields.
+// Appends to path ("" = stderr) from a background thread; a caller never
+// waits on I/O, and events logged faster than they drain are dropped and
+// counted. stopLogging() (or process exit) flushes what is queued.
+bool startLogging(const std::string& path, LogLevel minLevel = LogLevel::Info);
+void stopLogging();
+LogStats logStats();
+
+// ----------------------------- Lookups -------------------------------------
+struct LookupResult { std::string title; std::string author; };
+struct ReverseHit { std::string isbn13, title, author; };
+
+struct LookupStats { unsigned long long lookups = 0, fetches = 0, coalesced = 0; };
+struct LookupQueueStats {
+    long long pending = 0;
+    unsigned long long resolved = 0, booksUpdated = 0, givenUp = 0, checks = 0;
+    bool online = true;
+};
+struct ReverseFillStats {
+    size_t books = 0, cacheHits = 0, fetched = 0, matched = 0, duplicates = 0, noMatch = 0, failed = 0;
+};
+
+struct MaintenanceTaskStats {
+    std::string name;
+    unsigned long long runs = 0;
+    double totalMs = 0, lastMs = 0, maxMs = 0;
+};
+
+// Process-wide network state. globalInit() before any lookup; globalCleanup()
+// once at exit, after every Library has been destroyed.
+void globalInit();
+void globalCleanup();
+
+struct ProbeResult { bool internet = false, googleKey = false, googleBooks = false, openLibrary = false; };
+// Runs the connectivity/provider checks concurrently.
+ProbeResult probeProviders();
+bool internetOk();
+bool googleKeyPresent();
+
+// Google Books is tried before Open Library while enabled.
+void setUseGoogleBooks(bool on);
+bool useGoogleBooks();
+// Last known connectivity; offline ISBN lookups get queued instead.
+void setOnline(bool on);
+bool online();
+
+// Any ISBN-10/13 form; identical concurrent lookups share one network fetch.
+std::optional<LookupResult> lookupIsbn(const std::string& rawIsbn);
+// All looked up concurrently on the calling thread; results in input order.
+std::vector<std::optional<LookupResult>> lookupIsbns(const std::vector<std::string>& isbns);
+LookupStats lookupStats();
+
+// Re-touches the providers in the background while lookups are recent, so
+// the next lookup skips DNS/TCP/TLS setup. Stopped by globalCleanup().
+void startKeepWarm();
+void stopKeepWarm();
+
+// ----------------------------- Fault injection -----------------------------
+// Test shim under the HTTP client (lookups, probes, keep-warm, benchmarks).
+// Each request draws from a generator seeded by the profile: an extra
+// delay, then at most one of no answer (fails after timeoutMs), a 503 or a
+// 429 that never reaches the network, or a body cut off at a random point.
+// The same seed replays the same faults for the same request order.
+struct FaultProfile {
+    std::string name;
+    double latencyMs = 0;          // median extra delay per request
+    double latencySigma = 0;       // log-normal spread of that delay; 0 = fixed
+    double timeoutRate = 0;
+    int    timeoutMs = 2000;
+    double serverErrorRate = 0;    // 503
+    double rateLimitRate = 0;      // 429
+    double truncateRate = 0;
+    unsigned long long seed = 1;
+};
+struct FaultStats {
+    unsigned long long requests = 0, timeouts = 0, serverErrors = 0, rateLimited = 0, truncated = 0;
+    double delayMs = 0;            // injected in total, timeouts included
+};
+// A preset (none, slow, flaky, ratelimited, truncated, timeouts), then
+// optional overrides: "flaky,5xx=0.2,seed=7". Keys: latency, sigma,
+// timeout, timeout-ms, 5xx, 429, truncate, seed; rates are 0..1 and may not
+// add up past 1. nullopt when the spec does not parse.
+std::optional<FaultProfile> faultProfileFromStr(const std::string& spec);
+std::vector<std::string> faultPresetNames();
+// nullopt switches injection off. Either way the generator is reseeded and
+// the stats are reset.
+void setFaultProfile(std::optional<FaultProfile> profile);
+std::optional<FaultProfile> faultProfile();
+FaultStats faultStats();
+
+// ----------------------------- Library -------------------------------------
+// Not thread-safe: use a Library from one thread at a time (the statement
+// cache and the in-memory mirrors are unsynchronized). Threads that need the
+// library concurrently open one Library each on the same file. The free
+// functions above and the background workers started below are safe to use
+// alongside.
+class Library {
+public:
+    static constexpr int kDefaultBusyTimeoutMs = 5000;
+
+    // busyTimeoutMs: how long a statement waits on another process's write
+    // lock before SQLITE_BUSY is surfaced.
+    explicit Library(const std::string& dbPath, int busyTimeoutMs = kDefaultBusyTimeoutMs);
+    ~Library();
+    Library(const Library&) = delete;
+    Library& operator=(const Library&) = delete;
+
+    bool ok() const;
+    std::string lastError() const;
+
+    // Prepares the frequent statements in the background; optional.
+    void warmUp();
+
+    int  add(const Book& b);                       // new id, or -1
+    int  addMany(const std::vector<Book>& rows);   // rows inserted, or -1
+    bool updateProgress(int id, int currentPage, int status);
+    bool updateStatus(int id, int status);
+    bool remove(int id);
+    std::optional<Book> get(int id);
+    // dailyRate is only used by SortBy::Eta.
+    std::vector<Book> list(std::optional<int> statusFilter = std::nullopt,
+                           SortBy sort = SortBy::Id, int dailyRate = 0);
+    // Case-insensitive (ASCII) substring of title or author. Without the
+    // search heap this is a LIKE, so q must be lower case and % and _ match
+    // any run of characters / any one character.
+    std::vector<Book> search(const std::string& q);
+    // Keeps a folded in-memory copy of every title and author for search(),
+    // scanned with SIMD across threads; mid-word fragments match too.
+    void enableSearchHeap();
+    int  bookWithIsbn(const std::string& isbn13);  // owning book id, or 0
+
+    int  getDailyRate();
+    bool setDailyRate(int rate);
+
+    // Aggregates over every book. After enableColumnMirror() they run over an
+    // in-memory columnar copy of the page/status columns that follows this
+    // connection's writes (SIMD where the CPU has it); otherwise in SQL.
+    // Another writer's commit that changes books makes the next call reload
+    // the copy; commits that leave books alone (maintenance) do not.
+    void enableColumnMirror();
+    ReadingTotals readingTotals(std::optional<int> statusFilter = std::nullopt);
+    StatusCounts statusCounts();
+    ProgressHistogram progressHistogram();
+
+    // Monte Carlo finish dates, sampling the pages read per day over the last
+    // historyDays (every current-page increase is logged). Each book forecast
+    // assumes all reading goes to that book. Trials run across threads until
+    // budgetMs is spent; seed 0 picks a random one. nullopt when nothing was
+    // read in that window.
+    std::optional<ReadingForecast> forecast(int budgetMs = 100, int historyDays = 90,
+                                            unsigned long long seed = 0);
+
+    std::optional<ExportStats> exportCsv(const std::string& path, ExportKey key = ExportKey::Id,
+                                         size_t memBudgetBytes = kDefaultExportBudget);
+    std::optional<CsvCheckpoint> csvCheckpoint(const std::string& path);
+    std::optional<CsvImportStats> importCsv(const std::string& path, bool resume = false);
+    int importCalibre(const std::string& path);    // books imported, or -1
+    std::optional<OnixImportStats> importOnix(const std::string& path);
+    std::optional<CsvOwnership> checkCsvOwnership(const std::string& path, int sampleLimit = 20);
+
+    // Title/author -> ISBN search, answered from a local cache when possible.
+    std::optional<ReverseHit> reverseLookup(const std::string& title, const std::string& author);
+    // Reverse-looks up every book without an ISBN, `concurrency` at a time.
+    ReverseFillStats fillMissingIsbns(int concurrency);
+
+    // Background upkeep (optimize, analyze, checkpoints, incremental vacuum).
+    void startMaintenance();
+    bool maintenanceRunning() const;
+    std::vector<MaintenanceTaskStats> maintenanceStats() const;
+    bool vacuumEnabled() const;
+
+    // Offline lookup queue, replayed in the background once back online. The
+    // worker starts right away only if the queue already holds rows, else on
+    // the first enqueueLookup(); lookupReplayRunning() is true from the call on.
+    // Its fetches are never shared with lookupIsbn() callers, so stopping it
+    // cannot fail theirs.
+    void startLookupReplay();
+    bool lookupReplayRunning() const;
+    bool enqueueLookup(const std::string& isbn13);
+    LookupQueueStats lookupQueueStats() const;
+    unsigned long long takeCompletedLookups();      // resolved since the last call
+
+    // Writes Prometheus text-format metrics (books by status, operation
+    // counts/latencies, provider lookups, cache hits, import volume) to
+    // promPath every intervalMs from a background thread, and once more on
+    // destruction. The file is replaced atomically, for node_exporter's
+    // textfile collector.
+    void startMetricsExport(const std::string& promPath, int intervalMs = 15000);
+    bool metricsExportRunning() const;
+    unsigned long long metricsWriteFailures() const;
+
+    // Marks the foreground busy while alive, so maintenance waits for idle time.
+    class ForegroundScope {
+    public:
+        explicit ForegroundScope(Library& lib);
+        ~ForegroundScope();
+        ForegroundScope(const ForegroundScope&) = delete;
+        ForegroundScope& operator=(const ForegroundScope&) = delete;
+    private:
+        Library& lib_;
+    };
+
+private:
+    struct Impl;
+    std::unique_ptr<Impl> impl_;
+};
+
+// ----------------------------- Benchmarks ----------------------------------
+// Unstable: for the CLI's --bench-* options, and may change in any release
+// without a kApiVersion bump. Each prints its report to `out` and returns a
+// process exit code.
+namespace bench {
+double percentile(std::vector<double>& sorted, double p);
+int executor(int tasks, std::ostream& out);
+int http(const std::string& url, int requests, std::ostream& out);
+// url set: times a plain GET of it instead of an ISBN lookup.
+int firstLookup(const std::string& isbn13, const std::optional<std::string>& url, int rounds, std::ostream& out);
+// Aggregate kernels (scalar vs. dispatched) over `rows` synthetic books.
+int columns(size_t rows, std::ostream& out);
+// Substring scans of the search heap over `rows` synthetic books.
+int substring(size_t rows, std::ostream& out);
+// Finish-date simulation for `books` synthetic in-progress books.
+int forecast(size_t books, int budgetMs, std::ostream& out);
+// Per-event cost of the async logger (to `path`) vs. logging off and vs. a
+// synchronous write of each line.
+int logging(size_t events, const std::string& path, std::ostream& out);
+// Lookup throughput and latency percentiles under each fault profile (every
+// preset when `profiles` is empty), `concurrency` lookups in flight on one
+// thread. url set: plain GETs of it instead of ISBN lookups.
+int faults(const std::string& isbn13, const std::optional<std::string>& url, int lookups,
+           int concurrency, const std::vector<FaultProfile>& profiles, std::ostream& out);
+}
+
+} // namespace booktracer
@@ -1,67 +1,24 @@
 // main.cpp — Console Book Tracer (SQLite + ISBN lookup)
-// Dependencies: sqlite3, libcurl, nlohmann/json (header-only)
+// A thin console client of libbooktracer (booktracer.h); all storage and
+// lookup logic lives in the library.
 
 #include <algorithm>
-#include <cctype>
+#include <chrono>
 #include <climits>
-#include <cmath>
 #include <cstdlib>
-#include <cstring>
+#include <filesystem>
 #include <fstream>
 #include <iomanip>
 #include <iostream>
 #include <optional>
-#include <regex>
-#include <sstream>
 #include <string>
+#include <thread>
+#include <unordered_map>
 #include <vector>
 
-#include <sqlite3.h>
-#include <curl/curl.h>
-// nlohmann/json is header-only; ensure include path is set via vcpkg or your environment.
-#include <nlohmann/json.hpp>
-
-struct Book {
-    int         id = 0;
-    std::string title;
-    std::string author;
-    int         totalPages = 0;
-    int         currentPage = 0;
-    int         status = 0;      // 0 To-Read, 1 Reading, 2 Finished
-    std::string isbn;            // optional
-};
-
-static bool g_useGoogleBooks = true;  // can be turned off if check fails
-
-enum class Status { ToRead=0, Reading=1, Finished=2 };
-
-static inline std::string statusToStr(Status s) {
-    switch (s) {
-        case Status::ToRead:  return "To-Read";
-        case Status::Reading: return "Reading";
-        case Status::Finished:return "Finished";
-    }
-    return "To-Read";
-}
-static inline std::optional<Status> strToStatus(const std::string& s) {
-    std::string t = s;
-    std::transform(t.begin(), t.end(), t.begin(), [](unsigned char c){ return std::tolower(c); });
-    if (t=="to-read" || t=="toread" || t=="todo" || t=="0") return Status::ToRead;
-    if (t=="reading" || t=="1") return Status::Reading;
-    if (t=="finished"|| t=="done" || t=="2") return Status::Finished;
-    return std::nullopt;
-}
+#include "booktracer.h"
 
-static inline double percentComplete(const Book& b) {
-    if (b.totalPages <= 0) return 0.0;
-    return 100.0 * static_cast<double>(b.currentPage) / static_cast<double>(b.totalPages);
-}
-static inline std::optional<int> daysToFinish(const Book& b, int dailyRate) {
-    if (dailyRate <= 0 || b.totalPages <= b.currentPage) return std::nullopt;
-    int remaining = b.totalPages - b.currentPage;
-    // ceil division:
-    return (remaining + dailyRate - 1) / dailyRate;
-}
+using namespace booktracer;
 
 // ----------------------------- Small IO helpers -----------------------------
 static int askInt(const std::string& prompt, int lo, int hi) {
@@ -84,55 +41,6 @@ static std::string askLine(const std::string& prompt, bool allowEmpty=false) {
     }
 }
 
-// ----------------------------- ISBN utilities ------------------------------
-static std::string onlyDigitsX(const std::string& s) {
-    std::string t; t.reserve(s.size());
-    for (char c: s) if (std::isdigit((unsigned char)c) || c=='X' || c=='x') t.push_back(c=='x'?'X':c);
-    return t;
-}
-static bool isIsbn10(const std::string& s) { return s.size()==10; }
-static bool isIsbn13(const std::string& s) { return s.size()==13; }
-
-// convert ISBN-10 to ISBN-13 (prefix 978 and recompute)
-static std::string isbn10to13(const std::string& s10) {
-    std::string core = "978" + s10.substr(0, 9);
-    int sum = 0;
-    for (int i=0;i<(int)core.size();++i) {
-        int d = core[i]-'0';
-        sum += (i%2==0) ? d : 3*d;
-    }
-    int cd = (10 - (sum % 10)) % 10;
-    return core + std::to_string(cd);
-}
-static std::string normalizeIsbn(const std::string& in) {
-    std::string s = onlyDigitsX(in);
-    if (isIsbn13(s)) return s;
-    if (isIsbn10(s)) return isbn10to13(s);
-    return ""; // invalid
-}
-
-// ----------------------------- HTTP via curl -------------------------------
-static size_t curlWrite(void* ptr, size_t size, size_t nmemb, void* userdata) {
-    auto* out = reinterpret_cast<std::string*>(userdata);
-    out->append(reinterpret_cast<const char*>(ptr), size*nmemb);
-    return size*nmemb;
-}
-static std::optional<std::string> httpGet(const std::string& url) {
-    CURL* curl = curl_easy_init();
-    if (!curl) return std::nullopt;
-    std::string buf;
-    curl_easy_setopt(curl, CURLOPT_URL, url.c_str());
-    curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1L);
-    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, curlWrite);
-    curl_easy_setopt(curl, CURLOPT_WRITEDATA, &buf);
-    curl_easy_setopt(curl, CURLOPT_USERAGENT, "BookTracer/1.0");
-    CURLcode res = curl_easy_perform(curl);
-    long code = 0;
-    curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &code);
-    curl_easy_cleanup(curl);
-    if (res != CURLE_OK || code < 200 || code >= 300) return std::nullopt;
-    return buf;
-}
 
 // Quick console status line
 static void printStep(const char* what, bool ok) {
@@ -140,382 +48,6 @@ static void printStep(const char* what, bool ok) {
               << (ok ? "Passed!\n" : "FAILED\n");
 }
 
-// Ultra-light internet probe (returns true on any 2xx)
-static bool internetOk() {
-    // 204 No Content on success; our httpGet treats 2xx as OK
-    return static_cast<bool>(httpGet("https://www.google.com/generate_204"));
-}
-
-// Quick Open Library ping (home page is fine; returns 200)
-static bool openLibraryOk() {
-    return static_cast<bool>(httpGet("https://openlibrary.org/"));
-}
-
-// Key presence only (no network). For full check we’ll still call googleBooksReady().
-static bool googleKeyPresent() {
-    const char* k = std::getenv("GOOGLE_BOOKS_API_KEY");
-    return k && *k;
-}
-
-// Quick Google Books API readiness check.
-// Returns true if key exists AND a tiny request succeeds (HTTP 2xx and no "error").
-static bool googleBooksReady() {
-    const char* key = std::getenv("GOOGLE_BOOKS_API_KEY");
-    if (!key || !*key) return false;  // no key
-
-    // Tiny request; OK even if totalItems==0
-    std::string url =
-        "https://www.googleapis.com/books/v1/volumes?q=isbn:0000000000000&maxResults=1&fields=totalItems&key=";
-    url += key;
-
-    if (auto body = httpGet(url)) {
-        try {
-            auto j = nlohmann::json::parse(*body);
-            if (j.contains("error")) return false;  // key invalid/blocked
-            return true;
-        } catch (...) {
-            return false; // not JSON -> treat as failure
-        }
-    }
-    return false; // network/HTTP error
-}
-
-
-struct LookupResult { std::string title; std::string author; };
-static std::optional<LookupResult> lookupIsbn(const std::string& rawIsbn) {
-    std::string isbn13 = normalizeIsbn(rawIsbn);
-    if (isbn13.empty()) return std::nullopt;
-
-    // 1) Open Library (no key)
-    {
-        std::string url = "https://openlibrary.org/isbn/" + isbn13 + ".json";
-        if (auto body = httpGet(url)) {
-            try {
-                auto j = nlohmann::json::parse(*body);
-                LookupResult r;
-                if (j.contains("title")) r.title = j["title"].get<std::string>();
-                // author handling: Open Library authors usually need a 2nd request;
-                // try by_statement if present, else leave blank and let Google fill.
-                if (j.contains("by_statement")) r.author = j["by_statement"].get<std::string>();
-                if (!r.title.empty()) {
-                    return r; // may have empty author, that's fine for now
-                }
-            } catch (...) {}
-        }
-    }
-
-    // 2) Google Books (needs key for higher reliability, but can work without)
-    if (g_useGoogleBooks) {
-        const char* key = std::getenv("GOOGLE_BOOKS_API_KEY");
-        std::ostringstream oss;
-        oss << "https://www.googleapis.com/books/v1/volumes?q=isbn:" << isbn13;
-        if (key && *key) oss << "&key=" << key;
-
-        if (auto body = httpGet(oss.str())) {
-            try {
-                auto j = nlohmann::json::parse(*body);
-                if (j.contains("items") && j["items"].is_array() && !j["items"].empty()) {
-                    auto vi = j["items"][0]["volumeInfo"];
-                    LookupResult r;
-                    if (vi.contains("title")) r.title = vi["title"].get<std::string>();
-                    if (vi.contains("authors") && vi["authors"].is_array() && !vi["authors"].empty())
-                        r.author = vi["authors"][0].get<std::string>();
-                    if (!r.title.empty() || !r.author.empty()) return r;
-                }
-            } catch (...) {}
-        }
-    }
-
-    return std::nullopt;
-}
-
-// ----------------------------- SQLite storage ------------------------------
-class SqliteStorage {
-public:
-    explicit SqliteStorage(const std::string& dbpath) {
-        if (sqlite3_open(dbpath.c_str(), &db_) != SQLITE_OK) {
-            std::cerr << "SQLite open failed: " << sqlite3_errmsg(db_) << "\n";
-            db_ = nullptr;
-        } else {
-            ensureSchema();
-        }
-    }
-    ~SqliteStorage() {
-        if (db_) sqlite3_close(db_);
-    }
-    bool ok() const { return db_ != nullptr; }
-
-    void ensureSchema() {
-        const char* sql =
-            "CREATE TABLE IF NOT EXISTS books ("
-            "  id INTEGER PRIMARY KEY AUTOINCREMENT,"
-            "  title TEXT NOT NULL,"
-            "  author TEXT,"
-            "  total_pages INTEGER NOT NULL,"
-            "  current_page INTEGER NOT NULL,"
-            "  status INTEGER NOT NULL,"
-            "  isbn TEXT"
-            ");";
-        exec(sql);
-
-        // NEW: key-value store for app settings
-        exec("CREATE TABLE IF NOT EXISTS settings ("
-            "  key TEXT PRIMARY KEY,"
-            "  value TEXT NOT NULL"
-            ");");
-
-        // Helpful index for LIKE searches on title/author
-        exec("CREATE INDEX IF NOT EXISTS idx_books_title ON books(title);");
-        exec("CREATE INDEX IF NOT EXISTS idx_books_author ON books(author);");
-        exec("CREATE INDEX IF NOT EXISTS idx_books_status ON books(status);");
-    }
-
-    int add(const Book& b) {
-        const char* sql =
-            "INSERT INTO books(title,author,total_pages,current_page,status,isbn)"
-            "VALUES(?,?,?,?,?,?);";
-        sqlite3_stmt* st=nullptr;
-        if (sqlite3_prepare_v2(db_, sql, -1, &st, nullptr) != SQLITE_OK) return -1;
-        sqlite3_bind_text(st, 1, b.title.c_str(), -1, SQLITE_TRANSIENT);
-        sqlite3_bind_text(st, 2, b.author.c_str(), -1, SQLITE_TRANSIENT);
-        sqlite3_bind_int (st, 3, b.totalPages);
-        sqlite3_bind_int (st, 4, b.currentPage);
-        sqlite3_bind_int (st, 5, b.status);
-        sqlite3_bind_text(st, 6, b.isbn.c_str(), -1, SQLITE_TRANSIENT);
-        int rc = sqlite3_step(st);
-        sqlite3_finalize(st);
-        if (rc != SQLITE_DONE) return -1;
-        return static_cast<int>(sqlite3_last_insert_rowid(db_));
-    }
-
-    bool updateProgress(int id, int currentPage, int status) {
-        const char* sql = "UPDATE books SET current_page=?, status=? WHERE id=?;";
-        sqlite3_stmt* st=nullptr;
-        if (sqlite3_prepare_v2(db_, sql, -1, &st, nullptr) != SQLITE_OK) return false;
-        sqlite3_bind_int(st, 1, currentPage);
-        sqlite3_bind_int(st, 2, status);
-        sqlite3_bind_int(st, 3, id);
-        int rc = sqlite3_step(st); sqlite3_finalize(st);
-        return rc == SQLITE_DONE;
-    }
-
-    bool updateStatus(int id, int status) {
-        const char* sql = "UPDATE books SET status=?, current_page=CASE WHEN ?=2 THEN total_pages ELSE current_page END WHERE id=?;";
-        sqlite3_stmt* st=nullptr;
-        if (sqlite3_prepare_v2(db_, sql, -1, &st, nullptr) != SQLITE_OK) return false;
-        sqlite3_bind_int(st, 1, status);
-        sqlite3_bind_int(st, 2, status);
-        sqlite3_bind_int(st, 3, id);
-        int rc = sqlite3_step(st); sqlite3_finalize(st);
-        return rc == SQLITE_DONE;
-    }
-
-    bool remove(int id) {
-        const char* sql = "DELETE FROM books WHERE id=?;";
-        sqlite3_stmt* st=nullptr;
-        if (sqlite3_prepare_v2(db_, sql, -1, &st, nullptr) != SQLITE_OK) return false;
-        sqlite3_bind_int(st, 1, id);
-        int rc = sqlite3_step(st); sqlite3_finalize(st);
-        return rc == SQLITE_DONE;
-    }
-
-    std::optional<Book> get(int id) {
-        const char* sql = "SELECT id,title,author,total_pages,current_page,status,isbn FROM books WHERE id=?;";
-        sqlite3_stmt* st=nullptr;
-        if (sqlite3_prepare_v2(db_, sql, -1, &st, nullptr) != SQLITE_OK) return std::nullopt;
-        sqlite3_bind_int(st, 1, id);
-        Book b;
-        if (sqlite3_step(st) == SQLITE_ROW) {
-            b.id          = sqlite3_column_int(st,0);
-            b.title       = reinterpret_cast<const char*>(sqlite3_column_text(st,1));
-            b.author      = reinterpret_cast<const char*>(sqlite3_column_text(st,2));
-            b.totalPages  = sqlite3_column_int(st,3);
-            b.currentPage = sqlite3_column_int(st,4);
-            b.status      = sqlite3_column_int(st,5);
-            const unsigned char* is = sqlite3_column_text(st,6);
-            b.isbn        = is ? reinterpret_cast<const char*>(is) : "";
-            sqlite3_finalize(st);
-            return b;
-        }
-        sqlite3_finalize(st);
-        return std::nullopt;
-    }
-
-    std::vector<Book> list(std::optional<int> statusFilter = std::nullopt) {
-        std::vector<Book> out;
-        std::string sql = "SELECT id,title,author,total_pages,current_page,status,isbn FROM books";
-        if (statusFilter) sql += " WHERE status=?";
-        sql += " ORDER BY id ASC;";
-        sqlite3_stmt* st=nullptr;
-        if (sqlite3_prepare_v2(db_, sql.c_str(), -1, &st, nullptr) != SQLITE_OK) return out;
-        if (statusFilter) sqlite3_bind_int(st, 1, *statusFilter);
-        while (sqlite3_step(st) == SQLITE_ROW) {
-            Book b;
-            b.id          = sqlite3_column_int(st,0);
-            b.title       = reinterpret_cast<const char*>(sqlite3_column_text(st,1));
-            b.author      = reinterpret_cast<const char*>(sqlite3_column_text(st,2));
-            b.totalPages  = sqlite3_column_int(st,3);
-            b.currentPage = sqlite3_column_int(st,4);
-            b.status      = sqlite3_column_int(st,5);
-            const unsigned char* is = sqlite3_column_text(st,6);
-            b.isbn        = is ? reinterpret_cast<const char*>(is) : "";
-            out.push_back(std::move(b));
-        }
-        sqlite3_finalize(st);
-        return out;
-    }
-
-    std::vector<Book> search(const std::string& q) {
-        std::vector<Book> out;
-        const char* sql =
-            "SELECT id,title,author,total_pages,current_page,status,isbn "
-            "FROM books WHERE lower(title) LIKE ? OR lower(author) LIKE ? ORDER BY id ASC;";
-        sqlite3_stmt* st=nullptr;
-        if (sqlite3_prepare_v2(db_, sql, -1, &st, nullptr) != SQLITE_OK) return out;
-        std::string pat = "%" + q + "%";
-        std::string patLower = pat;
-        std::transform(patLower.begin(), patLower.end(), patLower.begin(), [](unsigned char c){return std::tolower(c);});
-        sqlite3_bind_text(st, 1, patLower.c_str(), -1, SQLITE_TRANSIENT);
-        sqlite3_bind_text(st, 2, patLower.c_str(), -1, SQLITE_TRANSIENT);
-        while (sqlite3_step(st) == SQLITE_ROW) {
-            Book b;
-            b.id          = sqlite3_column_int(st,0);
-            b.title       = reinterpret_cast<const char*>(sqlite3_column_text(st,1));
-            b.author      = reinterpret_cast<const char*>(sqlite3_column_text(st,2));
-            b.totalPages  = sqlite3_column_int(st,3);
-            b.currentPage = sqlite3_column_int(st,4);
-            b.status      = sqlite3_column_int(st,5);
-            const unsigned char* is = sqlite3_column_text(st,6);
-            b.isbn        = is ? reinterpret_cast<const char*>(is) : "";
-            out.push_back(std::move(b));
-        }
-        sqlite3_finalize(st);
-        return out;
-    }
-
-    public:
-    // get daily rate (pages/day); 0 if unset
-    int getDailyRate() {
-        const char* sql = "SELECT value FROM settings WHERE key='daily_rate';";
-        sqlite3_stmt* st=nullptr;
-        if (sqlite3_prepare_v2(db_, sql, -1, &st, nullptr) != SQLITE_OK) return 0;
-        int rate = 0;
-        if (sqlite3_step(st) == SQLITE_ROW) {
-            const unsigned char* v = sqlite3_column_text(st, 0);
-            if (v) { try { rate = std::stoi(reinterpret_cast<const char*>(v)); } catch (...) {} }
-        }
-        sqlite3_finalize(st);
-        return std::max(0, rate);
-    }
-
-    bool setDailyRate(int rate) {
-        const char* sql = "INSERT INTO settings(key,value) VALUES('daily_rate',?) "
-                          "ON CONFLICT(key) DO UPDATE SET value=excluded.value;";
-        sqlite3_stmt* st=nullptr;
-        if (sqlite3_prepare_v2(db_, sql, -1, &st, nullptr) != SQLITE_OK) return false;
-        std::string s = std::to_string(std::max(0, rate));
-        sqlite3_bind_text(st, 1, s.c_str(), -1, SQLITE_TRANSIENT);
-        bool ok = (sqlite3_step(st) == SQLITE_DONE);
-        sqlite3_finalize(st);
-        return ok;
-    }
-
-    // CSV export/import -------------------------------------------------------
-    bool exportCsv(const std::string& path) {
-        std::ofstream out(path, std::ios::trunc);
-        if (!out) return false;
-        out << "id,title,author,totalPages,currentPage,status,isbn\n";
-        auto rows = list(std::nullopt);
-        for (const auto& b: rows) {
-            out << b.id << ","
-                << csvQuote(b.title) << ","
-                << csvQuote(b.author) << ","
-                << b.totalPages << ","
-                << b.currentPage << ","
-                << b.status << ","
-                << csvQuote(b.isbn) << "\n";
-        }
-        return true;
-    }
-    bool importCsv(const std::string& path) {
-        std::ifstream in(path);
-        if (!in) return false;
-        std::string line;
-        // skip header if present
-        if (!std::getline(in, line)) return false;
-        // naive header check
-        if (line.find("id,") == std::string::npos) {
-            // no header; handle it as data
-            in.clear();
-            in.seekg(0);
-        }
-
-        // transactional import
-        exec("BEGIN TRANSACTION;");
-        while (std::getline(in, line)) {
-            auto cols = csvParse(line);
-            if (cols.size() < 7) continue;
-            Book b;
-            // id column is ignored on insert (AUTOINCREMENT)
-            b.title       = cols[1];
-            b.author      = cols[2];
-            b.totalPages  = std::max(0, strToIntSafe(cols[3]));
-            b.currentPage = std::clamp(strToIntSafe(cols[4]), 0, b.totalPages);
-            b.status      = std::clamp(strToIntSafe(cols[5]), 0, 2);
-            b.isbn        = cols[6];
-            add(b);
-        }
-        exec("COMMIT;");
-        return true;
-    }
-
-private:
-    sqlite3* db_ = nullptr;
-
-    void exec(const char* sql) {
-        char* err = nullptr;
-        if (sqlite3_exec(db_, sql, nullptr, nullptr, &err) != SQLITE_OK) {
-            if (err) { std::cerr << "SQLite error: " << err << "\n"; sqlite3_free(err); }
-        }
-    }
-
-    static int strToIntSafe(const std::string& s) {
-        try { return std::stoi(s); } catch (...) { return 0; }
-        return 0;
-    }
-
-    static std::string csvQuote(const std::string& s) {
-        std::string out; out.reserve(s.size()+4);
-        out.push_back('"');
-        for (char c: s) {
-            if (c == '"') out += "\"\"";
-            else out.push_back(c);
-        }
-        out.push_back('"');
-        return out;
-    }
-    static std::vector<std::string> csvParse(const std::string& line) {
-        std::vector<std::string> cols;
-        std::string cur;
-        bool inQ=false;
-        for (size_t i=0;i<line.size();++i) {
-            char c=line[i];
-            if (inQ) {
-                if (c=='"') {
-                    if (i+1<line.size() && line[i+1]=='"') { cur.push_back('"'); ++i; }
-                    else inQ=false;
-                } else cur.push_back(c);
-            } else {
-                if (c==',') { cols.push_back(cur); cur.clear(); }
-                else if (c=='"') inQ=true;
-                else cur.push_back(c);
-            }
-        }
-        cols.push_back(cur);
-        return cols;
-    }
-};
-
 // ----------------------------- UI / printing -------------------------------
 static void printHeader() {
     std::cout << "\nID   "
@@ -548,14 +80,30 @@ static void printRow(const Book& b, int dailyRate) {
 }
 
 // ----------------------------- Flows ---------------------------------------
-static void listBooks(SqliteStorage& db, std::optional<Status> filter, int dailyRate) {
+static void listBooks(Library& db, std::optional<Status> filter, int dailyRate,
+                      SortBy sort = SortBy::Id) {
     printHeader();
-    auto rows = filter ? db.list(static_cast<int>(*filter)) : db.list(std::nullopt);
+    auto rows = filter ? db.list(static_cast<int>(*filter), sort, dailyRate) : db.list(std::nullopt, sort, dailyRate);
     if (rows.empty()) { std::cout << "(no books)\n"; return; }
     for (const auto& b: rows) printRow(b, dailyRate);
 }
 
-static void addManualFlow(SqliteStorage& db) {
+static void fillIsbnsReport(const ReverseFillStats& st, double secs) {
+    std::cout << "Books without ISBN: " << st.books << "  matched: " << st.matched
+              << "  already in library: " << st.duplicates << "  no match: " << st.noMatch
+              << "  failed: " << st.failed << "\n"
+              << "Searches: " << st.fetched << " fetched, " << st.cacheHits << " from cache ("
+              << std::fixed << std::setprecision(1) << secs << " s)\n";
+}
+
+static void fillIsbnsFlow(Library& db) {
+    if (!online()) { std::cout << "Offline: reverse lookup needs the network.\n"; return; }
+    auto t0 = std::chrono::steady_clock::now();
+    ReverseFillStats st = db.fillMissingIsbns(4);
+    fillIsbnsReport(st, std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count());
+}
+
+static void addManualFlow(Library& db) {
     Book b;
     b.title       = askLine("Title:");
     b.author      = askLine("Author (optional):", true);
@@ -569,21 +117,38 @@ static void addManualFlow(SqliteStorage& db) {
         else if (b.currentPage > 0) b.status = static_cast<int>(Status::Reading);
         else b.status = static_cast<int>(Status::ToRead);
     }
-    // ISBN optional
+    // ISBN optional; when left blank, try to find it from the title/author
     std::string isbn = askLine("ISBN-10/13 (optional):", true);
     b.isbn = normalizeIsbn(isbn);
+    if (isbn.empty() && online()) {
+        std::optional<ReverseHit> hit = db.reverseLookup(b.title, b.author);
+        if (hit && !db.bookWithIsbn(hit->isbn13)) {
+            std::cout << "Found ISBN " << hit->isbn13 << " (" << hit->title
+                      << (hit->author.empty() ? "" : " by " + hit->author) << "). Use it? [Y/n]: " << std::flush;
+            std::string ans; std::getline(std::cin, ans);
+            if (ans.empty() || ans[0]=='y' || ans[0]=='Y') b.isbn = hit->isbn13;
+        }
+    }
     int newId = db.add(b);
     if (newId>0) std::cout << "Added book with ID #" << newId << ".\n";
-    else std::cout << "Add failed.\n";
+    else std::cout << "Add failed: " << db.lastError() << "\n";
 }
 
-static void addIsbnFlow(SqliteStorage& db) {
+static void addIsbnFlow(Library& db) {
     std::string raw = askLine("Enter ISBN-10/13:");
     std::string isbn13 = normalizeIsbn(raw);
     if (isbn13.empty()) { std::cout << "Invalid ISBN.\n"; return; }
 
-    std::cout << "Looking up…\n";
-    auto lr = lookupIsbn(isbn13);
+    std::optional<LookupResult> lr;
+    if (online()) {
+        std::cout << "Looking up…\n";
+        lr = lookupIsbn(isbn13);
+        if (!lr && !internetOk()) setOnline(false);   // a failed lookup may just mean we went offline
+    }
+    // Offline: the ISBN is queued once the book exists; the title/author can
+    // be left blank and are filled in once the network is back.
+    bool queued = !lr && !online() && db.lookupReplayRunning();
+    if (queued) std::cout << "Offline: the lookup is queued and will run once you're back online.\n";
     Book b;
     b.isbn = isbn13;
 
@@ -597,7 +162,7 @@ static void addIsbnFlow(SqliteStorage& db) {
         std::cout << "No metadata found; entering manually.\n";
     }
 
-    if (b.title.empty())  b.title  = askLine("Title:");
+    if (b.title.empty())  b.title  = queued ? askLine("Title (Enter to fill in from the lookup):", true) : askLine("Title:");
     if (b.author.empty()) b.author = askLine("Author (optional):", true);
 
     b.totalPages  = askInt("Total pages (>=0):", 0, 2'000'000'000);
@@ -614,10 +179,12 @@ static void addIsbnFlow(SqliteStorage& db) {
 
     int newId = db.add(b);
     if (newId>0) std::cout << "Added book with ID #" << newId << ".\n";
-    else std::cout << "Add failed.\n";
+    else std::cout << "Add failed: " << db.lastError() << "\n";
+    if (queued && newId>0 && !db.enqueueLookup(isbn13))
+        std::cout << "Could not queue the lookup: " << db.lastError() << "\n";
 }
 
-static void updatePageFlow(SqliteStorage& db) {
+static void updatePageFlow(Library& db) {
     int id = askInt("Book ID:", 1, INT_MAX);
     auto ob = db.get(id);
     if (!ob) { std::cout << "Not found.\n"; return; }
@@ -628,26 +195,208 @@ static void updatePageFlow(SqliteStorage& db) {
     else if (page > 0) status = static_cast<int>(Status::Reading);
     else status = static_cast<int>(Status::ToRead);
     if (db.updateProgress(id, page, status)) std::cout << "Updated.\n";
-    else std::cout << "Update failed.\n";
+    else std::cout << "Update failed: " << db.lastError() << "\n";
 }
 
-static void markStatusFlow(SqliteStorage& db) {
+static void markStatusFlow(Library& db) {
     int id = askInt("Book ID:", 1, INT_MAX);
     auto ob = db.get(id);
     if (!ob) { std::cout << "Not found.\n"; return; }
     std::cout << "Set status: (0) To-Read  (1) Reading  (2) Finished\n";
     int s = askInt("Choice:", 0, 2);
     if (db.updateStatus(id, s)) std::cout << "Status updated.\n";
-    else std::cout << "Update failed.\n";
+    else std::cout << "Update failed: " << db.lastError() << "\n";
 }
 
-static void deleteFlow(SqliteStorage& db) {
+static void deleteFlow(Library& db) {
     int id = askInt("Book ID to delete:", 1, INT_MAX);
     if (db.remove(id)) std::cout << "Deleted.\n";
     else std::cout << "Not found.\n";
 }
 
-static void searchFlow(SqliteStorage& db, int dailyRate) {
+static bool importCsvReport(Library& db, const std::string& path, bool resume) {
+    auto t0 = std::chrono::steady_clock::now();
+    auto r = db.importCsv(path, resume);
+    double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+    if (!r) {
+        std::cout << "Import failed.";
+        if (db.csvCheckpoint(path)) std::cout << " Committed rows are kept; re-run with --resume to continue.";
+        std::cout << "\n";
+        return false;
+    }
+    long long fresh = r->rows - r->resumedRows;
+    if (r->resumedRows) std::cout << "Resumed at byte " << r->resumedOffset << " after " << r->resumedRows << " row(s).\n";
+    std::cout << "Imported " << fresh << " row(s) in " << std::fixed << std::setprecision(1) << secs << " s ("
+              << std::setprecision(0) << (secs > 0 ? fresh / secs : 0.0) << " rows/sec).\n";
+    if (r->rejected) {
+        std::cout << "Rejected " << r->rejected << " row(s):\n";
+        for (const auto& [reason, n]: r->rejectsByReason) std::cout << "  " << std::setw(8) << n << "  " << reason << "\n";
+        std::cout << std::left;
+        for (const auto& rj: r->sample)
+            std::cout << "  record #" << rj.record << (r->resumedRows ? " (since resume)" : "")
+                      << ": " << (rj.title.empty() ? "(no title)" : rj.title) << " - " << rj.reason << "\n";
+        if (r->rejected > static_cast<long long>(r->sample.size()))
+            std::cout << "  ... and " << (r->rejected - static_cast<long long>(r->sample.size())) << " more.\n";
+    }
+    return true;
+}
+
+static bool exportCsvReport(Library& db, const std::string& path, const std::string& keyName, size_t budget) {
+    auto key = exportKeyFromStr(keyName);
+    if (!key) { std::cout << "Unknown sort key: " << keyName << "\n"; return false; }
+    auto t0 = std::chrono::steady_clock::now();
+    auto r = db.exportCsv(path, *key, budget);
+    double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+    if (!r) { std::cout << "Export failed.\n"; return false; }
+    std::cout << "Exported " << r->rows << " row(s) in " << std::fixed << std::setprecision(2) << secs << " s";
+    if (r->runs) std::cout << " (" << r->runs << " sorted run(s) spilled, " << r->passes << " merge pass(es))";
+    std::cout << ".\n";
+    return true;
+}
+
+// --lookup-isbns FILE: one ISBN per line, all looked up concurrently on one
+// thread; prints isbn<TAB>title<TAB>author (blank fields when not found).
+static int lookupIsbnsMain(const std::string& path) {
+    std::ifstream in(path);
+    if (!in) { std::cerr << "Cannot open " << path << "\n"; return 1; }
+    std::vector<std::string> isbns;
+    for (std::string line; std::getline(in, line);) {
+        line.erase(std::remove_if(line.begin(), line.end(), [](unsigned char c){ return std::isspace(c); }), line.end());
+        if (!line.empty()) isbns.push_back(line);
+    }
+    std::vector<std::optional<LookupResult>> results = lookupIsbns(isbns);
+    size_t found = 0;
+    for (size_t i = 0; i < isbns.size(); ++i) {
+        std::cout << isbns[i] << "\t" << (results[i] ? results[i]->title : "") << "\t"
+                  << (results[i] ? results[i]->author : "") << "\n";
+        found += results[i].has_value();
+    }
+    LookupStats st = lookupStats();
+    std::cerr << found << "/" << isbns.size() << " ISBN(s) resolved; " << st.fetches
+              << " fetch(es), " << st.coalesced << " coalesced.\n";
+    return 0;
+}
+
+static void lookupStatsFlow(const Library& db) {
+    LookupStats st = lookupStats();
+    std::cout << "\nISBN lookups: " << st.lookups << "  network fetches: " << st.fetches
+              << "  coalesced: " << st.coalesced << "\n";
+    LookupQueueStats q = db.lookupQueueStats();
+    std::cout << "Offline queue: " << q.pending << " pending  " << q.resolved << " resolved ("
+              << q.booksUpdated << " book(s) updated)  " << q.givenUp << " given up  network "
+              << (q.online ? "online" : "offline") << "\n";
+}
+
+static void importCalibreFlow(Library& db) {
+    std::string path = askLine("Calibre metadata.db path:");
+    auto t0 = std::chrono::steady_clock::now();
+    int n = db.importCalibre(path);
+    auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - t0).count();
+    if (n < 0) std::cout << "Calibre import failed (not a Calibre library?).\n";
+    else std::cout << "Imported " << n << " book(s) in " << ms << " ms.\n";
+}
+
+static void importOnixFlow(Library& db) {
+    std::string path = askLine("ONIX XML path:");
+    auto t0 = std::chrono::steady_clock::now();
+    auto r = db.importOnix(path);
+    if (!r) { std::cout << "Cannot open file.\n"; return; }
+    double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+    if (r->dbError) std::cout << "Import stopped on a database error: " << db.lastError() << "\n";
+    std::cout << "Read " << r->products << " product(s), imported " << r->inserted
+              << ", skipped " << r->skipped << " without title (duplicates by ISBN are skipped too).\n"
+              << std::fixed << std::setprecision(0)
+              << (secs > 0 ? r->products / secs : 0.0) << " products/sec, "
+              << std::setprecision(1) << (secs > 0 ? r->bytes / secs / 1e6 : 0.0) << " MB/s\n";
+}
+
+static void checkCsvFlow(Library& db, int dailyRate) {
+    std::string path = askLine("CSV path (needs an isbn column):");
+    auto t0 = std::chrono::steady_clock::now();
+    auto r = db.checkCsvOwnership(path);
+    auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - t0).count();
+    if (!r) { std::cout << "Could not read the CSV (missing file or no isbn column).\n"; return; }
+    std::cout << r->owned << " of " << r->rows << " CSV row(s) are already in your library ("
+              << ms << " ms).\n";
+    if (r->sample.empty()) return;
+    printHeader();
+    for (const auto& b: r->sample) printRow(b, dailyRate);
+    if (r->owned > static_cast<long long>(r->sample.size()))
+        std::cout << "... and " << (r->owned - static_cast<long long>(r->sample.size())) << " more.\n";
+}
+
+static void maintenanceFlow(const Library& db) {
+    if (db.metricsExportRunning() && db.metricsWriteFailures())
+        std::cout << "Metrics export: " << db.metricsWriteFailures() << " write(s) failed.\n";
+    if (!db.maintenanceRunning()) { std::cout << "Background maintenance is off (--no-maintenance).\n"; return; }
+    std::cout << "\n" << std::left << std::setw(20) << "Task" << std::right << std::setw(8) << "Runs"
+              << std::setw(12) << "Total ms" << std::setw(10) << "Last ms" << std::setw(10) << "Max ms" << "\n";
+    for (const auto& t: db.maintenanceStats()) {
+        std::cout << std::left << std::setw(20) << t.name << std::right << std::setw(8) << t.runs
+                  << std::fixed << std::setprecision(2)
+                  << std::setw(12) << t.totalMs << std::setw(10) << t.lastMs << std::setw(10) << t.maxMs << "\n";
+    }
+    if (!db.vacuumEnabled())
+        std::cout << "Incremental vacuum is unavailable: this database predates auto_vacuum=INCREMENTAL\n"
+                     "(run PRAGMA auto_vacuum=INCREMENTAL; VACUUM; once to enable it).\n";
+    std::cout << std::left;
+}
+
+static void summaryFlow(Library& db) {
+    ReadingTotals t = db.readingTotals();
+    StatusCounts sc = db.statusCounts();
+    std::cout << "\nBooks: " << t.books << "  (to-read " << sc[0] << ", reading " << sc[1]
+              << ", finished " << sc[2] << ")\n"
+              << "Pages read: " << t.pagesRead << " of " << t.pagesTotal
+              << "  remaining: " << t.pagesRemaining << "\n";
+    ReadingTotals r = db.readingTotals(static_cast<int>(Status::Reading));
+    if (r.books) std::cout << "Currently reading: " << r.pagesRemaining << " page(s) left across "
+                           << r.books << " book(s)\n";
+    ProgressHistogram h = db.progressHistogram();
+    long long widest = std::max(1LL, *std::max_element(h.begin(), h.end()));
+    std::cout << "Progress:\n";
+    for (int b = 0; b < kProgressBins; ++b) {
+        std::string label = b + 1 < kProgressBins ? std::to_string(b * 10) + "-" + std::to_string(b * 10 + 9) + "%"
+                                                  : std::string("done");
+        std::cout << "  " << std::left << std::setw(8) << label << std::right << std::setw(8) << h[b] << "  "
+                  << std::string(static_cast<size_t>(40 * h[b] / widest), '#') << "\n";
+    }
+    std::cout << std::left;
+}
+
+static void forecastFlow(Library& db, int dailyRate) {
+    auto fc = db.forecast();
+    if (!fc) { std::cout << "No reading logged in the last 90 days yet; update a page count to start.\n"; return; }
+    auto when = [](const std::optional<int>& days, const std::string& date) {
+        return days ? date + " (" + std::to_string(*days) + "d)" : std::string("> 100 years");
+    };
+    std::cout << "\nFrom " << fc->historyDays << " day(s) of reading, " << std::fixed << std::setprecision(1)
+              << fc->pagesPerDay << " pages/day on average (" << fc->trials << " simulations each, "
+              << fc->ms << " ms)\n" << std::defaultfloat;
+    if (!fc->books.empty()) {
+        std::cout << std::left << std::setw(5) << "ID" << std::setw(32) << "Title" << std::setw(8) << "Left"
+                  << std::setw(20) << "Likely (P50)" << std::setw(20) << "Safe bet (P90)";
+        if (dailyRate > 0) std::cout << "At " << dailyRate << "/day";
+        std::cout << "\n";
+        std::unordered_map<int, Book> byId;
+        for (auto& b: db.list(static_cast<int>(Status::Reading))) byId.emplace(b.id, std::move(b));
+        for (const auto& f: fc->books) {
+            auto it = byId.find(f.bookId);
+            const Book* b = it != byId.end() ? &it->second : nullptr;
+            std::string title = b ? b->title : "";
+            if (title.size() > 30) title = title.substr(0, 29) + "~";
+            std::cout << std::setw(5) << f.bookId << std::setw(32) << title << std::setw(8) << f.pagesLeft
+                      << std::setw(20) << when(f.p50Days, f.p50Date) << std::setw(20) << when(f.p90Days, f.p90Date);
+            if (b) if (auto d = daysToFinish(*b, dailyRate)) std::cout << *d << "d";
+            std::cout << "\n";
+        }
+    }
+    std::cout << "Whole backlog (" << fc->backlog.pagesLeft << " pages): likely "
+              << when(fc->backlog.p50Days, fc->backlog.p50Date) << ", safe bet "
+              << when(fc->backlog.p90Days, fc->backlog.p90Date) << "\n";
+}
+
+static void searchFlow(Library& db, int dailyRate) {
     std::string q = askLine("Search title/author substring:");
     // lower the query for LIKE lower(...)
     std::transform(q.begin(), q.end(), q.begin(), [](unsigned char c){return std::tolower(c);});
@@ -657,41 +406,172 @@ static void searchFlow(SqliteStorage& db, int dailyRate) {
     for (const auto& b: matches) printRow(b, dailyRate);
 }
 
-// ----------------------------- main ----------------------------------------
-int main() {
-    std::ios::sync_with_stdio(false);
-    std::cin.tie(nullptr);
+// ----------------------------- Benchmarks ----------------------------------
+// Command-line options: --name=value or --name value.
+static std::optional<std::string> cliOption(const std::vector<std::string>& args, const std::string& name) {
+    for (size_t i = 0; i < args.size(); ++i) {
+        if (args[i] == name) return (i + 1 < args.size()) ? args[i+1] : std::string();
+        if (args[i].rfind(name + "=", 0) == 0) return args[i].substr(name.size() + 1);
+    }
+    return std::nullopt;
+}
+static bool cliFlag(const std::vector<std::string>& args, const std::string& name) {
+    return std::find(args.begin(), args.end(), name) != args.end();
+}
+static int cliInt(const std::vector<std::string>& args, const std::string& name, int def) {
+    auto v = cliOption(args, name);
+    if (!v) return def;
+    try { return std::stoi(*v); } catch (...) { return def; }
+}
+// --metrics-file PATH (or BOOKTRACER_METRICS_FILE) [--metrics-interval SEC]
+static void startMetricsExport(Library& db, const std::vector<std::string>& args) {
+    std::optional<std::string> path = cliOption(args, "--metrics-file");
+    if (!path) if (const char* env = std::getenv("BOOKTRACER_METRICS_FILE")) path = env;
+    if (!path || path->empty()) return;
+    db.startMetricsExport(*path, 1000 * std::max(1, cliInt(args, "--metrics-interval", 15)));
+}
+
+// Child side of --bench-contention: <db> <ops> <outfile>. Each op is one
+// BEGIN IMMEDIATE / INSERT / COMMIT write transaction. outfile gets the
+// committed and failed counts, then the latency (us) of each committed op.
+static int benchWriterMain(const std::vector<std::string>& args, int busyTimeoutMs) {
+    if (args.size() < 4) return 2;
+    int ops = std::max(1, std::atoi(args[2].c_str()));
+    Library db(args[1], busyTimeoutMs);
+    if (!db.ok()) return 1;
+    std::vector<double> lat; lat.reserve(ops);
+    int failures = 0;
+    std::vector<Book> one(1);
+    one[0].title = "contention";
+    one[0].totalPages = 100;
+    for (int i = 0; i < ops; ++i) {
+        auto t0 = std::chrono::steady_clock::now();
+        if (db.addMany(one) < 0) { ++failures; continue; }
+        lat.push_back(std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - t0).count());
+    }
+    std::ofstream out(args[3], std::ios::trunc);
+    out << lat.size() << " " << failures << "\n";
+    for (double us: lat) out << us << "\n";
+    return out ? 0 : 1;
+}
 
-    // init curl once per process
-    curl_global_init(CURL_GLOBAL_DEFAULT);
+// --bench-contention N [--ops M]: N writer processes hammer one database.
+static int benchContentionMain(const std::string& self, int writers, int ops, int busyTimeoutMs) {
+    namespace fs = std::filesystem;
+    fs::path dir = fs::temp_directory_path();
+    fs::path dbPath = dir / "booktracer_contention.db";
+    for (const char* sfx: {"", "-wal", "-shm"}) fs::remove(dbPath.string() + sfx);
+    { Library init(dbPath.string(), busyTimeoutMs); if (!init.ok()) return 1; }
+
+    std::cout << "Contention benchmark: " << writers << " writer process(es) x " << ops
+              << " write transaction(s), busy timeout " << busyTimeoutMs << " ms\n";
+    std::vector<fs::path> outs;
+    std::vector<std::thread> procs;
+    auto t0 = std::chrono::steady_clock::now();
+    for (int w = 0; w < writers; ++w) {
+        outs.push_back(dir / ("booktracer_contention_" + std::to_string(w) + ".txt"));
+        std::string cmd = "\"" + self + "\" --bench-writer \"" + dbPath.string() + "\" " + std::to_string(ops)
+                        + " \"" + outs.back().string() + "\" --busy-timeout=" + std::to_string(busyTimeoutMs);
+#ifdef _WIN32
+        cmd = "\"" + cmd + "\"";   // cmd.exe /c strips the outermost pair of quotes
+#endif
+        procs.emplace_back([cmd]{ (void)std::system(cmd.c_str()); });
+    }
+    for (auto& t: procs) t.join();
+    double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+
+    std::vector<double> lat;
+    long long okOps = 0, failures = 0;
+    for (const auto& o: outs) {
+        std::ifstream in(o);
+        long long c = 0, f = 0;
+        if (!(in >> c >> f)) { failures += ops; continue; }   // child crashed
+        okOps += c;
+        failures += f;
+        for (double us; in >> us;) lat.push_back(us);
+        in.close();
+        fs::remove(o);
+    }
+    for (const char* sfx: {"", "-wal", "-shm"}) fs::remove(dbPath.string() + sfx);
+    std::sort(lat.begin(), lat.end());
+
+    std::cout << std::fixed << std::setprecision(1)
+              << "  committed: " << okOps << "  failed: " << failures << "  wall: " << secs << " s\n"
+              << "  throughput: " << (secs > 0 ? okOps / secs : 0.0) << " tx/s\n"
+              << "  latency ms  p50 " << bench::percentile(lat, 0.50) / 1000
+              << "  p90 " << bench::percentile(lat, 0.90) / 1000
+              << "  p99 " << bench::percentile(lat, 0.99) / 1000
+              << "  max " << (lat.empty() ? 0.0 : lat.back() / 1000) << "\n";
+    return failures ? 1 : 0;
+}
 
-    SqliteStorage db("books.db");
+// --bench-first-lookup [--isbn X] [--url U] [--rounds N]: latency of the
+// first lookup of a session, cold vs. pre-warmed. --url times a plain GET of
+// U instead of an ISBN lookup.
+static int benchFirstLookupMain(const std::vector<std::string>& args) {
+    std::string isbn = normalizeIsbn(cliOption(args, "--isbn").value_or("9780141036144"));
+    std::optional<std::string> url = cliOption(args, "--url");
+    if (!url && isbn.empty()) { std::cerr << "Invalid ISBN.\n"; return 2; }
+    return bench::firstLookup(isbn, url, cliInt(args, "--rounds", 3), std::cout);
+}
+
+// --bench-faults [--isbn X] [--url U] [--lookups N] [--concurrency N]
+// [--faults SPEC]: lookups under each fault preset, or only under SPEC.
+static int benchFaultsMain(const std::vector<std::string>& args) {
+    std::string isbn = normalizeIsbn(cliOption(args, "--isbn").value_or("9780141036144"));
+    std::optional<std::string> url = cliOption(args, "--url");
+    if (!url && isbn.empty()) { std::cerr << "Invalid ISBN.\n"; return 2; }
+    std::vector<FaultProfile> profiles;
+    if (auto p = faultProfile()) profiles.push_back(*p);
+    return bench::faults(isbn, url, cliInt(args, "--lookups", 200), cliInt(args, "--concurrency", 16),
+                         profiles, std::cout);
+}
+
+// --fill-isbns [--concurrency N]
+static int fillIsbnsMain(const std::vector<std::string>& args, int busyTimeoutMs) {
+    Library db("books.db", busyTimeoutMs);
+    if (!db.ok()) return 1;
+    auto t0 = std::chrono::steady_clock::now();
+    ReverseFillStats st = db.fillMissingIsbns(std::max(1, cliInt(args, "--concurrency", 4)));
+    fillIsbnsReport(st, std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count());
+    return st.failed ? 1 : 0;
+}
+
+// ----------------------------- main ----------------------------------------
+// The interactive session. Returns before main() tears down the network
+// state, so the library's background workers are stopped by then.
+static int interactiveMain(const std::vector<std::string>& args, int busyTimeoutMs) {
+    Library db("books.db", busyTimeoutMs);
     if (!db.ok()) {
-        std::cerr << "Failed to open books.db\n";
-        curl_global_cleanup();
+        std::cerr << "Failed to open books.db: " << db.lastError() << "\n";
         return 1;
     }
 
+    db.warmUp();   // overlaps statement preparation with the checks below
+    if (!cliFlag(args, "--no-maintenance")) db.startMaintenance();
+    startMetricsExport(db, args);
+    db.enableColumnMirror();
+    db.enableSearchHeap();
+
     // ------- Startup diagnostics -------
     std::cout << "\nRunning startup checks…\n";
-
-    bool netOK   = internetOk();                   printStep("Connecting to the internet…", netOK);
-    bool keyOK   = googleKeyPresent();             printStep("Getting the Google API key…", keyOK);
-
-    bool gapiOK  = false;
-    if (netOK && keyOK) {
-        gapiOK = googleBooksReady();               printStep("Contacting Google Books API…", gapiOK);
-    } else {
-        printStep("Contacting Google Books API…", false);
-    }
-
-    bool olOK    = netOK && openLibraryOk();       printStep("Connecting to Open Library…", olOK);
+    ProbeResult probe = probeProviders();
+    bool netOK  = probe.internet;
+    bool gapiOK = probe.googleBooks;
+    bool olOK   = probe.openLibrary;
+    printStep("Connecting to the internet…", netOK);
+    printStep("Getting the Google API key…", probe.googleKey);
+    printStep("Contacting Google Books API…", gapiOK);
+    printStep("Connecting to Open Library…", olOK);
 
     // Decide how to proceed
-    g_useGoogleBooks = gapiOK; // use Google Books this run only if it’s truly ready
+    setUseGoogleBooks(gapiOK); // use Google Books this run only if it’s truly ready
+
+    // The probes left pooled connections behind; keep them usable for lookups.
+    if (netOK && !cliFlag(args, "--no-keep-warm")) startKeepWarm();
 
     if (!netOK) {
-        std::cout << "\nNo internet connection. You can continue but ISBN lookup will be manual.\n";
+        std::cout << "\nNo internet connection. ISBNs you add are queued and looked up once you're back online.\n";
     } else if (!gapiOK && !olOK) {
         std::cout << "\nNeither Google Books nor Open Library is reachable right now.\n"
                     "You can continue without online lookup, or exit and fix your network.\n";
@@ -702,11 +582,17 @@ int main() {
                     "Choice: " << std::flush;
         std::string ans; std::getline(std::cin, ans);
         if (!ans.empty() && ans[0]=='1') { std::cout << "Bye!\n"; return 0; }
-        g_useGoogleBooks = false;
+        setUseGoogleBooks(false);
     }
 
+    // Replays ISBN lookups queued while offline once the network is back.
+    setOnline(netOK);
+    db.startLookupReplay();
+
     int dailyRate = db.getDailyRate();
     while (true) {
+        if (auto n = db.takeCompletedLookups())
+            std::cout << "\n" << n << " queued ISBN lookup(s) completed in the background.\n";
         std::cout << "\n====== Book Tracer (SQLite) ======\n"
                   << "1) List books\n"
                   << "2) Add book (manual)\n"
@@ -719,11 +605,19 @@ int main() {
                   << "9) Set daily reading rate (pages/day) [current: " << dailyRate << "]\n"
                   << "10) Export CSV\n"
                   << "11) Import CSV\n"
-                  << "12) Exit\n"
+                  << "12) Import Calibre library\n"
+                  << "13) Import ONIX XML feed\n"
+                  << "14) Check CSV against library (no import)\n"
+                  << "15) Maintenance & lookup status\n"
+                  << "16) Find missing ISBNs (search by title/author)\n"
+                  << "17) Reading summary\n"
+                  << "18) Finish-date forecast\n"
+                  << "19) Exit\n"
                   << "Choice: " << std::flush;
 
         std::string s; if (!std::getline(std::cin, s)) break;
         int choice = 0; try { choice = std::stoi(s); } catch (...) { choice = 0; }
+        Library::ForegroundScope busy(db);
 
         switch (choice) {
             case 1: listBooks(db, std::nullopt, dailyRate); break;
@@ -736,10 +630,12 @@ int main() {
             case 8: {
                 std::cout << "Filter: (0) All  (1) To-Read  (2) Reading  (3) Finished\n";
                 int c = askInt("Choice:", 0, 3);
-                if (c==0) listBooks(db, std::nullopt, dailyRate);
-                else if (c==1) listBooks(db, Status::ToRead, dailyRate);
-                else if (c==2) listBooks(db, Status::Reading, dailyRate);
-                else listBooks(db, Status::Finished, dailyRate);
+                std::cout << "Sort: (0) ID  (1) Progress  (2) ETA  (3) Title  (4) Author\n";
+                auto sort = static_cast<SortBy>(askInt("Choice:", 0, 4));
+                if (c==0) listBooks(db, std::nullopt, dailyRate, sort);
+                else if (c==1) listBooks(db, Status::ToRead, dailyRate, sort);
+                else if (c==2) listBooks(db, Status::Reading, dailyRate, sort);
+                else listBooks(db, Status::Finished, dailyRate, sort);
                 break;
             }
             case 9: {
@@ -752,25 +648,136 @@ int main() {
 
             case 10: {
                 std::string path = askLine("Export CSV path (e.g., books.csv):");
-                if (db.exportCsv(path)) std::cout << "Exported.\n";
-                else std::cout << "Export failed.\n";
+                std::string key = askLine("Sort by id/title/author/isbn/pages/progress/status (Enter = id):", true);
+                exportCsvReport(db, path, key, kDefaultExportBudget);
                 break;
             }
             case 11: {
                 std::string path = askLine("Import CSV path:");
-                if (db.importCsv(path)) std::cout << "Imported.\n";
-                else std::cout << "Import failed.\n";
+                bool resume = false;
+                if (auto cp = db.csvCheckpoint(path)) {
+                    std::cout << "An earlier import of this file stopped after " << cp->rows
+                              << " row(s). Resume? [Y/n]: " << std::flush;
+                    std::string ans; std::getline(std::cin, ans);
+                    resume = ans.empty() || ans[0]=='y' || ans[0]=='Y';
+                }
+                importCsvReport(db, path, resume);
                 break;
             }
-            case 12:
+            case 12: importCalibreFlow(db); break;
+            case 13: importOnixFlow(db); break;
+            case 14: checkCsvFlow(db, dailyRate); break;
+            case 15: maintenanceFlow(db); lookupStatsFlow(db); break;
+            case 16: fillIsbnsFlow(db); break;
+            case 17: summaryFlow(db); break;
+            case 18: forecastFlow(db, dailyRate); break;
+            case 19:
                 std::cout << "Bye!\n";
-                curl_global_cleanup();
                 return 0;
             default:
                 std::cout << "Invalid choice.\n"; break;
         }
     }
-
-    curl_global_cleanup();
     return 0;
 }
+
+int main(int argc, char** argv) {
+    std::ios::sync_with_stdio(false);
+    std::cin.tie(nullptr);
+
+    // Options: --busy-timeout=MS (or BOOKTRACER_BUSY_TIMEOUT_MS), --no-maintenance,
+    //          --import-csv PATH [--resume],
+    //          --export-csv PATH [--sort-key id|title|author|isbn|pages|progress|status] [--mem-mb N],
+    //          --no-keep-warm, --lookup-isbns FILE, --fill-isbns [--concurrency N],
+    //          --metrics-file PATH [--metrics-interval SEC] (or BOOKTRACER_METRICS_FILE),
+    //          --log-file PATH (or BOOKTRACER_LOG_FILE) [--log-level debug|info|warn|error],
+    //          --bench-log [--events N] [--log-file PATH],
+    //          --bench-contention N [--ops M], --bench-executor [--tasks N],
+    //          --bench-columns [--rows N], --bench-substring [--rows N],
+    //          --bench-forecast [--books N] [--budget-ms N],
+    //          --bench-http URL [--requests N],
+    //          --bench-first-lookup [--isbn X] [--url U] [--rounds N],
+    //          --faults SPEC (or BOOKTRACER_FAULTS): inject HTTP faults, e.g. "flaky,seed=7",
+    //          --bench-faults [--isbn X] [--url U] [--lookups N] [--concurrency N] [--faults SPEC]
+    std::vector<std::string> args(argv + 1, argv + argc);
+    int busyTimeoutMs = Library::kDefaultBusyTimeoutMs;
+    if (const char* env = std::getenv("BOOKTRACER_BUSY_TIMEOUT_MS")) {
+        try { busyTimeoutMs = std::stoi(env); } catch (...) {}
+    }
+    busyTimeoutMs = cliInt(args, "--busy-timeout", busyTimeoutMs);
+
+    if (cliOption(args, "--bench-log")) {
+#ifdef _WIN32
+        const char* nullDevice = "NUL";
+#else
+        const char* nullDevice = "/dev/null";
+#endif
+        return bench::logging(static_cast<size_t>(std::max(1, cliInt(args, "--events", 1000000))),
+                              cliOption(args, "--log-file").value_or(nullDevice), std::cout);
+    }
+    // JSON-lines event log; flushed at exit
+    std::optional<std::string> logFile = cliOption(args, "--log-file");
+    if (!logFile) if (const char* env = std::getenv("BOOKTRACER_LOG_FILE")) logFile = env;
+    if (logFile && !logFile->empty()) {
+        auto level = logLevelFromStr(cliOption(args, "--log-level").value_or("info"));
+        if (!level) { std::cerr << "Unknown --log-level (debug, info, warn, error, off).\n"; return 2; }
+        if (!startLogging(*logFile, *level)) std::cerr << "Cannot open log file " << *logFile << "\n";
+    }
+    // HTTP fault injection, for testing how lookups cope with a bad network
+    std::optional<std::string> faultSpec = cliOption(args, "--faults");
+    if (!faultSpec) if (const char* env = std::getenv("BOOKTRACER_FAULTS")) faultSpec = env;
+    if (faultSpec && !faultSpec->empty()) {
+        auto profile = faultProfileFromStr(*faultSpec);
+        if (!profile) {
+            std::cerr << "Bad --faults spec. Presets: none, slow, flaky, ratelimited, truncated, timeouts;\n"
+                         "overrides: latency, sigma, timeout, timeout-ms, 5xx, 429, truncate, seed.\n";
+            return 2;
+        }
+        setFaultProfile(profile);
+    }
+
+    if (!args.empty() && args[0] == "--bench-writer") return benchWriterMain(args, busyTimeoutMs);
+    if (auto csv = cliOption(args, "--import-csv")) {
+        Library db("books.db", busyTimeoutMs);
+        startMetricsExport(db, args);
+        return db.ok() && importCsvReport(db, *csv, cliFlag(args, "--resume")) ? 0 : 1;
+    }
+    if (auto csv = cliOption(args, "--export-csv")) {
+        Library db("books.db", busyTimeoutMs);
+        startMetricsExport(db, args);
+        size_t budget = static_cast<size_t>(std::max(1, cliInt(args, "--mem-mb", 64))) << 20;
+        return db.ok() && exportCsvReport(db, *csv, cliOption(args, "--sort-key").value_or("id"), budget) ? 0 : 1;
+    }
+    if (cliOption(args, "--bench-executor"))
+        return bench::executor(std::max(1, cliInt(args, "--tasks", 100000)), std::cout);
+    if (cliOption(args, "--bench-columns"))
+        return bench::columns(static_cast<size_t>(std::max(1, cliInt(args, "--rows", 1000000))), std::cout);
+    if (cliOption(args, "--bench-substring"))
+        return bench::substring(static_cast<size_t>(std::max(1, cliInt(args, "--rows", 1000000))), std::cout);
+    if (cliOption(args, "--bench-forecast"))
+        return bench::forecast(static_cast<size_t>(std::max(1, cliInt(args, "--books", 1000))),
+                               std::max(1, cliInt(args, "--budget-ms", 100)), std::cout);
+    if (cliOption(args, "--bench-contention"))
+        return benchContentionMain(argv[0], std::max(1, cliInt(args, "--bench-contention", 4)),
+                                   std::max(1, cliInt(args, "--ops", 200)), busyTimeoutMs);
+
+    // network state is set up once per process
+    globalInit();
+    int rc = 0;
+    if (auto url = cliOption(args, "--bench-http")) {
+        rc = bench::http(*url, std::max(1, cliInt(args, "--requests", 1000)), std::cout);
+    } else if (cliOption(args, "--bench-first-lookup")) {
+        rc = benchFirstLookupMain(args);
+    } else if (cliOption(args, "--bench-faults")) {
+        rc = benchFaultsMain(args);
+    } else if (cliOption(args, "--fill-isbns")) {
+        rc = fillIsbnsMain(args, busyTimeoutMs);
+    } else if (auto list = cliOption(args, "--lookup-isbns")) {
+        setUseGoogleBooks(googleKeyPresent());
+        rc = lookupIsbnsMain(*list);
+    } else {
+        rc = interactiveMain(args, busyTimeoutMs);
+    }
+    globalCleanup();
+    return rc;
+}